@@ -0,0 +1,498 @@
+// SPDX-License-Identifier: GPL-2.0
+/* KUnit tests for the effect encoders. Each backend encodes a fixed series
+ * of uploads and updates, the packets go through its send_packet, which is
+ * swapped for one that only captures them, and are compared against the
+ * vectors in force-effects.txt and force-effects-t500.txt. Built with
+ * `make kunit`, see the README.
+ *
+ * There are two kinds of vectors. The golden vectors were produced by the
+ * encoders themselves, they only catch an encoder changing its output. The
+ * capture vectors are packets captured on the USB interface, they catch the
+ * encoder getting the wire format wrong. */
+#include <kunit/test.h>
+#include <linux/hid.h>
+#include "hid-tmff2.h"
+#include "hid-tmt500rs.h"
+
+/* a vector is a list of packets, each its length followed by its bytes.
+ * Trailing zeros are left out, like in the text files */
+#define TMFF2_TEST_VECTOR_SIZE	128
+#define P(...) sizeof((u8[]){ __VA_ARGS__ }), __VA_ARGS__
+
+/* a new effect is uploaded, anything else acts on the one before */
+#define TMFF2_TEST_UPDATE	0
+#define TMFF2_TEST_UPLOAD	1
+#define TMFF2_TEST_PLAY		2
+#define TMFF2_TEST_STOP		3
+
+struct tmff2_test_step {
+	const char *name;
+	int action;
+	struct ff_effect effect;
+};
+
+/* same inputs as the golden vectors, direction 0x4000 so the levels go out
+ * unscaled. Encoder-derived, see above */
+static const struct tmff2_test_step tmff2_test_steps[] = {
+	{ "constant upload", TMFF2_TEST_UPLOAD, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay.length = 1000,
+		.u.constant = { .level = 0x2000, .envelope = {
+			.attack_length = 100, .attack_level = 0x1000 } } } },
+	{ "constant update, level 0x2000 -> 0x3000", TMFF2_TEST_UPDATE, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay.length = 1000,
+		.u.constant = { .level = 0x3000, .envelope = {
+			.attack_length = 100, .attack_level = 0x1000 } } } },
+	{ "constant update, attack_level 0x2000, fade_length 200, fade_level 0x1000", TMFF2_TEST_UPDATE, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay.length = 1000,
+		.u.constant = { .level = 0x3000, .envelope = {
+			.attack_length = 100, .attack_level = 0x2000,
+			.fade_length = 200, .fade_level = 0x1000 } } } },
+	{ "constant update, length 1000 -> 500", TMFF2_TEST_UPDATE, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay.length = 500,
+		.u.constant = { .level = 0x3000, .envelope = {
+			.attack_length = 100, .attack_level = 0x2000,
+			.fade_length = 200, .fade_level = 0x1000 } } } },
+	{ "periodic (sine) upload", TMFF2_TEST_UPLOAD, {
+		.type = FF_PERIODIC, .id = 1, .direction = 0x4000,
+		.u.periodic = { .waveform = FF_SINE, .magnitude = 0x4000,
+			.period = 100 } } },
+	{ "periodic update, magnitude 0x2000, period 50", TMFF2_TEST_UPDATE, {
+		.type = FF_PERIODIC, .id = 1, .direction = 0x4000,
+		.u.periodic = { .waveform = FF_SINE, .magnitude = 0x2000,
+			.period = 50 } } },
+	{ "ramp upload", TMFF2_TEST_UPLOAD, {
+		.type = FF_RAMP, .id = 2, .direction = 0x4000,
+		.replay.length = 2000,
+		.u.ramp = { .start_level = 0x1000, .end_level = 0x3000 } } },
+	{ "ramp update, end_level 0x3000 -> 0x4000", TMFF2_TEST_UPDATE, {
+		.type = FF_RAMP, .id = 2, .direction = 0x4000,
+		.replay.length = 2000,
+		.u.ramp = { .start_level = 0x1000, .end_level = 0x4000 } } },
+	{ "spring upload, spring_level 30", TMFF2_TEST_UPLOAD, {
+		.type = FF_SPRING, .id = 3,
+		.u.condition[0] = { .right_coeff = 0x4000,
+			.left_coeff = 0x4000 } } },
+	{ "spring update, right_coeff 0x2000, left_coeff 0x6000, deadband 0x100", TMFF2_TEST_UPDATE, {
+		.type = FF_SPRING, .id = 3,
+		.u.condition[0] = { .right_coeff = 0x2000,
+			.left_coeff = 0x6000, .deadband = 0x100 } } },
+	{ "damper upload, damper_level 30", TMFF2_TEST_UPLOAD, {
+		.type = FF_DAMPER, .id = 4,
+		.u.condition[0] = { .right_coeff = 0x4000,
+			.left_coeff = 0x4000 } } },
+};
+
+static const u8 t300rs_test_vectors[][TMFF2_TEST_VECTOR_SIZE] = {
+	{ P(0x00, 0x01, 0x6a, 0x00, 0x20, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4f, 0xe7,
+	    0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x01, 0x0a, 0x00, 0x30),
+	  P(0x00, 0x01, 0x31, 0x82, 0x00, 0x06) },
+	{ P(0x00, 0x01, 0x31, 0x82, 0x00, 0x0c),
+	  P(0x00, 0x01, 0x31, 0x84, 0x06),
+	  P(0x00, 0x01, 0x31, 0x88, 0x00, 0x06) },
+	{ P(0x00, 0x01, 0x31, 0x81, 0x01),
+	  P(0x00, 0x01, 0x31, 0x84, 0x03),
+	  P(0x00, 0x01, 0x49, 0x00, 0x41, 0xf3, 0x01) },
+	{ P(0x00, 0x02, 0x6b, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x4f, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x02, 0x0e, 0x01, 0x00, 0x20),
+	  P(0x00, 0x02, 0x0e, 0x08, 0x32) },
+	{ P(0x00, 0x03, 0x6b, 0x00, 0x20, 0x00, 0x30, 0x00, 0x00, 0xcf, 0x07, 0x00, 0x80, 0x00, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x4f, 0xcf, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x03, 0x0e, 0x03, 0x00, 0x30, 0x00, 0x40) },
+	{ P(0x00, 0x04, 0x64, 0x33, 0x13, 0x33, 0x13, 0xfe, 0xff, 0xfe, 0xff, 0xa6, 0x6a, 0xa6, 0x6a, 0xfe,
+	    0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfe, 0xff, 0xdf, 0x58, 0xa6, 0x6a, 0x06, 0x4f, 0xff, 0xff, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x04, 0x0e, 0x4c, 0xfe, 0xfe, 0xfe, 0xfe),
+	  P(0x00, 0x04, 0x0e, 0x41, 0x99, 0x09),
+	  P(0x00, 0x04, 0x0e, 0x42, 0xcc, 0x1c) },
+	{ P(0x00, 0x05, 0x64, 0x33, 0x13, 0x33, 0x13, 0xfe, 0xff, 0xfe, 0xff, 0xfc, 0x7f, 0xfc, 0x7f, 0xfe,
+	    0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfc, 0x7f, 0xfc, 0x7f, 0x07, 0x4f, 0xff, 0xff, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+};
+
+static const u8 t500rs_test_vectors[][TMFF2_TEST_VECTOR_SIZE] = {
+	{ P(0x00, 0x01, 0x6a, 0x00, 0x20, 0x03, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4f, 0xe8,
+	    0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x01, 0x0a, 0x00, 0x30),
+	  P(0x00, 0x01, 0x31, 0x82, 0x00, 0x06) },
+	{ P(0x00, 0x01, 0x31, 0x82, 0x00, 0x0c),
+	  P(0x00, 0x01, 0x31, 0x84, 0x06),
+	  P(0x00, 0x01, 0x31, 0x88, 0x00, 0x06) },
+	{ P(0x00, 0x01, 0x31, 0x81, 0x01),
+	  P(0x00, 0x01, 0x31, 0x84, 0x03),
+	  P(0x00, 0x01, 0x49, 0x00, 0x41, 0xf4, 0x01) },
+	{ P(0x00, 0x02, 0x6b, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x64, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x4f, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x02, 0x0e, 0x01, 0x00, 0x20),
+	  P(0x00, 0x02, 0x0e, 0x08, 0x32) },
+	{ P(0x00, 0x03, 0x6b, 0x00, 0x20, 0x00, 0x30, 0x00, 0x00, 0xd0, 0x07, 0x00, 0x80, 0x00, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x4f, 0xd0, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+	    0xff) },
+	{ P(0x00, 0x03, 0x0e, 0x03, 0x00, 0x30, 0x00, 0x40) },
+	{ P(0x00, 0x04, 0x64, 0x33, 0x13, 0x33, 0x13, 0xfe, 0xff, 0xfe, 0xff, 0xa6, 0x6a, 0xa6, 0x6a, 0xfe,
+	    0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfe, 0xff, 0xdf, 0x58, 0xa6, 0x6a, 0x06, 0x4f, 0xff, 0xff, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x04, 0x0e, 0x4c, 0xfe, 0xfe, 0xfe, 0xfe),
+	  P(0x00, 0x04, 0x0e, 0x41, 0x99, 0x09),
+	  P(0x00, 0x04, 0x0e, 0x42, 0xcc, 0x1c) },
+	{ P(0x00, 0x05, 0x64, 0x33, 0x13, 0x33, 0x13, 0xfe, 0xff, 0xfe, 0xff, 0xfc, 0x7f, 0xfc, 0x7f, 0xfe,
+	    0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfc, 0x7f, 0xfc, 0x7f, 0x07, 0x4f, 0xff, 0xff, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+};
+
+static_assert(ARRAY_SIZE(t300rs_test_vectors) == ARRAY_SIZE(tmff2_test_steps));
+static_assert(ARRAY_SIZE(t500rs_test_vectors) == ARRAY_SIZE(tmff2_test_steps));
+
+/* inputs that bring the T300 RS encoder to the packets captured on the USB
+ * interface, listed in force-effects.txt. The captures only show the
+ * packets, so the inputs are worked back from them, with the spring and
+ * damper levels at 100. Captures the encoder doesn't reproduce aren't in
+ * here, force-effects.txt lists them with the difference */
+static const struct tmff2_test_step tmff2_capture_steps[] = {
+	{ "captured constant init", TMFF2_TEST_UPLOAD, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay = { .length = 6136, .delay = 7 },
+		.u.constant.level = -2 } },
+	{ "captured play", TMFF2_TEST_PLAY, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay = { .length = 6136, .delay = 7 },
+		.u.constant.level = -2 } },
+	{ "captured constant force modify", TMFF2_TEST_UPDATE, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay = { .length = 6136, .delay = 7 },
+		.u.constant.level = 0x1605 } },
+	{ "captured duration modify", TMFF2_TEST_UPDATE, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay = { .length = 8301, .delay = 7 },
+		.u.constant.level = 0x1605 } },
+	{ "captured envelope modify, fade_length", TMFF2_TEST_UPDATE, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay = { .length = 8301, .delay = 7 },
+		.u.constant = { .level = 0x1605,
+			.envelope.fade_length = 4434 } } },
+	{ "captured stop", TMFF2_TEST_STOP, {
+		.type = FF_CONSTANT, .id = 0, .direction = 0x4000,
+		.replay = { .length = 8301, .delay = 7 },
+		.u.constant = { .level = 0x1605,
+			.envelope.fade_length = 4434 } } },
+	{ "captured spring init", TMFF2_TEST_UPLOAD, {
+		.type = FF_SPRING, .id = 0, .replay.length = 6136,
+		.u.condition[0] = { .right_coeff = 0x7ffc,
+			.left_coeff = 0x7ffc } } },
+	{ "captured damper init", TMFF2_TEST_UPLOAD, {
+		.type = FF_DAMPER, .id = 1, .replay.length = 6136,
+		.u.condition[0] = { .right_coeff = 0x7ffc,
+			.left_coeff = 0x7ffc } } },
+	{ "captured damper modify, positive coefficient", TMFF2_TEST_UPDATE, {
+		.type = FF_DAMPER, .id = 1, .replay.length = 6136,
+		.u.condition[0] = { .right_coeff = 0x3564,
+			.left_coeff = 0x7ffc } } },
+	{ "captured damper modify, negative coefficient", TMFF2_TEST_UPDATE, {
+		.type = FF_DAMPER, .id = 1, .replay.length = 6136,
+		.u.condition[0] = { .right_coeff = 0x3564,
+			.left_coeff = 0x3564 } } },
+	{ "captured damper modify, deadband", TMFF2_TEST_UPDATE, {
+		.type = FF_DAMPER, .id = 1, .replay.length = 6136,
+		.u.condition[0] = { .right_coeff = 0x3564,
+			.left_coeff = 0x3564, .deadband = 0xe54c,
+			.center = -6834 } } },
+	{ "captured periodic init", TMFF2_TEST_UPLOAD, {
+		.type = FF_PERIODIC, .id = 0, .direction = 0x4000,
+		.replay.length = 6136,
+		.u.periodic = { .waveform = FF_SQUARE, .offset = -2,
+			.period = 1000 } } },
+};
+
+/* copied from force-effects.txt, less the 0x60 report id */
+static const u8 t300rs_capture_vectors[][TMFF2_TEST_VECTOR_SIZE] = {
+	{ P(0x00, 0x01, 0x6a, 0xfe, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x4f, 0xf7,
+	    0x17, 0x00, 0x00, 0x07, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x01, 0x89, 0x01) },
+	{ P(0x00, 0x01, 0x0a, 0x05, 0x16) },
+	{ P(0x00, 0x01, 0x49, 0x00, 0x41, 0x6c, 0x20) },
+	{ P(0x00, 0x01, 0x31, 0x84, 0x63, 0x04) },
+	{ P(0x00, 0x01, 0x89, 0x00) },
+	{ P(0x00, 0x01, 0x64, 0xfc, 0x7f, 0xfc, 0x7f, 0xfe, 0xff, 0xfe, 0xff, 0xa6, 0x6a, 0xa6, 0x6a, 0xfe,
+	    0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfe, 0xff, 0xdf, 0x58, 0xa6, 0x6a, 0x06, 0x4f, 0xf7, 0x17, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x02, 0x64, 0xfc, 0x7f, 0xfc, 0x7f, 0xfe, 0xff, 0xfe, 0xff, 0xfc, 0x7f, 0xfc, 0x7f, 0xfe,
+	    0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfe, 0xff, 0xfc, 0x7f, 0xfc, 0x7f, 0x07, 0x4f, 0xf7, 0x17, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+	{ P(0x00, 0x02, 0x0e, 0x41, 0x64, 0x35) },
+	{ P(0x00, 0x02, 0x0e, 0x42, 0x64, 0x35) },
+	{ P(0x00, 0x02, 0x0e, 0x4c, 0x64, 0x35, 0x00, 0x00) },
+	{ P(0x00, 0x01, 0x6b, 0x00, 0x00, 0xfe, 0xff, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x80, 0x00, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x4f, 0xf7, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff) },
+};
+
+static_assert(ARRAY_SIZE(t300rs_capture_vectors) == ARRAY_SIZE(tmff2_capture_steps));
+
+/* what the backend handed to send_packet, the tests run one at a time so a
+ * single capture will do */
+static struct tmff2_test_capture {
+	unsigned int count;
+	u8 buf[TMFF2_MAX_PACKETS][TMFF2_PACKET_SIZE];
+} tmff2_test_capture;
+
+static int tmff2_test_send_packet(void *data, const u8 *buf,
+		const struct tmff2_inflight *inflight)
+{
+	struct tmff2_test_capture *capture = &tmff2_test_capture;
+
+	if (capture->count >= TMFF2_MAX_PACKETS)
+		return -ENOSPC;
+
+	memcpy(capture->buf[capture->count++], buf, TMFF2_PACKET_SIZE);
+	return 0;
+}
+
+/* hardware slots of the test queue, more than any of the steps use */
+#define TMFF2_TEST_SLOTS	8
+
+/* the drain is never run, the tests take the packets out of the queue */
+static void tmff2_test_drain(struct work_struct *work)
+{
+}
+
+/* just enough of a command queue for play and stop, which the backends queue
+ * themselves */
+static void tmff2_test_queue_init(struct kunit *test,
+		struct tmff2_device_entry *tmff2)
+{
+	int i;
+
+	tmff2->max_effects = TMFF2_TEST_SLOTS;
+	tmff2->slots = kunit_kzalloc(test,
+			TMFF2_TEST_SLOTS * sizeof(*tmff2->slots), GFP_KERNEL);
+	tmff2->commands = kunit_kzalloc(test,
+			TMFF2_QUEUE_LENGTH * sizeof(*tmff2->commands), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tmff2->slots);
+	KUNIT_ASSERT_NOT_NULL(test, tmff2->commands);
+
+	for (i = 0; i < TMFF2_TEST_SLOTS; ++i)
+		tmff2->slots[i].owner = -1;
+
+	spin_lock_init(&tmff2->queue_lock);
+	INIT_LIST_HEAD(&tmff2->free_commands);
+	for (i = 0; i < TMFF2_PRIO_COUNT; ++i)
+		INIT_LIST_HEAD(&tmff2->queue[i]);
+
+	for (i = 0; i < TMFF2_QUEUE_LENGTH; ++i)
+		list_add_tail(&tmff2->commands[i].list, &tmff2->free_commands);
+
+	tmff2->queue_free = TMFF2_QUEUE_LENGTH;
+	tmff2->wq = system_wq;
+	INIT_WORK(&tmff2->drain, tmff2_test_drain);
+}
+
+/* move whatever the backend queued into the capture, in the order the drain
+ * would send it */
+static void tmff2_test_dequeue(struct tmff2_device_entry *tmff2)
+{
+	struct tmff2_test_capture *capture = &tmff2_test_capture;
+	struct tmff2_command *cmd, *tmp;
+	int i;
+
+	for (i = 0; i < TMFF2_PRIO_COUNT; ++i) {
+		list_for_each_entry_safe(cmd, tmp, &tmff2->queue[i], list) {
+			if (capture->count < TMFF2_MAX_PACKETS)
+				memcpy(capture->buf[capture->count++], cmd->buf,
+						TMFF2_PACKET_SIZE);
+
+			if (cmd->effect_id >= 0)
+				tmff2->slots[cmd->effect_id].queued--;
+
+			tmff2->queue_depth[i]--;
+			tmff2->queue_free++;
+			list_move_tail(&cmd->list, &tmff2->free_commands);
+		}
+	}
+}
+
+/* encode one step the way tmff2_encode does and push the packets through
+ * send_packet, the way the drain work does */
+static void tmff2_test_encode(struct kunit *test,
+		struct tmff2_device_entry *tmff2, struct tmff2_effect_state *state,
+		const struct tmff2_test_step *step)
+{
+	struct tmff2_packets *packets = &state->packets;
+	unsigned int i;
+	int ret;
+
+	if (step->action == TMFF2_TEST_UPLOAD)
+		memset(state, 0, sizeof(*state));
+
+	state->effect = step->effect;
+	packets->count = 0;
+	memset(&tmff2_test_capture, 0, sizeof(tmff2_test_capture));
+
+	switch (step->action) {
+	case TMFF2_TEST_PLAY:
+	case TMFF2_TEST_STOP:
+		if (step->action == TMFF2_TEST_PLAY)
+			ret = tmff2->play_effect(tmff2->data, state);
+		else
+			ret = tmff2->stop_effect(tmff2->data, state);
+		KUNIT_ASSERT_EQ_MSG(test, ret, 0, "%s", step->name);
+		tmff2_test_dequeue(tmff2);
+		return;
+	case TMFF2_TEST_UPLOAD:
+		memset(&state->next, 0, sizeof(state->next));
+		ret = tmff2->upload_effect(tmff2->data, state, packets);
+		break;
+	default:
+		state->next = state->shadow;
+		ret = tmff2->update_effect(tmff2->data, state, packets);
+		break;
+	}
+	KUNIT_ASSERT_EQ_MSG(test, ret, 0, "%s", step->name);
+	state->shadow = state->next;
+
+	for (i = 0; i < packets->count; ++i) {
+		ret = tmff2->send_packet(tmff2->data, packets->buf[i], NULL);
+		KUNIT_ASSERT_EQ_MSG(test, ret, 0, "%s", step->name);
+	}
+}
+
+static void tmff2_test_compare(struct kunit *test,
+		const struct tmff2_test_step *step, const u8 *vector)
+{
+	struct tmff2_test_capture *capture = &tmff2_test_capture;
+	unsigned int i = 0, count = 0, len;
+
+	while (i < TMFF2_TEST_VECTOR_SIZE && (len = vector[i])) {
+		const u8 *expected = vector + i + 1;
+		u8 packet[TMFF2_PACKET_SIZE] = { 0 };
+
+		i += len + 1;
+		if (count >= capture->count) {
+			count++;
+			continue;
+		}
+
+		memcpy(packet, expected, len);
+		KUNIT_EXPECT_TRUE_MSG(test,
+				!memcmp(capture->buf[count], packet, TMFF2_PACKET_SIZE),
+				"%s, packet %u:\n sent     %*ph\n expected %*ph",
+				step->name, count, (int)len, capture->buf[count],
+				(int)len, expected);
+		count++;
+	}
+
+	KUNIT_EXPECT_EQ_MSG(test, capture->count, count, "%s", step->name);
+}
+
+static void tmff2_test_run(struct kunit *test,
+		struct tmff2_device_entry *tmff2,
+		const struct tmff2_test_step *steps,
+		const u8 (*vectors)[TMFF2_TEST_VECTOR_SIZE], int count, int level)
+{
+	struct tmff2_effect_state *state;
+	int i;
+
+	state = kunit_kzalloc(test, sizeof(*state), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, state);
+
+	tmff2_test_queue_init(test, tmff2);
+	tmff2->send_packet = tmff2_test_send_packet;
+	tmff2->spring_level = level;
+	tmff2->damper_level = level;
+	tmff2->friction_level = level;
+
+	for (i = 0; i < count; ++i) {
+		tmff2_test_encode(test, tmff2, state, &steps[i]);
+		tmff2_test_compare(test, &steps[i], vectors[i]);
+	}
+
+	flush_work(&tmff2->drain);
+}
+
+static void t300rs_test_run(struct kunit *test,
+		int (*populate_api)(struct tmff2_device_entry *tmff2),
+		const struct tmff2_test_step *steps,
+		const u8 (*vectors)[TMFF2_TEST_VECTOR_SIZE], int count, int level)
+{
+	struct tmff2_device_entry *tmff2;
+	struct t300rs_device_entry *t300rs;
+
+	tmff2 = kunit_kzalloc(test, sizeof(*tmff2), GFP_KERNEL);
+	t300rs = kunit_kzalloc(test, sizeof(*t300rs), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tmff2);
+	KUNIT_ASSERT_NOT_NULL(test, t300rs);
+
+	populate_api(tmff2);
+	t300rs->tmff2 = tmff2;
+	/* the length of the T300 RS and T248 reports, play and stop go out
+	 * with it */
+	t300rs->buffer_length = 63;
+	tmff2->data = t300rs;
+
+	tmff2_test_run(test, tmff2, steps, vectors, count, level);
+}
+
+static void t300rs_test_vectors_match(struct kunit *test)
+{
+	t300rs_test_run(test, t300rs_populate_api, tmff2_test_steps,
+			t300rs_test_vectors, ARRAY_SIZE(tmff2_test_steps), 30);
+}
+
+/* the T248 shares the T300RS encoders, this makes sure it keeps doing so */
+static void t248_test_vectors_match(struct kunit *test)
+{
+	t300rs_test_run(test, t248_populate_api, tmff2_test_steps,
+			t300rs_test_vectors, ARRAY_SIZE(tmff2_test_steps), 30);
+}
+
+/* the T500 RS captures in force-effects-t500.txt are of a protocol the T500 RS
+ * backend doesn't speak, it sends the T300 RS packets, so there's nothing to
+ * check it against yet */
+static void t300rs_test_captures_match(struct kunit *test)
+{
+	t300rs_test_run(test, t300rs_populate_api, tmff2_capture_steps,
+			t300rs_capture_vectors, ARRAY_SIZE(tmff2_capture_steps), 100);
+}
+
+static void t248_test_captures_match(struct kunit *test)
+{
+	t300rs_test_run(test, t248_populate_api, tmff2_capture_steps,
+			t300rs_capture_vectors, ARRAY_SIZE(tmff2_capture_steps), 100);
+}
+
+static void t500rs_test_vectors_match(struct kunit *test)
+{
+	struct tmff2_device_entry *tmff2;
+	struct t500rs_device_entry *t500rs;
+
+	tmff2 = kunit_kzalloc(test, sizeof(*tmff2), GFP_KERNEL);
+	t500rs = kunit_kzalloc(test, sizeof(*t500rs), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tmff2);
+	KUNIT_ASSERT_NOT_NULL(test, t500rs);
+
+	t500rs_populate_api(tmff2);
+	t500rs->tmff2 = tmff2;
+	tmff2->data = t500rs;
+
+	tmff2_test_run(test, tmff2, tmff2_test_steps, t500rs_test_vectors,
+			ARRAY_SIZE(tmff2_test_steps), 30);
+}
+
+static struct kunit_case tmff2_encode_test_cases[] = {
+	KUNIT_CASE(t300rs_test_vectors_match),
+	KUNIT_CASE(t248_test_vectors_match),
+	KUNIT_CASE(t500rs_test_vectors_match),
+	KUNIT_CASE(t300rs_test_captures_match),
+	KUNIT_CASE(t248_test_captures_match),
+	{}
+};
+
+static struct kunit_suite tmff2_encode_test_suite = {
+	.name = "hid-tmff2-encode",
+	.test_cases = tmff2_encode_test_cases,
+};
+
+kunit_test_suite(tmff2_encode_test_suite);
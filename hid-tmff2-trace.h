@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Trace events for everything the core sends to the wheel. Tracepoints sit
+ * behind static keys, so they cost a nop each while disabled. Enable them
+ * through /sys/kernel/tracing/events/tmff2/ or with perf/bpftrace. */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tmff2
+
+#if !defined(__HID_TMFF2_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __HID_TMFF2_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/hid.h>
+#include "hid-tmff2.h"
+
+/* devices are identified by the id at the end of the hid device name, so
+ * 0003:044F:B66E.0005 is hid=5 */
+
+TRACE_EVENT(tmff2_upload,
+	TP_PROTO(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state, int update, u64 encode_ns),
+	TP_ARGS(tmff2, state, update, encode_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hid)
+		__field(int, id)
+		__field(u16, type)
+		__field(int, update)
+		__field(unsigned int, packets)
+		__field(u64, encode_ns)
+	),
+
+	TP_fast_assign(
+		__entry->hid = tmff2->hdev->id;
+		__entry->id = state->effect.id;
+		__entry->type = state->effect.type;
+		__entry->update = update;
+		__entry->packets = state->packets.count;
+		__entry->encode_ns = encode_ns;
+	),
+
+	TP_printk("hid=%u id=%d type=0x%x %s packets=%u encode_ns=%llu",
+		__entry->hid, __entry->id, __entry->type,
+		__entry->update ? "update" : "upload", __entry->packets,
+		__entry->encode_ns)
+);
+
+TRACE_EVENT(tmff2_play,
+	TP_PROTO(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state, int value),
+	TP_ARGS(tmff2, state, value),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hid)
+		__field(int, id)
+		__field(u16, type)
+		__field(int, value)
+	),
+
+	TP_fast_assign(
+		__entry->hid = tmff2->hdev->id;
+		__entry->id = state->effect.id;
+		__entry->type = state->effect.type;
+		__entry->value = value;
+	),
+
+	TP_printk("hid=%u id=%d type=0x%x value=%d",
+		__entry->hid, __entry->id, __entry->type, __entry->value)
+);
+
+TRACE_EVENT(tmff2_tick_begin,
+	TP_PROTO(struct tmff2_device_entry *tmff2, ktime_t due, ktime_t now),
+	TP_ARGS(tmff2, due, now),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hid)
+		__field(s64, late_ns)
+	),
+
+	TP_fast_assign(
+		__entry->hid = tmff2->hdev->id;
+		__entry->late_ns = due ? ktime_to_ns(ktime_sub(now, due)) : 0;
+	),
+
+	TP_printk("hid=%u late_ns=%lld", __entry->hid, __entry->late_ns)
+);
+
+TRACE_EVENT(tmff2_tick_end,
+	TP_PROTO(struct tmff2_device_entry *tmff2, ktime_t start, int retry),
+	TP_ARGS(tmff2, start, retry),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hid)
+		__field(u64, duration_ns)
+		__field(int, retry)
+		__field(s64, next_deadline_ns)
+	),
+
+	TP_fast_assign(
+		__entry->hid = tmff2->hdev->id;
+		__entry->duration_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		__entry->retry = retry;
+		__entry->next_deadline_ns = tmff2->next_deadline == KTIME_MAX ?
+			-1 : ktime_to_ns(tmff2->next_deadline);
+	),
+
+	TP_printk("hid=%u duration_ns=%llu retry=%d next_deadline_ns=%lld",
+		__entry->hid, __entry->duration_ns, __entry->retry,
+		__entry->next_deadline_ns)
+);
+
+/* the first bytes of a packet are its header, for effect packets the
+ * opcode is in byte 2 and the attribute mask of modify packets in byte 3,
+ * settings packets have their command in bytes 0 and 1 */
+TRACE_EVENT(tmff2_packet_submit,
+	TP_PROTO(struct tmff2_device_entry *tmff2, struct tmff2_command *cmd,
+		ktime_t now),
+	TP_ARGS(tmff2, cmd, now),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hid)
+		__field(int, prio)
+		__field(int, id)
+		__array(u8, header, 4)
+		__field(unsigned int, len)
+		__field(s64, queued_ns)
+		__field(u64, wait_ns)
+	),
+
+	TP_fast_assign(
+		__entry->hid = tmff2->hdev->id;
+		__entry->prio = cmd->prio;
+		__entry->id = cmd->effect_id;
+		memcpy(__entry->header, cmd->buf, 4);
+		__entry->len = cmd->len;
+		__entry->queued_ns = ktime_to_ns(cmd->queued);
+		__entry->wait_ns = ktime_to_ns(ktime_sub(now, cmd->queued));
+	),
+
+	TP_printk("hid=%u prio=%d id=%d header=%*phN opcode=0x%02x attribute=0x%02x len=%u queued_ns=%lld wait_ns=%llu",
+		__entry->hid, __entry->prio, __entry->id, 4, __entry->header,
+		__entry->header[2], __entry->header[3], __entry->len,
+		__entry->queued_ns, __entry->wait_ns)
+);
+
+/* the wheel has the packet: send_packet returned, or for the T500 the urb
+ * completed */
+TRACE_EVENT(tmff2_packet_complete,
+	TP_PROTO(struct tmff2_device_entry *tmff2,
+		const struct tmff2_inflight *inflight, ktime_t end, int ret),
+	TP_ARGS(tmff2, inflight, end, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, hid)
+		__field(int, prio)
+		__field(int, id)
+		__field(u8, opcode)
+		__field(u64, send_ns)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->hid = tmff2->hdev->id;
+		__entry->prio = inflight->prio;
+		__entry->id = inflight->effect_id;
+		__entry->opcode = inflight->opcode;
+		__entry->send_ns = ktime_to_ns(ktime_sub(end, inflight->start));
+		__entry->ret = ret;
+	),
+
+	TP_printk("hid=%u prio=%d id=%d opcode=0x%02x send_ns=%llu ret=%d",
+		__entry->hid, __entry->prio, __entry->id, __entry->opcode,
+		__entry->send_ns, __entry->ret)
+);
+
+#endif /* __HID_TMFF2_TRACE_H */
+
+/* this has to be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hid-tmff2-trace
+#include <trace/define_trace.h>
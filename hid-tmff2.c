@@ -1,16 +1,28 @@
 // SPDX-License-Identifier: GPL-2.0
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/hid.h>
+#include <linux/bitmap.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
+#include <linux/sort.h>
+#include <linux/fixp-arith.h>
+#include <linux/version.h>
 #include "hid-tmff2.h"
 
+#define CREATE_TRACE_POINTS
+#include "hid-tmff2-trace.h"
+
 
 int timer_msecs = DEFAULT_TIMER_PERIOD;
 module_param(timer_msecs, int, 0660);
 MODULE_PARM_DESC(timer_msecs,
-		"Timer resolution in msecs");
+		"Minimum time between two transmissions to the wheel in msecs");
 
-/* should these be removed and just rely on /sys? */
+/* defaults for each new wheel, after that each wheel has its own copy that
+ * can be changed through /sys */
 int spring_level = 30;
 module_param(spring_level, int, 0);
 MODULE_PARM_DESC(spring_level,
@@ -36,37 +48,76 @@ module_param(alt_mode, int, 0);
 MODULE_PARM_DESC(alt_mode,
 		"Alternate mode, eg. F1 mode");
 
-#define GAIN_MAX 65535
 int gain = 40000;
 module_param(gain, int, 0);
 MODULE_PARM_DESC(gain,
 		"Level of gain (0-65535)");
 
-static spinlock_t lock;
-static unsigned long lock_flags;
+int worker_priority = 0;
+module_param(worker_priority, int, 0);
+MODULE_PARM_DESC(worker_priority,
+		"SCHED_FIFO priority (1-99) of a dedicated FF thread per wheel, 0 uses a high priority workqueue instead");
+
+int worker_cpu = -1;
+module_param(worker_cpu, int, 0);
+MODULE_PARM_DESC(worker_cpu,
+		"CPU to bind the dedicated FF thread to, -1 for any");
+
+int lazy_upload = 0;
+module_param(lazy_upload, int, 0);
+MODULE_PARM_DESC(lazy_upload,
+		"Only send an effect to the wheel when it is first played, instead of when it is uploaded");
+
+int virtual_effects = 64;
+module_param(virtual_effects, int, 0);
+MODULE_PARM_DESC(virtual_effects,
+		"Number of effects games can create, the wheel's own slots are shared between them as needed");
+
+int host_mixing = 0;
+module_param(host_mixing, int, 0);
+MODULE_PARM_DESC(host_mixing,
+		"Play constant, ramp and periodic effects on the host and send their sum to the wheel as a single constant force, every timer_msecs");
+
+int combined_modify = 0;
+module_param(combined_modify, int, 0);
+MODULE_PARM_DESC(combined_modify,
+		"Send every changed attribute of a T300RS effect modify in one report. Untested, the wheel has only been seen taking some combinations");
+
+static struct dentry *tmff2_debugfs_root;
+
+s16 tmff2_sin_table[360] __ro_after_init;
+
+/* past 180 degrees the first half is mirrored, which is what the encoders
+ * have always sent */
+static void __init tmff2_sin_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tmff2_sin_table); ++i)
+		tmff2_sin_table[i] = i > 180 ?
+			-(fixp_sin32(i - 180) >> 16) : fixp_sin32(i) >> 16;
+}
 
+/* drvdata is set before anything that could call these is registered and
+ * stays put until remove, so there's nothing to lock here */
 static struct tmff2_device_entry *tmff2_from_hdev(struct hid_device *hdev)
 {
 	struct tmff2_device_entry *tmff2;
-	spin_lock_irqsave(&lock, lock_flags);
 
 	if (!(tmff2 = hid_get_drvdata(hdev)))
 		dev_err(&hdev->dev, "hdev private data not found\n");
 
-	spin_unlock_irqrestore(&lock, lock_flags);
-
 	return tmff2;
 }
 
 static struct tmff2_device_entry *tmff2_from_input(struct input_dev *input_dev)
 {
 	struct hid_device *hdev;
-	spin_lock_irqsave(&lock, lock_flags);
 
-	if (!(hdev = input_get_drvdata(input_dev)))
+	if (!(hdev = input_get_drvdata(input_dev))) {
 		dev_err(&input_dev->dev, "input_dev private data not found\n");
-
-	spin_unlock_irqrestore(&lock, lock_flags);
+		return NULL;
+	}
 
 	return tmff2_from_hdev(hdev);
 }
@@ -74,9 +125,13 @@ static struct tmff2_device_entry *tmff2_from_input(struct input_dev *input_dev)
 static ssize_t spring_level_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t count)
 {
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
 	unsigned int value;
 	int ret;
 
+	if (!tmff2)
+		return -ENODEV;
+
 	ret = kstrtouint(buf, 0, &value);
 	if (ret) {
 		dev_err(dev, "kstrtouint failed at spring_level_store: %i", ret);
@@ -88,7 +143,7 @@ static ssize_t spring_level_store(struct device *dev,
 		value = 100;
 	}
 
-	spring_level = value;
+	tmff2->spring_level = value;
 
 	return count;
 }
@@ -96,17 +151,25 @@ static ssize_t spring_level_store(struct device *dev,
 static ssize_t spring_level_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", spring_level);
+	if (!tmff2)
+		return -ENODEV;
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", tmff2->spring_level);
 }
 static DEVICE_ATTR_RW(spring_level);
 
 static ssize_t damper_level_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t count)
 {
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
 	unsigned int value;
 	int ret;
 
+	if (!tmff2)
+		return -ENODEV;
+
 
 	ret = kstrtouint(buf, 0, &value);
 	if (ret) {
@@ -119,7 +182,7 @@ static ssize_t damper_level_store(struct device *dev,
 		value = 100;
 	}
 
-	damper_level = value;
+	tmff2->damper_level = value;
 
 	return count;
 }
@@ -127,17 +190,25 @@ static ssize_t damper_level_store(struct device *dev,
 static ssize_t damper_level_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", damper_level);
+	if (!tmff2)
+		return -ENODEV;
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", tmff2->damper_level);
 }
 static DEVICE_ATTR_RW(damper_level);
 
 static ssize_t friction_level_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t count)
 {
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
 	unsigned int value;
 	int ret;
 
+	if (!tmff2)
+		return -ENODEV;
+
 
 	ret = kstrtouint(buf, 0, &value);
 	if (ret) {
@@ -150,7 +221,7 @@ static ssize_t friction_level_store(struct device *dev,
 		value = 100;
 	}
 
-	friction_level = value;
+	tmff2->friction_level = value;
 
 	return count;
 }
@@ -158,12 +229,12 @@ static ssize_t friction_level_store(struct device *dev,
 static ssize_t friction_level_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
-	size_t count;
-
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
 
-	count = scnprintf(buf, PAGE_SIZE, "%u\n", friction_level);
+	if (!tmff2)
+		return -ENODEV;
 
-	return count;
+	return scnprintf(buf, PAGE_SIZE, "%u\n", tmff2->friction_level);
 }
 static DEVICE_ATTR_RW(friction_level);
 
@@ -194,8 +265,12 @@ static ssize_t range_store(struct device *dev,
 static ssize_t range_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
+
+	if (!tmff2)
+		return -ENODEV;
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", range);
+	return scnprintf(buf, PAGE_SIZE, "%u\n", tmff2->range);
 }
 static DEVICE_ATTR_RW(range);
 
@@ -228,6 +303,18 @@ static ssize_t alternate_modes_show(struct device *dev,
 }
 static DEVICE_ATTR_RW(alternate_modes);
 
+/* with host_mixing the mixer scales its sum before saturating it, the way the
+ * wheel would have scaled the effects before adding them up, so the wheel
+ * itself stays at full gain */
+static int tmff2_apply_gain(struct tmff2_device_entry *tmff2, u16 gain)
+{
+	if (!tmff2->host_mixing)
+		return tmff2->set_gain(tmff2->data, gain);
+
+	WRITE_ONCE(tmff2->host_gain, gain);
+	return tmff2->set_gain(tmff2->data, GAIN_MAX);
+}
+
 static ssize_t gain_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t count)
 {
@@ -243,9 +330,9 @@ static ssize_t gain_store(struct device *dev,
 		return ret;
 	}
 
-	gain = value;
+	tmff2->gain = value;
 	if (tmff2->set_gain) /* if we can, update gain immediately */
-		tmff2->set_gain(tmff2->data, (GAIN_MAX * gain) / GAIN_MAX);
+		tmff2_apply_gain(tmff2, (GAIN_MAX * tmff2->gain) / GAIN_MAX);
 
 	return count;
 }
@@ -253,7 +340,12 @@ static ssize_t gain_store(struct device *dev,
 static ssize_t gain_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
-	return scnprintf(buf, PAGE_SIZE, "%i\n", gain);
+	struct tmff2_device_entry *tmff2 = tmff2_from_hdev(to_hid_device(dev));
+
+	if (!tmff2)
+		return -ENODEV;
+
+	return scnprintf(buf, PAGE_SIZE, "%i\n", tmff2->gain);
 }
 static DEVICE_ATTR_RW(gain);
 
@@ -269,7 +361,7 @@ static void tmff2_set_gain(struct input_dev *dev, uint16_t value)
 		return;
 	}
 
-	if (tmff2->set_gain(tmff2->data, (value * gain) / GAIN_MAX))
+	if (tmff2_apply_gain(tmff2, (value * tmff2->gain) / GAIN_MAX))
 		hid_warn(tmff2->hdev, "unable to set gain\n");
 }
 
@@ -289,84 +381,1103 @@ static void tmff2_set_autocenter(struct input_dev *dev, uint16_t value)
 		hid_warn(tmff2->hdev, "unable to set autocenter\n");
 }
 
-static void tmff2_work_handler(struct work_struct *w)
+/* point in time when a finite effect stops playing on the wheel, the wheel
+ * itself takes care of the delay so it has to be accounted for here as well */
+static ktime_t tmff2_effect_end(struct tmff2_effect_state *state)
+{
+	return ktime_add_ms(state->start_time,
+			state->effect.replay.delay + state->effect.replay.length);
+}
+
+static unsigned long tmff2_delay_jiffies(ktime_t when, ktime_t now)
+{
+	s64 delta = ktime_us_delta(when, now);
+
+	if (delta <= 0)
+		return 0;
+
+	/* rounds up, so we never wake up before the deadline has passed */
+	return usecs_to_jiffies(delta);
+}
+
+/* arm the work handler for when, on whichever worker this device uses. If
+ * it's already armed for later it's pulled forward, so new work never waits
+ * for a far off deadline. Called with tmff2->lock held */
+static void tmff2_queue_work(struct tmff2_device_entry *tmff2, ktime_t when)
+{
+	ktime_t now = ktime_get();
+	unsigned long delay = tmff2_delay_jiffies(when, now);
+
+	if (ktime_before(when, now))
+		when = now;
+
+	if (!ktime_before(when, tmff2->armed))
+		return;
+
+	if (tmff2->kworker)
+		kthread_mod_delayed_work(tmff2->kworker, &tmff2->kwork, delay);
+	else
+		mod_delayed_work(tmff2->wq, &tmff2->work, delay);
+
+	tmff2->armed = when;
+	tmff2->tick_due = when;
+}
+
+static void tmff2_cancel_work(struct tmff2_device_entry *tmff2)
+{
+	if (tmff2->kworker)
+		kthread_cancel_delayed_work_sync(&tmff2->kwork);
+	else
+		cancel_delayed_work_sync(&tmff2->work);
+}
+
+/* post new work for the work handler, called with tmff2->lock held.
+ * Consecutive runs are kept at least timer_msecs apart, as the wheel can only
+ * handle so many interrupts per second. If the handler is already due by
+ * then nothing changes, it will pick up the new work when it runs. */
+static void tmff2_schedule_work(struct tmff2_device_entry *tmff2)
+{
+	if (!tmff2->allow_scheduling)
+		return;
+
+	tmff2_queue_work(tmff2, ktime_add_ms(tmff2->last_tick, timer_msecs));
+}
+
+static void tmff2_count_wakeup(struct tmff2_device_entry *tmff2, ktime_t now)
+{
+	s64 elapsed = ktime_to_ns(ktime_sub(now, tmff2->wakeups_window_start));
+
+	tmff2->wakeups++;
+	if (elapsed >= NSEC_PER_SEC) {
+		tmff2->wakeups_per_sec =
+			div64_u64((u64)tmff2->wakeups_window * NSEC_PER_SEC, elapsed);
+		tmff2->wakeups_window = 0;
+		tmff2->wakeups_window_start = now;
+	}
+
+	tmff2->wakeups_window++;
+}
+
+/* called with tmff2->lock held, as tick_due is set wherever work is posted */
+static void tmff2_record_jitter(struct tmff2_device_entry *tmff2, ktime_t now)
+{
+	s64 jitter = ktime_to_ns(ktime_sub(now, tmff2->tick_due));
+
+	tmff2->jitter[tmff2->jitter_next] = clamp_t(s64, jitter, 0, U32_MAX);
+	tmff2->jitter_next = (tmff2->jitter_next + 1) % TMFF2_JITTER_SAMPLES;
+	if (tmff2->jitter_count < TMFF2_JITTER_SAMPLES)
+		tmff2->jitter_count++;
+}
+
+/* take tmff2->lock, keeping count of how often and for how long we had to
+ * wait for it */
+static void tmff2_lock(struct tmff2_device_entry *tmff2, unsigned long *flags)
+{
+	ktime_t start;
+	u64 wait;
+
+	if (spin_trylock_irqsave(&tmff2->lock, *flags)) {
+		tmff2->lock_acquired++;
+		return;
+	}
+
+	start = ktime_get();
+	spin_lock_irqsave(&tmff2->lock, *flags);
+	wait = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	tmff2->lock_acquired++;
+	tmff2->lock_contended++;
+	tmff2->lock_wait_total_ns += wait;
+	if (wait > tmff2->lock_wait_max_ns)
+		tmff2->lock_wait_max_ns = wait;
+}
+
+static void tmff2_unlock(struct tmff2_device_entry *tmff2, unsigned long flags)
+{
+	spin_unlock_irqrestore(&tmff2->lock, flags);
+}
+
+static unsigned int tmff2_type_index(struct tmff2_effect_state *state)
+{
+	return state->effect.type - FF_EFFECT_MIN;
+}
+
+/* names for the per type statistics, indexed by tmff2_type_index */
+static const char * const tmff2_effect_names[FF_EFFECT_MAX - FF_EFFECT_MIN + 1] = {
+	[FF_RUMBLE - FF_EFFECT_MIN] = "rumble",
+	[FF_PERIODIC - FF_EFFECT_MIN] = "periodic",
+	[FF_CONSTANT - FF_EFFECT_MIN] = "constant",
+	[FF_SPRING - FF_EFFECT_MIN] = "spring",
+	[FF_FRICTION - FF_EFFECT_MIN] = "friction",
+	[FF_DAMPER - FF_EFFECT_MIN] = "damper",
+	[FF_INERTIA - FF_EFFECT_MIN] = "inertia",
+	[FF_RAMP - FF_EFFECT_MIN] = "ramp",
+};
+
+void tmff2_hist_add(struct tmff2_hist *hist, u64 ns)
+{
+	unsigned int bucket = fls64(div_u64(ns, NSEC_PER_USEC));
+
+	if (bucket)
+		bucket--;
+
+	hist->buckets[min_t(unsigned int, bucket, TMFF2_HIST_BUCKETS - 1)]++;
+}
+
+/* one line per histogram, each nonempty bucket as lower bound:count */
+void tmff2_hist_show(struct seq_file *m, const char *name,
+		const struct tmff2_hist *hist)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < TMFF2_HIST_BUCKETS; ++i)
+		total += hist->buckets[i];
+
+	if (!total)
+		return;
+
+	seq_printf(m, "%s %lu", name, total);
+	for (i = 0; i < TMFF2_HIST_BUCKETS; ++i) {
+		if (hist->buckets[i])
+			seq_printf(m, " %luus:%lu", i ? 1UL << i : 0,
+					hist->buckets[i]);
+	}
+	seq_putc(m, '\n');
+}
+
+/* encode whatever upload or update is queued for a slot into its packets,
+ * replacing anything encoded earlier. Called with tmff2->lock held */
+static int tmff2_encode(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state)
+{
+	unsigned int type = tmff2_type_index(state);
+	ktime_t start = ktime_get();
+	u64 encode_ns;
+	int ret, upload;
+
+	state->packets.count = 0;
+
+	if ((upload = test_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags))) {
+		memset(&state->next, 0, sizeof(state->next));
+		ret = tmff2->upload_effect(tmff2->data, state, &state->packets);
+	} else if (test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
+		state->next = state->shadow;
+		ret = tmff2->update_effect(tmff2->data, state, &state->packets);
+	} else {
+		return 0;
+	}
+
+	if (ret) {
+		hid_warn(tmff2->hdev, "failed encoding effect\n");
+		state->packets.count = 0;
+		state->flags &= ~(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE));
+		return ret;
+	}
+
+	encode_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	tmff2_hist_add(&tmff2->latency[TMFF2_LAT_ENCODE][type], encode_ns);
+	trace_tmff2_upload(tmff2, state, !upload, encode_ns);
+
+	if (upload) {
+		tmff2->uploads[type]++;
+		tmff2->upload_ns[type] += encode_ns;
+		tmff2->upload_packets[type] += state->packets.count;
+	} else {
+		tmff2->updates_encoded[type]++;
+		tmff2->update_ns[type] += encode_ns;
+		tmff2->update_packets[type] += state->packets.count;
+	}
+	return 0;
+}
+
+static void tmff2_kick_drain(struct tmff2_device_entry *tmff2)
+{
+	if (tmff2->kworker)
+		kthread_queue_work(tmff2->kworker, &tmff2->kdrain);
+	else
+		queue_work(tmff2->wq, &tmff2->drain);
+}
+
+/* effect in a hardware slot, or NULL. Packets carry the hardware slot, by
+ * the time they're sent the slot may have changed hands */
+static struct tmff2_effect_state *tmff2_slot_state(
+		struct tmff2_device_entry *tmff2, int slot)
+{
+	int owner = READ_ONCE(tmff2->slots[slot].owner);
+
+	if (tmff2->host_mixing && slot == tmff2->mix.slot)
+		return &tmff2->mix;
+
+	return owner < 0 ? NULL : &tmff2->states[owner];
+}
+
+/* called with queue_lock held, and only after making sure there's room */
+static void __tmff2_enqueue(struct tmff2_device_entry *tmff2, int prio,
+		int effect_id, const u8 *buf, size_t len)
+{
+	struct tmff2_effect_state *state;
+	struct tmff2_command *cmd;
+	struct tmff2_slot *slot;
+	unsigned int depth = TMFF2_QUEUE_LENGTH - --tmff2->queue_free;
+	int queue = prio;
+
+	/* the drain takes the lists in order of priority, so a packet for a
+	 * slot that still has packets waiting goes behind the last of them.
+	 * Otherwise a stop could overtake the play before it, or a modify
+	 * the upload it modifies, once the drain falls behind */
+	if (effect_id >= 0) {
+		slot = &tmff2->slots[effect_id];
+		if (slot->queued && slot->queue > queue)
+			queue = slot->queue;
+		slot->queue = queue;
+	}
+
+	cmd = list_first_entry(&tmff2->free_commands, struct tmff2_command, list);
+	list_move_tail(&cmd->list, &tmff2->queue[queue]);
+
+	cmd->prio = prio;
+	cmd->queue = queue;
+	cmd->effect_id = effect_id;
+	cmd->len = len;
+	cmd->queued = ktime_get();
+	cmd->requested = 0;
+	memcpy(cmd->buf, buf, len);
+	memset(cmd->buf + len, 0, TMFF2_PACKET_SIZE - len);
+
+	/* only for the latency histograms, play and stop may come in
+	 * without tmff2->lock held but a stale timestamp doesn't matter */
+	if (effect_id >= 0) {
+		slot->queued++;
+		if ((state = tmff2_slot_state(tmff2, effect_id)))
+			cmd->requested = prio <= TMFF2_PRIO_PLAY ?
+				state->play_requested : state->requested;
+	}
+
+	tmff2->queue_depth[queue]++;
+	tmff2->queued[prio]++;
+	if (depth > tmff2->queue_depth_max)
+		tmff2->queue_depth_max = depth;
+}
+
+/* queue count packets of the same priority, laid out TMFF2_PACKET_SIZE apart
+ * in bufs, either all of them or none. Never sleeps, so this can be called
+ * from any context */
+static int tmff2_queue_packets(struct tmff2_device_entry *tmff2, int prio,
+		int effect_id, const u8 *bufs, unsigned int count, size_t len)
+{
+	unsigned long flags;
+	unsigned int i;
+	int ret = 0;
+
+	if (len > TMFF2_PACKET_SIZE)
+		return -EINVAL;
+
+	spin_lock_irqsave(&tmff2->queue_lock, flags);
+
+	if (tmff2->queue_stopped) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (tmff2->queue_free < count) {
+		tmff2->queue_full++;
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	for (i = 0; i < count; ++i)
+		__tmff2_enqueue(tmff2, prio, effect_id,
+				bufs + i * TMFF2_PACKET_SIZE, len);
+
+	if (count)
+		tmff2_kick_drain(tmff2);
+
+out:
+	spin_unlock_irqrestore(&tmff2->queue_lock, flags);
+	return ret;
+}
+
+int tmff2_queue_packet(struct tmff2_device_entry *tmff2, int prio,
+		int effect_id, const u8 *buf, size_t len)
+{
+	return tmff2_queue_packets(tmff2, prio, effect_id, buf, 1, len);
+}
+
+/* a packet didn't make it to the wheel, queue whatever brings the slot back
+ * to where userspace expects it */
+static void tmff2_command_failed(struct tmff2_device_entry *tmff2,
+		struct tmff2_command *cmd)
+{
+	struct tmff2_effect_state *state;
+	unsigned long flags;
+
+	if (cmd->effect_id < 0) {
+		hid_warn(tmff2->hdev, "failed sending setting\n");
+		return;
+	}
+
+	tmff2_lock(tmff2, &flags);
+
+	/* the mixer uploads and starts its effect again on its next run */
+	if (tmff2->host_mixing && cmd->effect_id == tmff2->mix.slot) {
+		tmff2->mix.flags = BIT(FF_EFFECT_QUEUE_UPLOAD);
+		tmff2_schedule_work(tmff2);
+		goto out;
+	}
+
+	/* whoever has the slot now gets a fresh upload anyway */
+	if (!(state = tmff2_slot_state(tmff2, cmd->effect_id))
+			|| test_bit(FF_EFFECT_ERASED, &state->flags))
+		goto out;
+
+	switch (cmd->prio) {
+	case TMFF2_PRIO_UPLOAD:
+	case TMFF2_PRIO_MODIFY:
+		/* we don't know how much of the effect the wheel has */
+		__set_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
+		if (tmff2_encode(tmff2, state))
+			goto out;
+		break;
+	case TMFF2_PRIO_PLAY:
+		if (test_bit(FF_EFFECT_QUEUE_STOP, &state->flags))
+			goto out;
+		/* could have been the upload in front of the start as well */
+		if (test_bit(FF_EFFECT_FUSED, &state->flags)) {
+			__set_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
+			if (tmff2_encode(tmff2, state))
+				goto out;
+		}
+		__set_bit(FF_EFFECT_QUEUE_START, &state->flags);
+		break;
+	case TMFF2_PRIO_STOP:
+		if (test_bit(FF_EFFECT_QUEUE_START, &state->flags))
+			goto out;
+		__set_bit(FF_EFFECT_QUEUE_STOP, &state->flags);
+		break;
+	}
+
+	__set_bit(state - tmff2->states, tmff2->pending);
+	tmff2_schedule_work(tmff2);
+
+out:
+	tmff2_unlock(tmff2, flags);
+}
+
+static void tmff2_count_packet(struct tmff2_device_entry *tmff2,
+		struct tmff2_command *cmd, int ret)
+{
+	struct tmff2_stats *stats = get_cpu_ptr(tmff2->stats);
+	struct tmff2_effect_state *state;
+
+	if (ret) {
+		stats->failed[clamp(-ret, 0, TMFF2_STATS_ERRNOS - 1)]++;
+		goto out;
+	}
+
+	stats->packets++;
+	stats->bytes += cmd->len;
+
+	if (cmd->effect_id < 0) {
+		stats->settings++;
+		goto out;
+	}
+
+	/* only for statistics, so racing with an upload to the same slot
+	 * doesn't matter */
+	stats->opcodes[cmd->buf[2]]++;
+	if ((state = tmff2_slot_state(tmff2, cmd->effect_id)))
+		stats->types[tmff2_type_index(state)]++;
+
+out:
+	put_cpu_ptr(tmff2->stats);
+}
+
+/* the wheel has the packet, or it never will. Called from the drain work
+ * when send_packet returns, or for async_send backends from wherever they
+ * find out, one at a time. Only one of the two records for a backend, so
+ * the send and total histograms still have a single writer */
+void tmff2_packet_done(struct tmff2_device_entry *tmff2,
+		const struct tmff2_inflight *inflight, int ret)
+{
+	ktime_t end = ktime_get();
+
+	trace_tmff2_packet_complete(tmff2, inflight, end, ret);
+
+	if (ret || inflight->type < 0)
+		return;
+
+	tmff2_hist_add(&tmff2->latency[TMFF2_LAT_SEND][inflight->type],
+			ktime_to_ns(ktime_sub(end, inflight->start)));
+
+	if (inflight->requested)
+		tmff2_hist_add(&tmff2->latency[TMFF2_LAT_TOTAL][inflight->type],
+				ktime_to_ns(ktime_sub(end, inflight->requested)));
+}
+
+/* the single writer, sends queued packets in order of priority until the
+ * queue is empty */
+static void tmff2_drain(struct tmff2_device_entry *tmff2)
+{
+	struct tmff2_effect_state *state;
+	struct tmff2_inflight inflight;
+	struct tmff2_command *cmd;
+	unsigned long flags;
+	ktime_t end;
+	int prio, ret;
+
+	for (;;) {
+		cmd = NULL;
+
+		spin_lock_irqsave(&tmff2->queue_lock, flags);
+		for (prio = 0; prio < TMFF2_PRIO_COUNT && !cmd; ++prio) {
+			cmd = list_first_entry_or_null(&tmff2->queue[prio],
+					struct tmff2_command, list);
+		}
+
+		if (cmd) {
+			list_del(&cmd->list);
+			tmff2->queue_depth[cmd->queue]--;
+		}
+		spin_unlock_irqrestore(&tmff2->queue_lock, flags);
+
+		if (!cmd)
+			return;
+
+		inflight = (struct tmff2_inflight){
+			.prio = cmd->prio,
+			.effect_id = cmd->effect_id,
+			.type = -1,
+			.opcode = cmd->buf[2],
+			.requested = cmd->requested,
+		};
+		/* only for statistics, so racing with an upload to the same
+		 * slot doesn't matter */
+		if (cmd->effect_id >= 0
+				&& (state = tmff2_slot_state(tmff2, cmd->effect_id)))
+			inflight.type = tmff2_type_index(state);
+
+		inflight.start = ktime_get();
+		trace_tmff2_packet_submit(tmff2, cmd, inflight.start);
+		ret = tmff2->send_packet(tmff2->data, cmd->buf, &inflight);
+		end = ktime_get();
+		if (ret || !tmff2->async_send)
+			tmff2_packet_done(tmff2, &inflight, ret);
+		tmff2_count_packet(tmff2, cmd, ret);
+
+		if ((cmd->prio == TMFF2_PRIO_UPLOAD || cmd->prio == TMFF2_PRIO_MODIFY)
+				&& inflight.type >= 0) {
+			tmff2->transmit_ns[inflight.type] +=
+				ktime_to_ns(ktime_sub(end, inflight.start));
+			tmff2->transmit_count[inflight.type]++;
+		}
+
+		/* the drain work is the only writer of these */
+		if (!ret && inflight.type >= 0 && inflight.requested)
+			tmff2_hist_add(&tmff2->latency[TMFF2_LAT_QUEUE][inflight.type],
+					ktime_to_ns(ktime_sub(inflight.start,
+							inflight.requested)));
+
+		if (ret)
+			tmff2_command_failed(tmff2, cmd);
+
+		spin_lock_irqsave(&tmff2->queue_lock, flags);
+		if (cmd->effect_id >= 0)
+			tmff2->slots[cmd->effect_id].queued--;
+		list_add(&cmd->list, &tmff2->free_commands);
+		tmff2->queue_free++;
+		if (ret)
+			tmff2->send_failed++;
+		else
+			tmff2->sent++;
+		spin_unlock_irqrestore(&tmff2->queue_lock, flags);
+	}
+}
+
+static void tmff2_drain_handler(struct work_struct *w)
+{
+	tmff2_drain(container_of(w, struct tmff2_device_entry, drain));
+}
+
+static void tmff2_kdrain_handler(struct kthread_work *w)
+{
+	tmff2_drain(container_of(w, struct tmff2_device_entry, kdrain));
+}
+
+/* Games may create more effects than the wheel has slots for. Effects only
+ * take a hardware slot while they're needed: new effects get a free one if
+ * there is one, anything else waits for its first play. The slot then goes
+ * to whichever effect is stopped and was played the longest time ago, so
+ * the few effects a game keeps playing and updating never move. All of
+ * these are called with tmff2->lock held. */
+static void tmff2_release(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state)
+{
+	tmff2->slots[state->slot].owner = -1;
+	state->flags &= ~(BIT(FF_EFFECT_RESIDENT) | BIT(FF_EFFECT_ERASED));
+}
+
+/* effects that are stopped and have nothing on its way to the wheel can
+ * give up their slot, packets still queued for it would land on the next
+ * effect in it */
+static int tmff2_evictable(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state)
+{
+	return !(state->flags & (BIT(FF_EFFECT_QUEUE_START) |
+				BIT(FF_EFFECT_QUEUE_STOP) |
+				BIT(FF_EFFECT_PLAYING) |
+				BIT(FF_EFFECT_ERASED)))
+		&& !state->play_requested
+		&& !READ_ONCE(tmff2->slots[state->slot].queued);
+}
+
+static void tmff2_evict(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state)
+{
+	if (test_bit(FF_EFFECT_DEFERRED, &state->flags))
+		this_cpu_inc(tmff2->stats->avoided);
+
+	/* whatever was encoded is for the old slot */
+	state->flags &= ~(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE) |
+			BIT(FF_EFFECT_DEFERRED) | BIT(FF_EFFECT_FUSED));
+	state->packets.count = 0;
+	state->requested = 0;
+
+	tmff2_release(tmff2, state);
+	this_cpu_inc(tmff2->stats->evictions);
+}
+
+static int tmff2_acquire(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state, int evict)
+{
+	struct tmff2_effect_state *victim = NULL, *other;
+	int slot;
+
+	if (test_bit(FF_EFFECT_RESIDENT, &state->flags))
+		return 0;
+
+	for (slot = 0; slot < tmff2->hw_effects; ++slot) {
+		if (tmff2->slots[slot].owner < 0
+				&& !READ_ONCE(tmff2->slots[slot].queued))
+			goto found;
+	}
+
+	if (!evict)
+		return -ENOSPC;
+
+	for (slot = 0; slot < tmff2->hw_effects; ++slot) {
+		if (tmff2->slots[slot].owner < 0)
+			continue;
+
+		other = &tmff2->states[tmff2->slots[slot].owner];
+		if (!tmff2_evictable(tmff2, other))
+			continue;
+
+		/* never played effects have a start_time of 0 */
+		if (!victim || ktime_before(other->start_time, victim->start_time))
+			victim = other;
+	}
+
+	if (!victim)
+		return -ENOSPC;
+
+	slot = victim->slot;
+	tmff2_evict(tmff2, victim);
+
+found:
+	tmff2->slots[slot].owner = state - tmff2->states;
+	state->slot = slot;
+	state->effect.id = slot;
+	__set_bit(FF_EFFECT_RESIDENT, &state->flags);
+	return 0;
+}
+
+/* With host_mixing, constant, ramp and periodic effects never go to the
+ * wheel themselves. The work handler evaluates the playing ones on every run,
+ * sums them up and sends the sum as the level of one constant force in a
+ * slot of its own, so however many effects a game layers the wheel gets at
+ * most one modify per run. Conditions depend on the wheel's position and stay
+ * on the wheel. */
+static int tmff2_mixed(struct tmff2_device_entry *tmff2,
+		const struct ff_effect *effect)
+{
+	return tmff2->host_mixing && (effect->type == FF_CONSTANT
+			|| effect->type == FF_RAMP || effect->type == FF_PERIODIC);
+}
+
+/* value t ms into playback, shaped by the envelope the way ff-memless does */
+static s32 tmff2_envelope(const struct ff_effect *effect,
+		const struct ff_envelope *envelope, s32 value, s64 t)
+{
+	s64 from, length;
+	s32 level, difference;
+
+	if (t < envelope->attack_length) {
+		from = t;
+		length = envelope->attack_length;
+		level = min_t(u16, envelope->attack_level, 0x7fff);
+	} else if (envelope->fade_length && effect->replay.length
+			&& t > effect->replay.length - envelope->fade_length
+			&& t < effect->replay.length) {
+		from = effect->replay.length - t;
+		length = envelope->fade_length;
+		level = min_t(u16, envelope->fade_level, 0x7fff);
+	} else {
+		return value;
+	}
+
+	difference = div64_s64((s64)(abs(value) - level) * from, length);
+	return value < 0 ? -(difference + level) : difference + level;
+}
+
+/* one period of a waveform, x runs from 0 to 0xffff over it */
+static s32 tmff2_waveform(u16 waveform, u32 x)
+{
+	switch (waveform) {
+	case FF_SQUARE:
+		return x < 0x8000 ? 0x7fff : -0x7fff;
+	case FF_TRIANGLE:
+		if (x < 0x4000)
+			return x * 0x7fff >> 14;
+		if (x < 0xc000)
+			return 0x7fff - ((x - 0x4000) * 0x7fff >> 14);
+		return ((x - 0xc000) * 0x7fff >> 14) - 0x7fff;
+	case FF_SINE:
+		return tmff2_sin_table[x * 360 >> 16];
+	case FF_SAW_UP:
+		return (s32)(x * 0xffff >> 16) - 0x7fff;
+	case FF_SAW_DOWN:
+		return 0x7fff - (s32)(x * 0xffff >> 16);
+	default:
+		return 0;
+	}
+}
+
+/* force of a mixed effect along the wheel at now. Called with tmff2->lock
+ * held */
+static s32 tmff2_render(struct tmff2_effect_state *state, ktime_t now)
+{
+	struct ff_effect *effect = &state->effect;
+	struct ff_periodic_effect *periodic = &effect->u.periodic;
+	struct ff_ramp_effect *ramp = &effect->u.ramp;
+	s64 t = ktime_ms_delta(now, state->start_time) - effect->replay.delay;
+	s32 value, magnitude;
+	u32 x;
+
+	/* the wheel would still be waiting out the delay */
+	if (t < 0)
+		return 0;
+
+	switch (effect->type) {
+	case FF_CONSTANT:
+		value = tmff2_envelope(effect, &effect->u.constant.envelope,
+				effect->u.constant.level, t);
+		break;
+	case FF_RAMP:
+		value = ramp->start_level;
+		if (effect->replay.length)
+			value += div64_s64((s64)(ramp->end_level - ramp->start_level)
+					* min_t(s64, t, effect->replay.length),
+					effect->replay.length);
+		value = tmff2_envelope(effect, &ramp->envelope, value, t);
+		break;
+	case FF_PERIODIC:
+		magnitude = tmff2_envelope(effect, &periodic->envelope,
+				periodic->magnitude, t);
+		div_u64_rem(t, periodic->period, &x);
+		x = ((x << 16) / periodic->period + periodic->phase) & 0xffff;
+		value = periodic->offset + tmff2_scale(magnitude,
+				tmff2_waveform(periodic->waveform, x));
+		break;
+	default:
+		return 0;
+	}
+
+	return tmff2_scale(tmff2_sat_s16(value), tmff2_projection(state));
+}
+
+/* sum up the mixed effects and queue whatever brings the wheel's constant
+ * force to the sum: its upload and start the first time, after that a
+ * modify of its level if that changed. Returns nonzero while the mixer has
+ * to keep running. Called with tmff2->lock held. */
+static int tmff2_mix(struct tmff2_device_entry *tmff2, ktime_t now)
+{
+	struct tmff2_effect_state *mix = &tmff2->mix, *state;
+	int effect_id, playing = 0, prio;
+	s32 sum = 0;
+
+	for_each_set_bit(effect_id, tmff2->mixed, tmff2->max_effects) {
+		state = &tmff2->states[effect_id];
+		sum += tmff2_render(state, now);
+		playing = 1;
+	}
+
+	sum = div_s64((s64)sum * READ_ONCE(tmff2->host_gain), GAIN_MAX);
+	mix->effect.u.constant.level = tmff2_sat_s16(sum);
+
+	if (playing)
+		this_cpu_inc(tmff2->stats->mixes);
+
+	if (test_bit(FF_EFFECT_RESIDENT, &mix->flags)) {
+		if ((u16)mix->effect.u.constant.level == mix->shadow.level) {
+			if (playing)
+				this_cpu_inc(tmff2->stats->mixes_unchanged);
+			return playing;
+		}
+
+		__set_bit(FF_EFFECT_QUEUE_UPDATE, &mix->flags);
+		prio = TMFF2_PRIO_MODIFY;
+	} else {
+		/* nothing has been sent yet, or it has to be sent again */
+		if (!playing && !test_bit(FF_EFFECT_QUEUE_UPLOAD, &mix->flags))
+			return 0;
+
+		__set_bit(FF_EFFECT_QUEUE_UPLOAD, &mix->flags);
+		prio = TMFF2_PRIO_PLAY;
+	}
+
+	if (tmff2_encode(tmff2, mix))
+		return 1;
+
+	/* if the queue is full the next run tries again with a fresh sum. The
+	 * start only queues a packet, so it's fine under the lock */
+	if (tmff2_queue_packets(tmff2, prio, mix->slot, mix->packets.buf[0],
+				mix->packets.count, TMFF2_PACKET_SIZE))
+		return 1;
+
+	if (prio == TMFF2_PRIO_PLAY) {
+		if (tmff2->play_effect(tmff2->data, mix)) {
+			hid_warn(tmff2->hdev, "failed starting mixer\n");
+			return 1;
+		}
+
+		__set_bit(FF_EFFECT_RESIDENT, &mix->flags);
+	}
+
+	mix->flags &= ~(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE));
+	mix->shadow = mix->next;
+	mix->packets.count = 0;
+
+	/* one more run to settle the level once the last effect has stopped */
+	return 1;
+}
+
+/* queue the work of one slot for the wheel. The encoded packets go straight
+ * into the command queue with the lock held, playback goes through the
+ * backend without it. Returns nonzero if something has to be retried. */
+static int tmff2_tick_slot(struct tmff2_device_entry *tmff2, int effect_id,
+		ktime_t now)
+{
+	struct tmff2_effect_state *state = &tmff2->states[effect_id];
+	struct tmff2_effect_state snap;
+	unsigned long todo, done = 0, flags;
+	int retry, prio;
+
+	tmff2_lock(tmff2, &flags);
+	__clear_bit(effect_id, tmff2->pending);
+
+	if (state->flags & (BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE))
+			&& !test_bit(FF_EFFECT_DEFERRED, &state->flags)) {
+		prio = test_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags) ?
+			TMFF2_PRIO_UPLOAD : TMFF2_PRIO_MODIFY;
+
+		/* the start would wait behind the effect it starts, so both
+		 * go out through the play queue */
+		if (prio == TMFF2_PRIO_UPLOAD
+				&& test_bit(FF_EFFECT_QUEUE_START, &state->flags))
+			prio = TMFF2_PRIO_PLAY;
+
+		/* if the queue is full the packets stay where they are, and
+		 * get another go on the next run */
+		if (!tmff2_queue_packets(tmff2, prio, state->slot,
+					state->packets.buf[0], state->packets.count,
+					TMFF2_PACKET_SIZE)) {
+			state->flags &= ~(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE));
+			if (prio == TMFF2_PRIO_PLAY)
+				__set_bit(FF_EFFECT_FUSED, &state->flags);
+			else
+				__clear_bit(FF_EFFECT_FUSED, &state->flags);
+			/* newer updates get encoded against what we just queued */
+			state->shadow = state->next;
+			state->packets.count = 0;
+			state->requested = 0;
+		}
+	}
+
+	todo = state->flags & (BIT(FF_EFFECT_QUEUE_START) | BIT(FF_EFFECT_QUEUE_STOP));
+	state->flags &= ~todo;
+
+	/* the mixer plays these, there's nothing to tell the wheel */
+	if (tmff2_mixed(tmff2, &state->effect)) {
+		done = todo;
+		goto played;
+	}
+
+	snap = *state;
+	tmff2_unlock(tmff2, flags);
+
+	if (test_bit(FF_EFFECT_QUEUE_START, &todo)) {
+		if (tmff2->play_effect(tmff2->data, &snap))
+			hid_warn(tmff2->hdev, "failed starting effect\n");
+		else
+			__set_bit(FF_EFFECT_QUEUE_START, &done);
+	}
+
+	if (test_bit(FF_EFFECT_QUEUE_STOP, &todo)) {
+		if (tmff2->stop_effect(tmff2->data, &snap))
+			hid_warn(tmff2->hdev, "failed stopping effect\n");
+		else
+			__set_bit(FF_EFFECT_QUEUE_STOP, &done);
+	}
+
+	tmff2_lock(tmff2, &flags);
+
+played:
+	if (done)
+		state->play_requested = 0;
+
+	if (test_bit(FF_EFFECT_QUEUE_START, &done)) {
+		__set_bit(FF_EFFECT_PLAYING, &state->flags);
+		state->start_time = now;
+	}
+
+	if (test_bit(FF_EFFECT_QUEUE_STOP, &done))
+		__clear_bit(FF_EFFECT_PLAYING, &state->flags);
+
+	/* requeue whatever failed, unless userspace asked for the opposite in
+	 * the meantime */
+	todo &= ~done;
+	if (test_bit(FF_EFFECT_QUEUE_START, &todo)
+			&& test_bit(FF_EFFECT_QUEUE_STOP, &state->flags))
+		__clear_bit(FF_EFFECT_QUEUE_START, &todo);
+	if (test_bit(FF_EFFECT_QUEUE_STOP, &todo)
+			&& test_bit(FF_EFFECT_QUEUE_START, &state->flags))
+		__clear_bit(FF_EFFECT_QUEUE_STOP, &todo);
+	state->flags |= todo;
+
+	if (test_bit(FF_EFFECT_PLAYING, &state->flags))
+		__set_bit(effect_id, tmff2->playing);
+	else
+		__clear_bit(effect_id, tmff2->playing);
+
+	if (test_bit(FF_EFFECT_PLAYING, &state->flags)
+			&& tmff2_mixed(tmff2, &state->effect))
+		__set_bit(effect_id, tmff2->mixed);
+	else
+		__clear_bit(effect_id, tmff2->mixed);
+
+	/* infinite effects never expire, so only finite ones have to
+	 * be tracked for deadlines */
+	if (test_bit(FF_EFFECT_PLAYING, &state->flags)
+			&& state->effect.replay.length)
+		__set_bit(effect_id, tmff2->timed);
+	else
+		__clear_bit(effect_id, tmff2->timed);
+
+	/* the stop of an erased effect is on its way, so the slot can go to
+	 * the next effect that needs one */
+	if (test_bit(FF_EFFECT_ERASED, &state->flags)
+			&& !(state->flags & (FF_EFFECT_QUEUE_MASK | BIT(FF_EFFECT_PLAYING)))
+			&& !state->play_requested)
+		tmff2_release(tmff2, state);
+
+	/* something couldn't be queued, try again on the next run. A held
+	 * back upload waits for tmff2_play instead */
+	retry = (state->flags & FF_EFFECT_QUEUE_MASK) != 0
+		&& !test_bit(FF_EFFECT_DEFERRED, &state->flags);
+	if (retry)
+		__set_bit(effect_id, tmff2->pending);
+
+	tmff2_unlock(tmff2, flags);
+
+	return retry;
+}
+
+static void tmff2_tick(struct tmff2_device_entry *tmff2)
 {
-	struct delayed_work *dw = container_of(w, struct delayed_work, work);
-	struct tmff2_device_entry *tmff2 = container_of(dw, struct tmff2_device_entry, work);
 	struct tmff2_effect_state *state;
-	int max_count = 0, effect_id;
-	unsigned long time_now;
-	__u16 effect_length;
+	ktime_t now, end, deadline = KTIME_MAX;
+	unsigned long flags;
+	unsigned int active;
+	int effect_id, retry = 0, empty = 1, mixing = 0;
 
 
 	if (!tmff2)
 		return;
 
-	for (effect_id = 0; effect_id < tmff2->max_effects; ++effect_id) {
-		spin_lock(&tmff2->lock);
+	now = ktime_get();
+	tmff2_count_wakeup(tmff2, now);
 
-		time_now = JIFFIES2MS(jiffies);
+	tmff2_lock(tmff2, &flags);
+	trace_tmff2_tick_begin(tmff2, tmff2->tick_due, now);
+	tmff2_record_jitter(tmff2, now);
+	tmff2->last_tick = now;
+	/* anything posted from here on has to arm us again */
+	tmff2->armed = KTIME_MAX;
+
+	/* expire finished effects, the ones that have to be repeated get
+	 * restarted along with the rest of the pending work */
+	for_each_set_bit(effect_id, tmff2->timed, tmff2->max_effects) {
 		state = &tmff2->states[effect_id];
 
-		effect_length = state->effect.replay.length;
-		if (test_bit(FF_EFFECT_PLAYING, &state->flags) && effect_length) {
-			if ((time_now - state->start_time) >= effect_length) {
-				__clear_bit(FF_EFFECT_PLAYING, &state->flags);
-				__clear_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
+		if (ktime_before(now, tmff2_effect_end(state)))
+			continue;
 
-				if (state->count)
-					state->count--;
+		empty = 0;
+		__clear_bit(effect_id, tmff2->timed);
+		__clear_bit(effect_id, tmff2->mixed);
+		__clear_bit(effect_id, tmff2->playing);
+		__clear_bit(FF_EFFECT_PLAYING, &state->flags);
+		__clear_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
 
-				if (state->count)
-					__set_bit(FF_EFFECT_QUEUE_START, &state->flags);
-			}
-		}
+		if (state->count)
+			state->count--;
 
-		if (test_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags)) {
-			if (tmff2->upload_effect(tmff2->data, state)) {
-				hid_warn(tmff2->hdev, "failed uploading effect\n");
-			} else {
-				__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-				/* if we're uploading an effect, it's bound to be the up
-				 * to date available */
-				__clear_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
-			}
+		if (state->count) {
+			__set_bit(FF_EFFECT_QUEUE_START, &state->flags);
+			__set_bit(effect_id, tmff2->pending);
 		}
+	}
 
-		if (test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
-			if (tmff2->update_effect(tmff2->data, state))
-				hid_warn(tmff2->hdev, "failed updating effect\n");
-			else
-				__clear_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
-		}
+	/* only visit each slot once per run, slots that get queued again
+	 * while we're at it are left for the next one */
+	effect_id = find_first_bit(tmff2->pending, tmff2->max_effects);
+	while (effect_id < tmff2->max_effects) {
+		empty = 0;
+		tmff2_unlock(tmff2, flags);
 
-		if (test_bit(FF_EFFECT_QUEUE_START, &state->flags)) {
-			if (tmff2->play_effect(tmff2->data, state)) {
-				hid_warn(tmff2->hdev, "failed starting effect\n");
-			} else {
-				__clear_bit(FF_EFFECT_QUEUE_START, &state->flags);
-				__set_bit(FF_EFFECT_PLAYING, &state->flags);
-			}
+		retry |= tmff2_tick_slot(tmff2, effect_id, now);
 
-		}
+		tmff2_lock(tmff2, &flags);
+		effect_id = find_next_bit(tmff2->pending, tmff2->max_effects,
+				effect_id + 1);
+	}
 
-		if (test_bit(FF_EFFECT_QUEUE_STOP, &state->flags)) {
-			if (tmff2->stop_effect(tmff2->data, state)) {
-				hid_warn(tmff2->hdev, "failed stopping effect\n");
-			} else {
-				__clear_bit(FF_EFFECT_PLAYING, &state->flags);
-				__clear_bit(FF_EFFECT_QUEUE_STOP, &state->flags);
-			}
-		}
+	if (tmff2->host_mixing && (mixing = tmff2_mix(tmff2, now)))
+		empty = 0;
+
+	for_each_set_bit(effect_id, tmff2->timed, tmff2->max_effects) {
+		end = tmff2_effect_end(&tmff2->states[effect_id]);
+		if (ktime_before(end, deadline))
+			deadline = end;
+	}
+
+	active = bitmap_weight(tmff2->playing, tmff2->max_effects);
+
+	/* the lock keeps us on this cpu */
+	if (active > this_cpu_read(tmff2->stats->active_max))
+		this_cpu_write(tmff2->stats->active_max, active);
+	this_cpu_inc(tmff2->stats->ticks);
+	if (empty)
+		this_cpu_inc(tmff2->stats->ticks_empty);
+	tmff2_unlock(tmff2, flags);
+
+	tmff2->next_deadline = deadline;
+	trace_tmff2_tick_end(tmff2, now, retry);
+
+	active = min_t(unsigned int, active, TMFF2_TICK_BUCKETS - 1);
+	tmff2->tick_ns[active] += ktime_to_ns(ktime_sub(ktime_get(), now));
+	tmff2->tick_count[active]++;
+
+	if (!tmff2->allow_scheduling)
+		return;
 
-		if (state->count > max_count)
-			max_count = state->count;
+	tmff2_lock(tmff2, &flags);
+	if (retry || mixing)
+		tmff2_queue_work(tmff2, ktime_add_ms(ktime_get(), timer_msecs));
+	else if (deadline != KTIME_MAX)
+		tmff2_queue_work(tmff2, deadline);
+	tmff2_unlock(tmff2, flags);
+}
+
+static void tmff2_work_handler(struct work_struct *w)
+{
+	struct delayed_work *dw = to_delayed_work(w);
+
+	tmff2_tick(container_of(dw, struct tmff2_device_entry, work));
+}
+
+static void tmff2_kwork_handler(struct kthread_work *w)
+{
+	struct kthread_delayed_work *dw =
+		container_of(w, struct kthread_delayed_work, work);
+
+	tmff2_tick(container_of(dw, struct tmff2_device_entry, kwork));
+}
+
+/* Games may update one effect far faster than we're allowed to talk to the
+ * wheel. Only the latest version of each effect is kept, and the backend diffs
+ * it against state->shadow, which is what the wheel has or is being sent, so any
+ * number of updates between two runs of the work handler collapse into one
+ * set of packets. Called with tmff2->lock held. */
+static void tmff2_coalesce(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state, struct ff_effect *effect,
+		int update)
+{
+	state->effect = *effect;
+	state->effect.id = state->slot;
+	__set_bit(effect->id, tmff2->pending);
+
+	if (!state->requested)
+		state->requested = ktime_get();
+
+	if (!update) {
+		__set_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
+		return;
+	}
 
-		spin_unlock(&tmff2->lock);
+	tmff2->updates++;
+	if (test_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags)
+			|| __test_and_set_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
+		tmff2->updates_coalesced++;
+		this_cpu_inc(tmff2->stats->coalesced);
 	}
+}
+
+/* With lazy_upload, games that upload a whole set of effects up front don't
+ * flood the wheel with them. The encoded upload stays in the slot until
+ * tmff2_play starts the effect, and then goes out right before the start.
+ * Effects that already play or have a start or stop queued go out as
+ * usual. Returns nonzero if the upload was held back. Called with
+ * tmff2->lock held. */
+static int tmff2_defer(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state)
+{
+	if (!tmff2->lazy_upload
+			|| !test_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags)
+			|| state->flags & (BIT(FF_EFFECT_QUEUE_START) |
+				BIT(FF_EFFECT_QUEUE_STOP) | BIT(FF_EFFECT_PLAYING)))
+		return 0;
+
+	if (!__test_and_set_bit(FF_EFFECT_DEFERRED, &state->flags))
+		this_cpu_inc(tmff2->stats->deferred);
+
+	__clear_bit(state - tmff2->states, tmff2->pending);
+	/* the wait for the first play doesn't count as latency */
+	state->requested = 0;
+	return 1;
+}
 
-	if (max_count && tmff2->allow_scheduling)
-		schedule_delayed_work(&tmff2->work, msecs_to_jiffies(timer_msecs));
+/* a mixed effect that gets the id of an erased one that still holds a slot
+ * has no use for the slot. The old effect's stop mustn't get lost with it,
+ * the stop only queues a packet so it's fine under the lock. Called with
+ * tmff2->lock held. */
+static void tmff2_vacate(struct tmff2_device_entry *tmff2,
+		struct tmff2_effect_state *state)
+{
+	int effect_id = state - tmff2->states;
+
+	if (state->flags & (BIT(FF_EFFECT_PLAYING) | BIT(FF_EFFECT_QUEUE_STOP))
+			&& tmff2->stop_effect(tmff2->data, state))
+		hid_warn(tmff2->hdev, "failed stopping effect\n");
+
+	state->flags &= ~(BIT(FF_EFFECT_PLAYING) | BIT(FF_EFFECT_QUEUE_START) |
+			BIT(FF_EFFECT_QUEUE_STOP) | BIT(FF_EFFECT_FUSED));
+	state->play_requested = 0;
+	__clear_bit(effect_id, tmff2->timed);
+	__clear_bit(effect_id, tmff2->playing);
+	__clear_bit(effect_id, tmff2->pending);
+	tmff2_release(tmff2, state);
 }
 
 static int tmff2_upload(struct input_dev *dev,
@@ -374,6 +1485,8 @@ static int tmff2_upload(struct input_dev *dev,
 {
 	struct tmff2_effect_state *state;
 	struct tmff2_device_entry *tmff2 = tmff2_from_input(dev);
+	unsigned long flags;
+	int ret;
 
 	if (!tmff2)
 		return -ENODEV;
@@ -383,27 +1496,54 @@ static int tmff2_upload(struct input_dev *dev,
 
 	state = &tmff2->states[effect->id];
 
-	spin_lock(&tmff2->lock);
-
-	state->effect = *effect;
+	tmff2_lock(tmff2, &flags);
+
+	if (!old) {
+		if (__test_and_clear_bit(FF_EFFECT_DEFERRED, &state->flags))
+			this_cpu_inc(tmff2->stats->avoided);
+		if (tmff2_mixed(tmff2, effect)
+				&& test_bit(FF_EFFECT_RESIDENT, &state->flags))
+			tmff2_vacate(tmff2, state);
+		/* the effect's stop may still be on its way, but the slot
+		 * can stay with it */
+		__clear_bit(FF_EFFECT_ERASED, &state->flags);
+	}
 
-	if (old) {
-		if (test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags))
-			state->old = *old;
+	/* the mixer picks it up on its next run */
+	if (tmff2_mixed(tmff2, effect)) {
+		state->effect = *effect;
+		ret = 0;
+		goto out;
+	}
 
-		__set_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
-	} else {
-		__set_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
+	tmff2_coalesce(tmff2, state, effect, old != NULL);
+
+	/* effects without a slot aren't on the wheel, so there's nothing to
+	 * send until they're played */
+	if (!test_bit(FF_EFFECT_RESIDENT, &state->flags)
+			&& (old || tmff2_acquire(tmff2, state, 0))) {
+		state->flags &= ~(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE));
+		__clear_bit(effect->id, tmff2->pending);
+		state->requested = 0;
+		ret = 0;
+		goto out;
 	}
 
-	spin_unlock(&tmff2->lock);
-	return 0;
+	ret = tmff2_encode(tmff2, state);
+	if (!ret && !tmff2_defer(tmff2, state))
+		tmff2_schedule_work(tmff2);
+
+out:
+	tmff2_unlock(tmff2, flags);
+	return ret;
 }
 
 static int tmff2_play(struct input_dev *dev, int effect_id, int value)
 {
 	struct tmff2_effect_state *state;
 	struct tmff2_device_entry *tmff2 = tmff2_from_input(dev);
+	unsigned long flags;
+	int ret = 0;
 
 	if (!tmff2)
 		return -ENODEV;
@@ -412,10 +1552,36 @@ static int tmff2_play(struct input_dev *dev, int effect_id, int value)
 	if (&state->effect == 0)
 		return 0;
 
-	spin_lock(&tmff2->lock);
+	tmff2_lock(tmff2, &flags);
+	trace_tmff2_play(tmff2, state, value);
+
+	if (!test_bit(FF_EFFECT_RESIDENT, &state->flags)
+			&& !tmff2_mixed(tmff2, &state->effect)) {
+		/* nothing to stop on the wheel */
+		if (value <= 0)
+			goto out;
+
+		if ((ret = tmff2_acquire(tmff2, state, 1)))
+			goto out;
+
+		this_cpu_inc(tmff2->stats->misses);
+		__set_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
+		if ((ret = tmff2_encode(tmff2, state))) {
+			tmff2_release(tmff2, state);
+			goto out;
+		}
+		state->requested = ktime_get();
+	}
+
+	__set_bit(effect_id, tmff2->pending);
+
+	if (!state->play_requested)
+		state->play_requested = ktime_get();
+
 	if (value > 0) {
 		state->count = value;
-		state->start_time = JIFFIES2MS(jiffies);
+		if (__test_and_clear_bit(FF_EFFECT_DEFERRED, &state->flags))
+			state->requested = state->play_requested;
 		__set_bit(FF_EFFECT_QUEUE_START, &state->flags);
 		__clear_bit(FF_EFFECT_QUEUE_STOP, &state->flags);
 	} else {
@@ -423,11 +1589,53 @@ static int tmff2_play(struct input_dev *dev, int effect_id, int value)
 		__clear_bit(FF_EFFECT_QUEUE_START, &state->flags);
 	}
 
-	spin_unlock(&tmff2->lock);
+	tmff2_schedule_work(tmff2);
+
+out:
+	tmff2_unlock(tmff2, flags);
+
+	return ret;
+}
+
+static int tmff2_erase(struct input_dev *dev, int effect_id)
+{
+	struct tmff2_effect_state *state;
+	struct tmff2_device_entry *tmff2 = tmff2_from_input(dev);
+	unsigned long flags;
+
+	if (!tmff2)
+		return -ENODEV;
+
+	state = &tmff2->states[effect_id];
+
+	tmff2_lock(tmff2, &flags);
+
+	if (__test_and_clear_bit(FF_EFFECT_DEFERRED, &state->flags))
+		this_cpu_inc(tmff2->stats->avoided);
+
+	/* no point in sending an effect that's going away. The input core
+	 * stops it first, the slot is freed once that has been queued */
+	state->flags &= ~(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_UPDATE));
+	state->packets.count = 0;
+	state->requested = 0;
+
+	/* the mixer drops it right away, the wheel never had it */
+	if (tmff2_mixed(tmff2, &state->effect)) {
+		state->flags &= ~(BIT(FF_EFFECT_QUEUE_START) |
+				BIT(FF_EFFECT_QUEUE_STOP) | BIT(FF_EFFECT_PLAYING));
+		state->play_requested = 0;
+		__clear_bit(effect_id, tmff2->mixed);
+		__clear_bit(effect_id, tmff2->timed);
+		__clear_bit(effect_id, tmff2->playing);
+	}
 
-	if (!delayed_work_pending(&tmff2->work) && tmff2->allow_scheduling)
-		schedule_delayed_work(&tmff2->work, 0);
+	if (test_bit(FF_EFFECT_RESIDENT, &state->flags)) {
+		__set_bit(FF_EFFECT_ERASED, &state->flags);
+		__set_bit(effect_id, tmff2->pending);
+		tmff2_schedule_work(tmff2);
+	}
 
+	tmff2_unlock(tmff2, flags);
 	return 0;
 }
 
@@ -448,12 +1656,19 @@ static int tmff2_open(struct input_dev *dev)
 static void tmff2_close(struct input_dev *dev)
 {
 	struct tmff2_device_entry *tmff2 = tmff2_from_input(dev);
+	unsigned long flags;
 
 	if (!tmff2)
 		return;
 
 	/* since we're closing the device, no need to continue feeding it new data */
-	cancel_delayed_work_sync(&tmff2->work);
+	tmff2_cancel_work(tmff2);
+
+	/* don't count on the mixer's effect surviving the close */
+	tmff2_lock(tmff2, &flags);
+	tmff2->armed = KTIME_MAX;
+	tmff2->mix.flags = 0;
+	tmff2_unlock(tmff2, flags);
 
 	if (tmff2->close) {
 		tmff2->close(tmff2->data);
@@ -528,26 +1743,586 @@ gain_err:
 	return ret;
 }
 
+static int tmff2_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void tmff2_jitter_show(struct seq_file *m,
+		struct tmff2_device_entry *tmff2)
+{
+	unsigned int count = tmff2->jitter_count;
+	u32 *sorted;
+
+	seq_printf(m, "jitter_samples: %u\n", count);
+	if (!count)
+		return;
+
+	sorted = kmemdup(tmff2->jitter, sizeof(tmff2->jitter), GFP_KERNEL);
+	if (!sorted)
+		return;
+
+	sort(sorted, count, sizeof(*sorted), tmff2_cmp_u32, NULL);
+	seq_printf(m, "jitter_us_p50: %u\n", sorted[count / 2] / 1000);
+	seq_printf(m, "jitter_us_p99: %u\n", sorted[count * 99 / 100] / 1000);
+	seq_printf(m, "jitter_us_max: %u\n", sorted[count - 1] / 1000);
+
+	kfree(sorted);
+}
+
+static int tmff2_scheduler_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	ktime_t now = ktime_get();
+	ktime_t deadline = tmff2->next_deadline;
+	s64 elapsed = ktime_to_ns(ktime_sub(now, tmff2->wakeups_window_start));
+	u64 rate = tmff2->wakeups_per_sec;
+
+	/* the last full window is stale if we've been sleeping since */
+	if (elapsed >= NSEC_PER_SEC)
+		rate = div64_u64((u64)tmff2->wakeups_window * NSEC_PER_SEC, elapsed);
+
+	seq_printf(m, "wakeups: %lu\n", tmff2->wakeups);
+	seq_printf(m, "wakeups_per_sec: %llu\n", rate);
+
+	if (deadline == KTIME_MAX)
+		seq_puts(m, "next_deadline_ms: none\n");
+	else
+		seq_printf(m, "next_deadline_ms: %lld\n", ktime_ms_delta(deadline, now));
+
+	seq_printf(m, "updates: %lu\n", tmff2->updates);
+	seq_printf(m, "updates_coalesced: %lu\n", tmff2->updates_coalesced);
+
+	seq_printf(m, "worker: %s\n", tmff2->kworker ? "kthread" : "workqueue");
+	tmff2_jitter_show(m, tmff2);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_scheduler);
+
+static int tmff2_lock_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	unsigned long acquired, contended, flags;
+	u64 wait_total, wait_max;
+
+	tmff2_lock(tmff2, &flags);
+	acquired = tmff2->lock_acquired;
+	contended = tmff2->lock_contended;
+	wait_total = tmff2->lock_wait_total_ns;
+	wait_max = tmff2->lock_wait_max_ns;
+	tmff2_unlock(tmff2, flags);
+
+	seq_printf(m, "acquisitions: %lu\n", acquired);
+	seq_printf(m, "contentions: %lu\n", contended);
+	seq_printf(m, "wait_total_ns: %llu\n", wait_total);
+	seq_printf(m, "wait_max_ns: %llu\n", wait_max);
+	seq_printf(m, "wait_avg_ns: %llu\n",
+			contended ? div64_u64(wait_total, contended) : 0);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_lock);
+
+/* average cost of encoding uploads and updates vs. sending the encoded
+ * packets from the work handler, per effect type */
+static int tmff2_encode_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	unsigned long uploads, updates, transmits;
+	int i;
+
+	seq_puts(m, "type uploads upload_avg_ns updates update_avg_ns transmits transmit_avg_ns\n");
+	for (i = 0; i < ARRAY_SIZE(tmff2_effect_names); ++i) {
+		uploads = tmff2->uploads[i];
+		updates = tmff2->updates_encoded[i];
+		transmits = tmff2->transmit_count[i];
+		if (!uploads && !updates && !transmits)
+			continue;
+
+		seq_printf(m, "%s %lu %llu %lu %llu %lu %llu\n",
+				tmff2_effect_names[i],
+				uploads,
+				uploads ? div64_u64(tmff2->upload_ns[i], uploads) : 0,
+				updates,
+				updates ? div64_u64(tmff2->update_ns[i], updates) : 0,
+				transmits,
+				transmits ? div64_u64(tmff2->transmit_ns[i], transmits) : 0);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_encode);
+
+/* average work handler run by how many effects were playing */
+static int tmff2_ticks_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	unsigned long count;
+	int i;
+
+	seq_puts(m, "active ticks tick_avg_ns\n");
+	for (i = 0; i < TMFF2_TICK_BUCKETS; ++i) {
+		count = tmff2->tick_count[i];
+		if (!count)
+			continue;
+
+		seq_printf(m, "%d%s %lu %llu\n", i,
+				i == TMFF2_TICK_BUCKETS - 1 ? "+" : "", count,
+				div64_u64(tmff2->tick_ns[i], count));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_ticks);
+
+/* packets per upload and per update, to see how much the modify commands
+ * save over uploading effects again. Updates absorbed by a newer one never
+ * get encoded on their own and aren't counted here */
+static int tmff2_packets_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	unsigned long uploads, updates;
+	int i;
+
+	seq_puts(m, "type uploads upload_packets updates update_packets\n");
+	for (i = 0; i < ARRAY_SIZE(tmff2_effect_names); ++i) {
+		uploads = tmff2->uploads[i];
+		updates = tmff2->updates_encoded[i];
+		if (!uploads && !updates)
+			continue;
+
+		seq_printf(m, "%s %lu %lu %lu %lu\n", tmff2_effect_names[i],
+				uploads, tmff2->upload_packets[i],
+				updates, tmff2->update_packets[i]);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_packets);
+
+/* which effect is in which hardware slot, evictions and misses in the stats
+ * file show whether they keep changing hands */
+static int tmff2_slots_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	struct tmff2_effect_state *state;
+	unsigned long flags;
+	int slot;
+
+	seq_puts(m, "slot effect type playing queued\n");
+
+	tmff2_lock(tmff2, &flags);
+	for (slot = 0; slot < tmff2->hw_effects; ++slot) {
+		if (!(state = tmff2_slot_state(tmff2, slot))) {
+			seq_printf(m, "%d - - - %u\n", slot,
+					READ_ONCE(tmff2->slots[slot].queued));
+			continue;
+		}
+
+		seq_printf(m, "%d %ld 0x%x %d %u\n", slot,
+				(long)(state - tmff2->states), state->effect.type,
+				test_bit(FF_EFFECT_PLAYING, &state->flags),
+				READ_ONCE(tmff2->slots[slot].queued));
+	}
+
+	if (tmff2->host_mixing)
+		seq_printf(m, "%d mix 0x%x %d %u\n", tmff2->mix.slot,
+				tmff2->mix.effect.type,
+				test_bit(FF_EFFECT_RESIDENT, &tmff2->mix.flags),
+				READ_ONCE(tmff2->slots[tmff2->mix.slot].queued));
+	tmff2_unlock(tmff2, flags);
+
+	seq_printf(m, "effects: %lu\n", tmff2->max_effects);
+	if (tmff2->host_mixing) {
+		seq_printf(m, "mix_level: %d\n", tmff2->mix.effect.u.constant.level);
+		seq_printf(m, "mix_gain: %d\n", READ_ONCE(tmff2->host_gain));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_slots);
+
+static int tmff2_queue_show(struct seq_file *m, void *unused)
+{
+	static const char * const names[TMFF2_PRIO_COUNT] = {
+		"stop", "play", "modify", "upload", "settings"
+	};
+	struct tmff2_device_entry *tmff2 = m->private;
+	unsigned int depth[TMFF2_PRIO_COUNT], depth_max;
+	unsigned long queued[TMFF2_PRIO_COUNT], full, sent, failed;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&tmff2->queue_lock, flags);
+	memcpy(depth, tmff2->queue_depth, sizeof(depth));
+	memcpy(queued, tmff2->queued, sizeof(queued));
+	depth_max = tmff2->queue_depth_max;
+	full = tmff2->queue_full;
+	sent = tmff2->sent;
+	failed = tmff2->send_failed;
+	spin_unlock_irqrestore(&tmff2->queue_lock, flags);
+
+	seq_puts(m, "priority depth queued\n");
+	for (i = 0; i < TMFF2_PRIO_COUNT; ++i)
+		seq_printf(m, "%s %u %lu\n", names[i], depth[i], queued[i]);
+
+	seq_printf(m, "depth_max: %u/%u\n", depth_max, TMFF2_QUEUE_LENGTH);
+	seq_printf(m, "full: %lu\n", full);
+	seq_printf(m, "sent: %lu\n", sent);
+	seq_printf(m, "failed: %lu\n", failed);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_queue);
+
+static void tmff2_stats_reset(struct tmff2_device_entry *tmff2)
+{
+	int cpu;
+
+	/* counters bumped while we're at it may or may not survive, which
+	 * doesn't matter for a sample of several seconds */
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(tmff2->stats, cpu), 0, sizeof(struct tmff2_stats));
+
+	tmff2->stats_since = ktime_get();
+}
+
+static u64 tmff2_per_sec(unsigned long count, s64 elapsed)
+{
+	return elapsed > 0 ? div64_u64((u64)count * NSEC_PER_SEC, elapsed) : 0;
+}
+
+static int tmff2_stats_show(struct seq_file *m, void *unused)
+{
+	struct tmff2_device_entry *tmff2 = m->private;
+	s64 elapsed = ktime_to_ns(ktime_sub(ktime_get(), tmff2->stats_since));
+	struct tmff2_stats *sum, *stats;
+	int cpu, i;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(tmff2->stats, cpu);
+
+		sum->packets += stats->packets;
+		sum->bytes += stats->bytes;
+		for (i = 0; i < TMFF2_STATS_ERRNOS; ++i)
+			sum->failed[i] += stats->failed[i];
+		sum->coalesced += stats->coalesced;
+		sum->deferred += stats->deferred;
+		sum->avoided += stats->avoided;
+		sum->evictions += stats->evictions;
+		sum->misses += stats->misses;
+		sum->mixes += stats->mixes;
+		sum->mixes_unchanged += stats->mixes_unchanged;
+		sum->ticks += stats->ticks;
+		sum->ticks_empty += stats->ticks_empty;
+		sum->active_max = max(sum->active_max, stats->active_max);
+		for (i = 0; i < ARRAY_SIZE(sum->opcodes); ++i)
+			sum->opcodes[i] += stats->opcodes[i];
+		sum->settings += stats->settings;
+		for (i = 0; i < ARRAY_SIZE(sum->types); ++i)
+			sum->types[i] += stats->types[i];
+	}
+
+	seq_printf(m, "elapsed_ms: %lld\n", div_s64(elapsed, NSEC_PER_MSEC));
+	seq_printf(m, "packets: %lu\n", sum->packets);
+	seq_printf(m, "packets_per_sec: %llu\n", tmff2_per_sec(sum->packets, elapsed));
+	seq_printf(m, "bytes: %lu\n", sum->bytes);
+	seq_printf(m, "bytes_per_sec: %llu\n", tmff2_per_sec(sum->bytes, elapsed));
+	seq_printf(m, "coalesced: %lu\n", sum->coalesced);
+	seq_printf(m, "uploads_deferred: %lu\n", sum->deferred);
+	seq_printf(m, "uploads_avoided: %lu\n", sum->avoided);
+	seq_printf(m, "evictions: %lu\n", sum->evictions);
+	seq_printf(m, "slot_misses: %lu\n", sum->misses);
+	seq_printf(m, "mixes: %lu\n", sum->mixes);
+	seq_printf(m, "mixes_unchanged: %lu\n", sum->mixes_unchanged);
+	seq_printf(m, "ticks: %lu\n", sum->ticks);
+	seq_printf(m, "ticks_empty: %lu\n", sum->ticks_empty);
+	seq_printf(m, "active_max: %u\n", sum->active_max);
+
+	for (i = 1; i < TMFF2_STATS_ERRNOS - 1; ++i) {
+		if (sum->failed[i])
+			seq_printf(m, "failed_errno_%d: %lu\n", i, sum->failed[i]);
+	}
+	if (sum->failed[TMFF2_STATS_ERRNOS - 1])
+		seq_printf(m, "failed_errno_other: %lu\n",
+				sum->failed[TMFF2_STATS_ERRNOS - 1]);
+
+	seq_printf(m, "settings: %lu\n", sum->settings);
+	for (i = 0; i < ARRAY_SIZE(sum->opcodes); ++i) {
+		if (sum->opcodes[i])
+			seq_printf(m, "opcode_%02x: %lu\n", i, sum->opcodes[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(tmff2_effect_names); ++i) {
+		if (sum->types[i])
+			seq_printf(m, "type_%s: %lu\n", tmff2_effect_names[i],
+					sum->types[i]);
+	}
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_stats);
+
+static ssize_t tmff2_stats_reset_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	tmff2_stats_reset(file->private_data);
+	return count;
+}
+
+static const struct file_operations tmff2_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = tmff2_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+static int tmff2_latency_show(struct seq_file *m, void *unused)
+{
+	static const char * const phases[TMFF2_LAT_COUNT] = {
+		"queue", "encode", "send", "total"
+	};
+	struct tmff2_device_entry *tmff2 = m->private;
+	char name[32];
+	int phase, i;
+
+	for (phase = 0; phase < TMFF2_LAT_COUNT; ++phase) {
+		for (i = 0; i < ARRAY_SIZE(tmff2_effect_names); ++i) {
+			snprintf(name, sizeof(name), "%s %s", phases[phase],
+					tmff2_effect_names[i]);
+			tmff2_hist_show(m, name, &tmff2->latency[phase][i]);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tmff2_latency);
+
+static ssize_t tmff2_latency_reset_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct tmff2_device_entry *tmff2 = file->private_data;
+
+	/* samples recorded while we're at it may or may not survive */
+	memset(tmff2->latency, 0, sizeof(tmff2->latency));
+	return count;
+}
+
+static const struct file_operations tmff2_latency_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = tmff2_latency_reset_write,
+	.llseek = noop_llseek,
+};
+
+static void tmff2_debugfs_init(struct tmff2_device_entry *tmff2)
+{
+	tmff2->debugfs_dir = debugfs_create_dir(dev_name(&tmff2->hdev->dev),
+			tmff2_debugfs_root);
+
+	debugfs_create_file("scheduler", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_scheduler_fops);
+	debugfs_create_file("lock", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_lock_fops);
+	debugfs_create_file("encode", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_encode_fops);
+	debugfs_create_file("ticks", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_ticks_fops);
+	debugfs_create_file("queue", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_queue_fops);
+	debugfs_create_file("slots", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_slots_fops);
+	debugfs_create_file("packets", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_packets_fops);
+	debugfs_create_file("stats", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_stats_fops);
+	debugfs_create_file("stats_reset", 0200, tmff2->debugfs_dir, tmff2,
+			&tmff2_stats_reset_fops);
+	debugfs_create_file("latency", 0444, tmff2->debugfs_dir, tmff2,
+			&tmff2_latency_fops);
+	debugfs_create_file("latency_reset", 0200, tmff2->debugfs_dir, tmff2,
+			&tmff2_latency_reset_fops);
+
+	if (tmff2->debugfs_init)
+		tmff2->debugfs_init(tmff2->data, tmff2->debugfs_dir);
+}
+
+/* the worker is bound to cpu, if there is one, before it first runs */
+static struct kthread_worker *tmff2_run_kworker(const char *name, int cpu)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+	struct kthread_worker *worker;
+
+	if (cpu < 0)
+		return kthread_run_worker(0, "tmff2-%s", name);
+
+	/* since 6.14 workers aren't woken up until we say so */
+	worker = kthread_create_worker(0, "tmff2-%s", name);
+	if (!IS_ERR(worker)) {
+		kthread_bind(worker->task, cpu);
+		wake_up_process(worker->task);
+	}
+
+	return worker;
+#else
+	if (cpu < 0)
+		return kthread_create_worker(0, "tmff2-%s", name);
+
+	return kthread_create_worker_on_cpu(cpu, 0, "tmff2-%s", name);
+#endif
+}
+
+static int tmff2_create_worker(struct tmff2_device_entry *tmff2)
+{
+	const char *name = dev_name(&tmff2->hdev->dev);
+	struct sched_param param = { .sched_priority = worker_priority };
+	int ret, cpu = worker_cpu;
+
+	if (!worker_priority) {
+		tmff2->wq = alloc_ordered_workqueue("tmff2-%s", WQ_HIGHPRI, name);
+		return tmff2->wq ? 0 : -ENOMEM;
+	}
+
+	if (cpu >= 0 && (cpu >= nr_cpu_ids || !cpu_online(cpu))) {
+		hid_warn(tmff2->hdev, "cpu %i not available for worker\n", cpu);
+		cpu = -1;
+	}
+
+	tmff2->kworker = tmff2_run_kworker(name, cpu);
+	if (IS_ERR(tmff2->kworker)) {
+		ret = PTR_ERR(tmff2->kworker);
+		tmff2->kworker = NULL;
+		return ret;
+	}
+
+	if ((ret = sched_setscheduler_nocheck(tmff2->kworker->task,
+					SCHED_FIFO, &param)))
+		hid_warn(tmff2->hdev, "unable to set worker priority: %i\n", ret);
+
+	return 0;
+}
+
+static void tmff2_destroy_worker(struct tmff2_device_entry *tmff2)
+{
+	if (tmff2->kworker)
+		kthread_destroy_worker(tmff2->kworker);
+
+	if (tmff2->wq)
+		destroy_workqueue(tmff2->wq);
+
+	tmff2->kworker = NULL;
+	tmff2->wq = NULL;
+}
+
+static int tmff2_queue_init(struct tmff2_device_entry *tmff2)
+{
+	int i;
+
+	tmff2->commands = kcalloc(TMFF2_QUEUE_LENGTH, sizeof(*tmff2->commands),
+			GFP_KERNEL);
+	if (!tmff2->commands)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&tmff2->free_commands);
+	for (i = 0; i < TMFF2_PRIO_COUNT; ++i)
+		INIT_LIST_HEAD(&tmff2->queue[i]);
+
+	for (i = 0; i < TMFF2_QUEUE_LENGTH; ++i)
+		list_add_tail(&tmff2->commands[i].list, &tmff2->free_commands);
+
+	tmff2->queue_free = TMFF2_QUEUE_LENGTH;
+	return 0;
+}
+
+/* refuse new packets, whatever is already queued still goes out when the
+ * worker is destroyed */
+static void tmff2_queue_stop(struct tmff2_device_entry *tmff2)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tmff2->queue_lock, flags);
+	tmff2->queue_stopped = 1;
+	spin_unlock_irqrestore(&tmff2->queue_lock, flags);
+}
+
 static int tmff2_wheel_init(struct tmff2_device_entry *tmff2)
 {
 	int ret, i;
 	struct ff_device *ff;
 
-	spin_lock_init(&lock);
 	spin_lock_init(&tmff2->lock);
+	spin_lock_init(&tmff2->queue_lock);
 	INIT_DELAYED_WORK(&tmff2->work, tmff2_work_handler);
+	kthread_init_delayed_work(&tmff2->kwork, tmff2_kwork_handler);
+	INIT_WORK(&tmff2->drain, tmff2_drain_handler);
+	kthread_init_work(&tmff2->kdrain, tmff2_kdrain_handler);
+	tmff2->next_deadline = KTIME_MAX;
+	tmff2->armed = KTIME_MAX;
 
 	/* get parameters etc from backend */
 	if ((ret = tmff2->wheel_init(tmff2)))
 		goto err;
 
+	tmff2->hw_effects = tmff2->max_effects;
+	tmff2->max_effects = clamp_t(int, virtual_effects, tmff2->hw_effects,
+			FF_MAX_EFFECTS);
+
+	tmff2->stats = alloc_percpu(struct tmff2_stats);
+	if (!tmff2->stats) {
+		ret = -ENOMEM;
+		goto err;
+	}
+	tmff2->stats_since = ktime_get();
+
+	if ((ret = tmff2_create_worker(tmff2))) {
+		hid_err(tmff2->hdev, "could not create worker\n");
+		goto stats_err;
+	}
+
+	if ((ret = tmff2_queue_init(tmff2)))
+		goto states_err;
 
 	tmff2->states = kzalloc(sizeof(struct tmff2_effect_state) * tmff2->max_effects,
 			GFP_KERNEL);
 
 	if (!tmff2->states) {
 		ret = -ENOMEM;
-		goto err;
+		goto states_err;
+	}
+
+	tmff2->pending = bitmap_zalloc(tmff2->max_effects, GFP_KERNEL);
+	tmff2->timed = bitmap_zalloc(tmff2->max_effects, GFP_KERNEL);
+	tmff2->mixed = bitmap_zalloc(tmff2->max_effects, GFP_KERNEL);
+	tmff2->playing = bitmap_zalloc(tmff2->max_effects, GFP_KERNEL);
+	tmff2->slots = kcalloc(tmff2->hw_effects, sizeof(*tmff2->slots),
+			GFP_KERNEL);
+	if (!tmff2->pending || !tmff2->timed || !tmff2->mixed
+			|| !tmff2->playing || !tmff2->slots) {
+		ret = -ENOMEM;
+		goto states_err;
+	}
+
+	for (i = 0; i < tmff2->hw_effects; ++i)
+		tmff2->slots[i].owner = -1;
+
+	/* the mixer takes the last slot, conditions share the rest */
+	if (tmff2->host_mixing && tmff2->hw_effects < 2) {
+		hid_warn(tmff2->hdev, "not enough slots for host_mixing\n");
+		tmff2->host_mixing = 0;
+	} else if (tmff2->host_mixing) {
+		tmff2->hw_effects--;
+		tmff2->mix.slot = tmff2->hw_effects;
+		tmff2->mix.effect.id = tmff2->mix.slot;
+		tmff2->mix.effect.type = FF_CONSTANT;
+		tmff2->mix.effect.direction = 0x4000;
+		tmff2->host_gain = GAIN_MAX;
 	}
 
 	/* set supported effects into input_dev->ffbit */
@@ -557,13 +2332,14 @@ static int tmff2_wheel_init(struct tmff2_device_entry *tmff2)
 	/* create actual ff device*/
 	if ((ret = input_ff_create(tmff2->input_dev, tmff2->max_effects))) {
 		hid_err(tmff2->hdev, "could not create input_ff\n");
-		goto err;
+		goto states_err;
 	}
 
 	/* set ff callbacks */
 	ff = tmff2->input_dev->ff;
 	ff->upload = tmff2_upload;
 	ff->playback = tmff2_play;
+	ff->erase = tmff2_erase;
 
 	if (tmff2->open)
 		tmff2->input_dev->open = tmff2_open;
@@ -574,26 +2350,41 @@ static int tmff2_wheel_init(struct tmff2_device_entry *tmff2)
 	/* set defaults wherever possible */
 	if (tmff2->set_gain) {
 		ff->set_gain = tmff2_set_gain;
-		tmff2->set_gain(tmff2->data, (GAIN_MAX * gain) / GAIN_MAX);
+		tmff2_apply_gain(tmff2, (GAIN_MAX * tmff2->gain) / GAIN_MAX);
 	}
 
 	if (tmff2->set_autocenter)
 		ff->set_autocenter = tmff2_set_autocenter;
 
 	if (tmff2->set_range)
-		tmff2->set_range(tmff2->data, range);
+		tmff2->set_range(tmff2->data, tmff2->range);
 
 	if (tmff2->switch_mode)
 		tmff2->switch_mode(tmff2->data, alt_mode);
 
 	/* create files */
 	if ((ret = tmff2_create_files(tmff2)))
-		goto err;
+		goto ff_err;
+
+	tmff2_debugfs_init(tmff2);
 
 	tmff2->allow_scheduling = 1;
 	return 0;
 
+ff_err:
 	input_ff_destroy(tmff2->input_dev);
+states_err:
+	kfree(tmff2->slots);
+	bitmap_free(tmff2->playing);
+	bitmap_free(tmff2->mixed);
+	bitmap_free(tmff2->timed);
+	bitmap_free(tmff2->pending);
+	kfree(tmff2->states);
+	tmff2_queue_stop(tmff2);
+	tmff2_destroy_worker(tmff2);
+	kfree(tmff2->commands);
+stats_err:
+	free_percpu(tmff2->stats);
 err:
 	return ret;
 }
@@ -612,6 +2403,14 @@ static int tmff2_probe(struct hid_device *hdev, const struct hid_device_id *id)
 	}
 
 	tmff2->hdev = hdev;
+	tmff2->spring_level = spring_level;
+	tmff2->damper_level = damper_level;
+	tmff2->friction_level = friction_level;
+	tmff2->range = range;
+	tmff2->gain = gain;
+	tmff2->lazy_upload = lazy_upload;
+	tmff2->host_mixing = host_mixing;
+	tmff2->is_usb = hid_is_usb(hdev);
 	hid_set_drvdata(tmff2->hdev, tmff2);
 
 	switch (tmff2->hdev->product) {
@@ -628,6 +2427,11 @@ static int tmff2_probe(struct hid_device *hdev, const struct hid_device_id *id)
 				goto wheel_err;
 			break;
 
+		case TMT500RS_PC_ID:
+			if ((ret = t500rs_populate_api(tmff2)))
+				goto wheel_err;
+			break;
+
 		default:
 			ret = -ENODEV;
 			goto wheel_err;
@@ -685,7 +2489,11 @@ static void tmff2_remove(struct hid_device *hdev)
 		return;
 
 	tmff2->allow_scheduling = 0;
-	cancel_delayed_work_sync(&tmff2->work);
+	tmff2_cancel_work(tmff2);
+	tmff2_queue_stop(tmff2);
+	tmff2_destroy_worker(tmff2);
+
+	debugfs_remove_recursive(tmff2->debugfs_dir);
 
 	dev = &tmff2->hdev->dev;
 	if (tmff2->params & PARAM_DAMPER_LEVEL)
@@ -706,7 +2514,14 @@ static void tmff2_remove(struct hid_device *hdev)
 	hid_hw_stop(hdev);
 	tmff2->wheel_destroy(tmff2->data);
 
+	kfree(tmff2->slots);
+	bitmap_free(tmff2->playing);
+	bitmap_free(tmff2->mixed);
+	bitmap_free(tmff2->timed);
+	bitmap_free(tmff2->pending);
 	kfree(tmff2->states);
+	kfree(tmff2->commands);
+	free_percpu(tmff2->stats);
 	kfree(tmff2);
 }
 
@@ -717,6 +2532,8 @@ static const struct hid_device_id tmff2_devices[] = {
 	{HID_USB_DEVICE(USB_VENDOR_ID_THRUSTMASTER, TMT300RS_PS4_NORM_ID)},
 	/* t248 PC*/
 	{HID_USB_DEVICE(USB_VENDOR_ID_THRUSTMASTER, TMT248_PC_ID)},
+	/* t500rs */
+	{HID_USB_DEVICE(USB_VENDOR_ID_THRUSTMASTER, TMT500RS_PC_ID)},
 	{}
 };
 MODULE_DEVICE_TABLE(hid, tmff2_devices);
@@ -728,6 +2545,27 @@ static struct hid_driver tmff2_driver = {
 	.remove = tmff2_remove,
 	.report_fixup = tmff2_report_fixup,
 };
-module_hid_driver(tmff2_driver);
+
+static int __init tmff2_init(void)
+{
+	int ret;
+
+	tmff2_sin_init();
+	tmff2_debugfs_root = debugfs_create_dir("tmff2", NULL);
+
+	if ((ret = hid_register_driver(&tmff2_driver)))
+		debugfs_remove_recursive(tmff2_debugfs_root);
+
+	return ret;
+}
+
+static void __exit tmff2_exit(void)
+{
+	hid_unregister_driver(&tmff2_driver);
+	debugfs_remove_recursive(tmff2_debugfs_root);
+}
+
+module_init(tmff2_init);
+module_exit(tmff2_exit);
 
 MODULE_LICENSE("GPL");
@@ -2,9 +2,11 @@
 #ifndef __HID_TMFF2_H
 #define __HID_TMFF2_H
 
-#include <linux/fixp-arith.h>
+#include <linux/kernel.h>
 #include <linux/ktime.h>
 #include <linux/input.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
 
 extern int timer_msecs;
 extern int spring_level;
@@ -13,6 +15,12 @@ extern int friction_level;
 extern int range;
 extern int gain;
 extern int alt_mode;
+extern int worker_priority;
+extern int worker_cpu;
+extern int lazy_upload;
+extern int virtual_effects;
+extern int host_mixing;
+extern int combined_modify;
 
 #define USB_VENDOR_ID_THRUSTMASTER 0x044f
 
@@ -24,11 +32,67 @@ extern int alt_mode;
  */
 #define DEFAULT_TIMER_PERIOD	8
 
+/* how many work handler start times are kept for the jitter percentiles */
+#define TMFF2_JITTER_SAMPLES	512
+
+/* work handler runs are timed by how many effects were playing, the last
+ * bucket takes everything from TMFF2_TICK_BUCKETS - 1 up */
+#define TMFF2_TICK_BUCKETS	17
+
+/* longest run of packets a backend encodes for one upload or update, a
+ * periodic update that changes all four values and the whole envelope needs
+ * one packet for each of them plus one for the duration */
+#define TMFF2_MAX_PACKETS	9
+#define TMFF2_PACKET_SIZE	64
+
+#define GAIN_MAX 65535
+
 #define FF_EFFECT_QUEUE_UPLOAD	0
 #define FF_EFFECT_QUEUE_START	1
 #define FF_EFFECT_QUEUE_STOP	2
 #define FF_EFFECT_QUEUE_UPDATE	3
 #define FF_EFFECT_PLAYING	4
+/* the queued upload is held back until the effect is first played */
+#define FF_EFFECT_DEFERRED	5
+/* the last upload went out in the play queue, ahead of a start */
+#define FF_EFFECT_FUSED		6
+/* the effect has a hardware slot, state->slot */
+#define FF_EFFECT_RESIDENT	7
+/* userspace erased the effect, its slot is freed once it's stopped */
+#define FF_EFFECT_ERASED	8
+
+#define FF_EFFECT_QUEUE_MASK	(BIT(FF_EFFECT_QUEUE_UPLOAD) | BIT(FF_EFFECT_QUEUE_START) |\
+		BIT(FF_EFFECT_QUEUE_STOP) | BIT(FF_EFFECT_QUEUE_UPDATE))
+
+/* command queue priorities, lower goes out first unless older packets for
+ * the same slot are still waiting */
+#define TMFF2_PRIO_STOP		0
+#define TMFF2_PRIO_PLAY		1
+#define TMFF2_PRIO_MODIFY	2
+#define TMFF2_PRIO_UPLOAD	3
+#define TMFF2_PRIO_SETTINGS	4
+#define TMFF2_PRIO_COUNT	5
+
+/* how many packets can be waiting to be sent, across all priorities */
+#define TMFF2_QUEUE_LENGTH	64
+
+/* failed sends are counted per errno up to this, anything above goes into
+ * the last bucket */
+#define TMFF2_STATS_ERRNOS	128
+
+/* log2 latency histograms, bucket n counts latencies in [2^n, 2^(n+1)) us
+ * and bucket 0 everything below 2us */
+#define TMFF2_HIST_BUCKETS	24
+
+/* where the time between a request from userspace and the wheel getting it
+ * goes. Queue is from the request until the drain work picks the packet up,
+ * send from there until the wheel has it, total is both. The wheel has it
+ * when send_packet returns, or for async_send backends when they say so */
+#define TMFF2_LAT_QUEUE		0
+#define TMFF2_LAT_ENCODE	1
+#define TMFF2_LAT_SEND		2
+#define TMFF2_LAT_TOTAL		3
+#define TMFF2_LAT_COUNT		4
 
 #define PARAM_SPRING_LEVEL	(1 << 0)
 #define PARAM_DAMPER_LEVEL	(1 << 1)
@@ -37,22 +101,196 @@ extern int alt_mode;
 #define PARAM_ALT_MODE		(1 << 4)
 #define PARAM_GAIN		(1 << 5)
 
-#undef fixp_sin16
-#define fixp_sin16(v) (((v % 360) > 180) ?\
-		-(fixp_sin32((v % 360) - 180) >> 16)\
-		: fixp_sin32(v) >> 16)
+/* sine of each whole degree, 0x7fff at 90, filled in at module load */
+extern s16 tmff2_sin_table[360];
+
+/* n / 0x7fff for any n up to 0xffff * 0xffff, as a multiply and a shift so
+ * 32-bit builds don't need a 64-bit division */
+static inline u32 tmff2_div_7fff(u32 n)
+{
+	return ((u64)n + 1) * 0x80010002ULL >> 46;
+}
+
+/* n / 100 for any n */
+static inline u32 tmff2_div_100(u32 n)
+{
+	return (u64)n * 0x51eb851fULL >> 37;
+}
+
+static inline s16 tmff2_sat_s16(s32 value)
+{
+	return clamp_t(s32, value, S16_MIN, S16_MAX);
+}
+
+static inline u16 tmff2_sat_u16(s32 value)
+{
+	return clamp_t(s32, value, 0, U16_MAX);
+}
+
+/* a * b / 0x7fff rounded towards zero, for a and b that fit in 16 bits,
+ * signed or not */
+static inline s32 tmff2_scale(s32 a, s32 b)
+{
+	u32 q = tmff2_div_7fff((u32)abs(a) * (u32)abs(b));
+
+	return (a ^ b) < 0 ? -(s32)q : q;
+}
 
-#define JIFFIES2MS(jiffies) ((jiffies) * 1000 / HZ)
+/* value scaled by a spring/damper/friction level */
+static inline s16 tmff2_percent(s16 value, int percent)
+{
+	u32 q = tmff2_div_100((u32)abs(value) * clamp_t(int, percent, 0, 100));
+
+	return value < 0 ? -(s32)q : q;
+}
+
+/* device packets, encoded ahead of time so the work handler only has to
+ * hand them over to the wheel */
+struct tmff2_packets {
+	unsigned int count;
+	u8 buf[TMFF2_MAX_PACKETS][TMFF2_PACKET_SIZE];
+};
+
+/* reserve and clear the next packet, NULL if there is no room left */
+static inline u8 *tmff2_packet_next(struct tmff2_packets *packets)
+{
+	u8 *buf;
+
+	if (packets->count >= TMFF2_MAX_PACKETS)
+		return NULL;
+
+	buf = packets->buf[packets->count++];
+	memset(buf, 0, TMFF2_PACKET_SIZE);
+	return buf;
+}
+
+struct tmff2_hist {
+	unsigned long buckets[TMFF2_HIST_BUCKETS];
+};
+
+struct tmff2_command {
+	struct list_head list;
+	int prio;
+	/* list the packet waits in, lower in priority than prio when it has
+	 * to wait behind older packets for the same slot */
+	int queue;
+	/* slot the packet belongs to, -1 for settings */
+	int effect_id;
+	/* bytes the backend asked for, the rest of buf is zero */
+	size_t len;
+	ktime_t queued;
+	/* oldest request from userspace the packet carries, 0 if none */
+	ktime_t requested;
+	u8 buf[TMFF2_PACKET_SIZE];
+};
+
+/* a packet handed to send_packet, for the send and total latencies and the
+ * packet_complete trace event */
+struct tmff2_inflight {
+	int prio;
+	int effect_id;
+	/* index of the per type statistics, -1 for settings */
+	int type;
+	u8 opcode;
+	/* when send_packet was called, and the oldest request from userspace
+	 * the packet carries, 0 if none */
+	ktime_t start;
+	ktime_t requested;
+};
+
+/* per cpu counters behind the debugfs stats file, each cpu only touches its
+ * own copy so they're cheap enough to always be on */
+struct tmff2_stats {
+	unsigned long packets;
+	unsigned long bytes;
+	unsigned long failed[TMFF2_STATS_ERRNOS];
+	unsigned long coalesced;
+	/* uploads held back until first play, and held back uploads that
+	 * were replaced before they had to be sent */
+	unsigned long deferred;
+	unsigned long avoided;
+	/* effects pushed out of their hardware slot, and plays of effects
+	 * that had to be given a slot and uploaded first */
+	unsigned long evictions;
+	unsigned long misses;
+	/* runs of the mixer with mixed effects playing, and how many of them
+	 * didn't have to send anything as the summed level stayed put */
+	unsigned long mixes;
+	unsigned long mixes_unchanged;
+	unsigned long ticks;
+	unsigned long ticks_empty;
+	unsigned int active_max;
+	/* effect packets by opcode, settings packets don't have one */
+	unsigned long opcodes[256];
+	unsigned long settings;
+	unsigned long types[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+};
+
+struct tmff2_slot {
+	/* effect in the slot, -1 if it's free */
+	int owner;
+	/* packets for the slot still in the command queue, and the lowest
+	 * priority list they wait in, under queue_lock */
+	unsigned int queued;
+	int queue;
+};
+
+/* the effect attributes as last encoded for the wheel, in wheel units. Values
+ * are what the modify commands carry, so an update only has to send the ones
+ * that differ. values[] is in attribute order: magnitude, offset, phase and
+ * period for periodic effects, difference and level for ramps, right and left
+ * coefficient and right and left deadband for conditions */
+struct tmff2_shadow {
+	u16 values[4];
+	/* attack length, attack level, fade length, fade level */
+	u16 envelope[4];
+	u16 level;
+	u16 duration;
+};
 
 struct tmff2_effect_state {
+	/* latest version from userspace, effect.id is the hardware slot */
 	struct ff_effect effect;
-	struct ff_effect old;
+	int slot;
+
+	/* what the wheel has or is being sent, and what the encoded packets
+	 * bring it to. Backends encode into next, which starts out as a copy of
+	 * shadow for updates and zeroed for uploads */
+	struct tmff2_shadow shadow;
+	struct tmff2_shadow next;
+
+	/* packets bringing the wheel from shadow to next */
+	struct tmff2_packets packets;
 
 	unsigned long flags;
 	unsigned long count;
-	unsigned long start_time;
+	ktime_t start_time;
+
+	/* oldest upload/update and play/stop request not yet queued for the
+	 * wheel, 0 if there is none */
+	ktime_t requested;
+	ktime_t play_requested;
+
+	/* effect.direction projected onto the wheel axis, see
+	 * tmff2_projection() */
+	u16 direction;
+	s16 projection;
 };
 
+/* how much of an effect's force acts along the wheel, 0x7fff for direction
+ * 0x4000. Games rarely turn an effect, so it is only looked up again when
+ * the direction changes. A zeroed state is valid, as sin(0) is 0. Called
+ * with tmff2->lock held. */
+static inline s16 tmff2_projection(struct tmff2_effect_state *state)
+{
+	if (state->direction != state->effect.direction) {
+		state->direction = state->effect.direction;
+		state->projection = tmff2_sin_table[state->direction * 360 >> 16];
+	}
+
+	return state->projection;
+}
+
 struct tmff2_device_entry {
 	struct hid_device *hdev;
 	struct input_dev *input_dev;
@@ -60,23 +298,155 @@ struct tmff2_device_entry {
 	/* pointer to array */
 	struct tmff2_effect_state *states;
 
+	/* effect slots with queued work, playing effects with a finite length
+	 * and playing effects the host mixes, so the work handler only has to
+	 * visit those. playing has every effect the wheel or the mixer plays,
+	 * it's only counted for the stats */
+	unsigned long *pending;
+	unsigned long *timed;
+	unsigned long *mixed;
+	unsigned long *playing;
+
+	/* the work handler runs either on an ordered high priority workqueue
+	 * or, if worker_priority is set, on a dedicated SCHED_FIFO kthread */
+	struct workqueue_struct *wq;
+	struct kthread_worker *kworker;
 	struct delayed_work work;
+	struct kthread_delayed_work kwork;
 
+	/* protects states and the bitmaps above. Never held while talking to
+	 * the wheel, the work handler works on a copy of each slot */
 	spinlock_t lock;
 
+	/* lock statistics, updated with the lock held */
+	unsigned long lock_acquired;
+	unsigned long lock_contended;
+	u64 lock_wait_total_ns;
+	u64 lock_wait_max_ns;
+
 	int allow_scheduling;
 
+	/* everything sent to the wheel goes through this queue, whoever
+	 * queues it, and only the drain work on the device worker submits
+	 * from it */
+	spinlock_t queue_lock;
+	struct tmff2_command *commands;
+	struct list_head free_commands;
+	struct list_head queue[TMFF2_PRIO_COUNT];
+	unsigned int queue_free;
+	int queue_stopped;
+	struct work_struct drain;
+	struct kthread_work kdrain;
+
+	/* queue statistics, protected by queue_lock */
+	unsigned int queue_depth[TMFF2_PRIO_COUNT];
+	unsigned int queue_depth_max;
+	unsigned long queued[TMFF2_PRIO_COUNT];
+	unsigned long queue_full;
+	unsigned long sent;
+	unsigned long send_failed;
+
+	/* when the work handler is armed for, KTIME_MAX if it isn't, and
+	 * when it was last armed for. Set wherever work is posted, so both
+	 * are under lock */
+	ktime_t armed;
+	ktime_t tick_due;
+
+	/* scheduler bookkeeping, only touched from the work handler */
+	ktime_t last_tick;
+	ktime_t next_deadline;
+	unsigned long wakeups;
+	unsigned long wakeups_window;
+	unsigned long wakeups_per_sec;
+	ktime_t wakeups_window_start;
+
+	/* updates from userspace, and how many of them were absorbed by a
+	 * newer update before they could be sent */
+	unsigned long updates;
+	unsigned long updates_coalesced;
+
+	/* how late the work handler ran compared to tick_due, in ns. Only
+	 * written from the work handler */
+	u32 jitter[TMFF2_JITTER_SAMPLES];
+	unsigned int jitter_next;
+	unsigned int jitter_count;
+
+	/* time spent encoding uploads and updates, and sending them from
+	 * the work handler, per effect type */
+	u64 upload_ns[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+	u64 update_ns[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+	u64 transmit_ns[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+	unsigned long transmit_count[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+
+	/* how many packets uploads and updates encode to, per effect type */
+	unsigned long uploads[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+	unsigned long upload_packets[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+	unsigned long updates_encoded[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+	unsigned long update_packets[FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+
+	/* time spent in the work handler, only touched from there */
+	u64 tick_ns[TMFF2_TICK_BUCKETS];
+	unsigned long tick_count[TMFF2_TICK_BUCKETS];
+
+	struct dentry *debugfs_dir;
+
+	/* latencies per phase and effect type, each phase only has one
+	 * writer */
+	struct tmff2_hist latency[TMFF2_LAT_COUNT][FF_EFFECT_MAX - FF_EFFECT_MIN + 1];
+
+	struct tmff2_stats __percpu *stats;
+	/* when the stats were last reset */
+	ktime_t stats_since;
+
+	/* per wheel settings, start out as the module parameters */
+	int spring_level;
+	int damper_level;
+	int friction_level;
+	int range;
+	int gain;
+	int lazy_upload;
+	int host_mixing;
+	/* with host_mixing the wheel runs at full gain, and the gain games and
+	 * the gain setting ask for is applied here instead */
+	int host_gain;
+
+	/* set if the wheel sits behind usbhid. Otherwise (uhid, for one)
+	 * there is no usb device to talk to, and backends have to make do
+	 * with what the hid core offers */
+	int is_usb;
+
 	/* fields relevant to each actual device (T300, T150...) */
 	void *data;
 	unsigned long params;
+	/* backends set this to how many effects the wheel holds, the core
+	 * then raises it to virtual_effects and maps the effects userspace
+	 * sees onto the hw_effects hardware slots as they're needed */
 	unsigned long max_effects;
+	unsigned int hw_effects;
+	struct tmff2_slot *slots;
 	signed short supported_effects[FF_CNT];
 
+	/* with host_mixing, the constant force in the hardware slot right
+	 * after the hw_effects shared ones. Its level is the sum of all mixed
+	 * effects, under lock */
+	struct tmff2_effect_state mix;
+
 	/* obligatory callbacks */
 	int (*play_effect)(void *data, struct tmff2_effect_state *state);
-	int (*upload_effect)(void *data, struct tmff2_effect_state *state);
-	int (*update_effect)(void *data, struct tmff2_effect_state *state);
 	int (*stop_effect)(void *data, struct tmff2_effect_state *state);
+	/* upload_effect and update_effect only encode into packets, they are
+	 * called from the input core with tmff2->lock held and may not sleep.
+	 * send_packet sends one queued packet to the wheel, it's only called
+	 * from the drain work and may sleep. Backends that set async_send only
+	 * submit the packet and pass inflight to tmff2_packet_done() once the
+	 * wheel has it */
+	int (*upload_effect)(void *data, struct tmff2_effect_state *state,
+			struct tmff2_packets *packets);
+	int (*update_effect)(void *data, struct tmff2_effect_state *state,
+			struct tmff2_packets *packets);
+	int (*send_packet)(void *data, const u8 *buf,
+			const struct tmff2_inflight *inflight);
+	int async_send;
 
 	int (*wheel_init)(struct tmff2_device_entry *tmff2);
 	int (*wheel_destroy)(void *data);
@@ -93,13 +463,36 @@ struct tmff2_device_entry {
 	ssize_t (*alt_mode_store)(void *data, const char *buf, size_t count);
 	int (*set_autocenter)(void *data, uint16_t autocenter);
 	__u8 *(*wheel_fixup)(struct hid_device *hdev, __u8 *rdesc, unsigned int *rsize);
+	/* lets the backend add its own files to the device's debugfs dir */
+	void (*debugfs_init)(void *data, struct dentry *dir);
 
 	/* void pointers are dangerous, I know, but in this case likely the best option... */
 };
 
+/* spring/damper/friction level of a condition. Conditions stay on the wheel
+ * even with host_mixing, so they get the gain through their level, from
+ * their next upload or update on */
+static inline int tmff2_condition_level(struct tmff2_device_entry *tmff2,
+		int level)
+{
+	if (!tmff2->host_mixing)
+		return level;
+
+	return level * READ_ONCE(tmff2->host_gain) / GAIN_MAX;
+}
+
+int tmff2_queue_packet(struct tmff2_device_entry *tmff2, int prio,
+		int effect_id, const u8 *buf, size_t len);
+void tmff2_packet_done(struct tmff2_device_entry *tmff2,
+		const struct tmff2_inflight *inflight, int ret);
+void tmff2_hist_add(struct tmff2_hist *hist, u64 ns);
+void tmff2_hist_show(struct seq_file *m, const char *name,
+		const struct tmff2_hist *hist);
+
 /* external */
 int t300rs_populate_api(struct tmff2_device_entry *tmff2);
 int t248_populate_api(struct tmff2_device_entry *tmff2);
+int t500rs_populate_api(struct tmff2_device_entry *tmff2);
 
 #define TMT300RS_PS3_NORM_ID	0xb66e
 #define TMT300RS_PS3_ADV_ID	0xb66f
@@ -107,11 +500,14 @@ int t248_populate_api(struct tmff2_device_entry *tmff2);
 
 #define TMT248_PC_ID		0xb696
 
+#define TMT500RS_PC_ID		0xb65e
+
 /* apis to different wheel families */
 /* T248 at least uses the T300RS api, not sure if there are other wheels but that's
  * why these functions are given global linkage */
 
 struct t300rs_device_entry {
+	struct tmff2_device_entry *tmff2;
 	struct hid_device *hdev;
 	struct input_dev *input_dev;
 	struct hid_report *report;
@@ -124,13 +520,21 @@ struct t300rs_device_entry {
 	int mode;
 	int attachment;
 	u8 buffer_length;
-	u8 *send_buffer;
+	/* report id followed by the report itself, only used by the drain
+	 * work when sending queued packets */
+	u8 *out_buffer;
+	/* cleared if the device turns out to not have an interrupt out
+	 * endpoint, we then go through ff_field and SET_REPORT instead */
+	int raw_output;
+	/* combined_modify as it was when the wheel was set up */
+	int combined_modify;
 };
 
 int t300rs_play_effect(void *, struct tmff2_effect_state *);
-int t300rs_upload_effect(void *, struct tmff2_effect_state *);
-int t300rs_update_effect(void *, struct tmff2_effect_state *);
+int t300rs_upload_effect(void *, struct tmff2_effect_state *, struct tmff2_packets *);
+int t300rs_update_effect(void *, struct tmff2_effect_state *, struct tmff2_packets *);
 int t300rs_stop_effect(void *, struct tmff2_effect_state *);
+int t300rs_send_packet(void *, const u8 *, const struct tmff2_inflight *);
 
 int t300rs_open(void *);
 int t300rs_close(void *);
@@ -138,7 +542,6 @@ int t300rs_set_gain(void *, uint16_t);
 int t300rs_set_range(void *, uint16_t);
 int t300rs_set_autocenter(void *, uint16_t);
 
-int t300rs_send_buf(struct t300rs_device_entry *t300rs, u8 *send_buffer, size_t len);
-int t300rs_send_int(struct t300rs_device_entry *t300rs);
+int t300rs_send_buf(struct t300rs_device_entry *t300rs, const u8 *send_buffer, size_t len);
 
 #endif /* __HID_TMFF2_H */
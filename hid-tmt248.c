@@ -175,13 +175,15 @@ int t248_wheel_init(struct tmff2_device_entry *tmff2)
 		goto t248_err;
 	}
 
+	t248->tmff2 = tmff2;
 	t248->hdev = tmff2->hdev;
 	t248->input_dev = tmff2->input_dev;
-	t248->usbdev = to_usb_device(tmff2->hdev->dev.parent->parent);
+	if (tmff2->is_usb)
+		t248->usbdev = to_usb_device(tmff2->hdev->dev.parent->parent);
 	t248->buffer_length = T248_BUFFER_LENGTH;
 
-	t248->send_buffer = kzalloc(t248->buffer_length, GFP_KERNEL);
-	if (!t248->send_buffer) {
+	t248->out_buffer = kzalloc(t248->buffer_length + 1, GFP_KERNEL);
+	if (!t248->out_buffer) {
 		ret = -ENOMEM;
 		goto send_err;
 	}
@@ -190,10 +192,16 @@ int t248_wheel_init(struct tmff2_device_entry *tmff2)
 	t248->report = list_entry(report_list->next, struct hid_report, list);
 	t248->ff_field = t248->report->field[0];
 
+	t248->out_buffer[0] = t248->report->id;
+	t248->raw_output = 1;
+	t248->combined_modify = combined_modify;
+
 	t248->open = t248->input_dev->open;
 	t248->close = t248->input_dev->close;
 
-	if ((ret = t248_interrupts(t248)))
+	/* the setup data goes straight to the usb endpoint, anything else
+	 * doesn't need it */
+	if (t248->usbdev && (ret = t248_interrupts(t248)))
 		goto interrupt_err;
 
 	/* everything went OK */
@@ -206,6 +214,7 @@ int t248_wheel_init(struct tmff2_device_entry *tmff2)
 	return 0;
 
 interrupt_err:
+	kfree(t248->out_buffer);
 send_err:
 	kfree(t248);
 t248_err:
@@ -220,7 +229,7 @@ int t248_wheel_destroy(void *data)
 	if (!t300rs)
 		return -ENODEV;
 
-	kfree(t300rs->send_buffer);
+	kfree(t300rs->out_buffer);
 	kfree(t300rs);
 	return 0;
 }
@@ -245,17 +254,18 @@ int t248_set_range(void *data, uint16_t value)
 static int t248_open(void *data)
 {
 	struct t300rs_device_entry *t248 = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 
 	if (!t248)
 		return -ENODEV;
 
-	t248->send_buffer[0] = 0x01;
-	t248->send_buffer[1] = 0x04;
-	t300rs_send_int(t248);
+	send_buffer[0] = 0x01;
+	send_buffer[1] = 0x04;
+	t300rs_send_buf(t248, send_buffer, t248->buffer_length);
 
-	t248->send_buffer[0] = 0x01;
-	t248->send_buffer[1] = 0x05;
-	t300rs_send_int(t248);
+	send_buffer[0] = 0x01;
+	send_buffer[1] = 0x05;
+	t300rs_send_buf(t248, send_buffer, t248->buffer_length);
 
 	return t248->open(t248->input_dev);
 }
@@ -263,17 +273,18 @@ static int t248_open(void *data)
 static int t248_close(void *data)
 {
 	struct t300rs_device_entry *t248 = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 
 	if (!t248)
 		return -ENODEV;
 
-	t248->send_buffer[0] = 0x01;
-	t248->send_buffer[1] = 0x05;
-	t300rs_send_int(t248);
+	send_buffer[0] = 0x01;
+	send_buffer[1] = 0x05;
+	t300rs_send_buf(t248, send_buffer, t248->buffer_length);
 
-	t248->send_buffer[0] = 0x01;
-	t248->send_buffer[1] = 0x00;
-	t300rs_send_int(t248);
+	send_buffer[0] = 0x01;
+	send_buffer[1] = 0x00;
+	t300rs_send_buf(t248, send_buffer, t248->buffer_length);
 
 	t248->close(t248->input_dev);
 	return 0;
@@ -293,6 +304,7 @@ int t248_populate_api(struct tmff2_device_entry *tmff2)
 	tmff2->upload_effect = t300rs_upload_effect;
 	tmff2->update_effect = t300rs_update_effect;
 	tmff2->stop_effect = t300rs_stop_effect;
+	tmff2->send_packet = t300rs_send_packet;
 
 	tmff2->set_gain = t300rs_set_gain;
 	tmff2->set_autocenter = t300rs_set_autocenter;
@@ -344,30 +344,44 @@ static u8 damper_values[] = {
 	0x7f, 0x07
 };
 
-int t300rs_send_buf(struct t300rs_device_entry *t300rs, u8 *send_buffer, size_t len)
+/* queue a report for the wheel, it's sent from the device worker */
+int t300rs_send_buf(struct t300rs_device_entry *t300rs, const u8 *send_buffer, size_t len)
 {
-	int i;
 	/* check that send_buffer fits into our report */
 	if (len > t300rs->buffer_length)
 		return -EINVAL;
 
-	/* fill with actual data */
-	for (i = 0; i < len; ++i)
-		t300rs->ff_field->value[i] = send_buffer[i];
-
-	/* fill the rest with zeroes */
-	for (i = len; i < t300rs->buffer_length; ++i)
-		t300rs->ff_field->value[i] = 0;
-
-	hid_hw_request(t300rs->hdev, t300rs->report, HID_REQ_SET_REPORT);
-	return 0;
+	return tmff2_queue_packet(t300rs->tmff2, TMFF2_PRIO_SETTINGS, -1,
+			send_buffer, len);
 }
 
-int t300rs_send_int(struct t300rs_device_entry *t300rs)
+/* sends a queued report to the wheel, may sleep. The packets are already in
+ * wire format, so if we can they go out as they are through the interrupt out
+ * endpoint, instead of being unpacked into ff_field only for the hid core to
+ * pack them again */
+int t300rs_send_packet(void *data, const u8 *buf,
+		const struct tmff2_inflight *inflight)
 {
-	t300rs_send_buf(t300rs, t300rs->send_buffer, t300rs->buffer_length);
-	memset(t300rs->send_buffer, 0, t300rs->buffer_length);
+	struct t300rs_device_entry *t300rs = data;
+	u8 *report = t300rs->out_buffer + 1;
+	int i, ret;
+
+	memcpy(report, buf, t300rs->buffer_length);
 
+	if (t300rs->raw_output) {
+		ret = hid_hw_output_report(t300rs->hdev, t300rs->out_buffer,
+				t300rs->buffer_length + 1);
+		if (ret != -ENOSYS)
+			return ret < 0 ? ret : 0;
+
+		hid_info(t300rs->hdev, "no interrupt out endpoint, using SET_REPORT\n");
+		t300rs->raw_output = 0;
+	}
+
+	for (i = 0; i < t300rs->buffer_length; ++i)
+		t300rs->ff_field->value[i] = report[i];
+
+	hid_hw_request(t300rs->hdev, t300rs->report, HID_REQ_SET_REPORT);
 	return 0;
 }
 
@@ -381,10 +395,11 @@ static void t300rs_fill_header(struct t300rs_packet_header *packet_header,
 int t300rs_play_effect(void *data, struct tmff2_effect_state *state)
 {
 	struct t300rs_device_entry *t300rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	struct __packed t300rs_packet_play {
 		struct t300rs_packet_header header;
 		uint8_t value;
-	} *play_packet = (struct t300rs_packet_play *)t300rs->send_buffer;
+	} *play_packet = (struct t300rs_packet_play *)send_buffer;
 
 	int ret;
 
@@ -392,7 +407,8 @@ int t300rs_play_effect(void *data, struct tmff2_effect_state *state)
 	t300rs_fill_header(&play_packet->header, state->effect.id, 0x89);
 	play_packet->value = 0x01;
 
-	ret = t300rs_send_int(t300rs);
+	ret = tmff2_queue_packet(t300rs->tmff2, TMFF2_PRIO_PLAY,
+			state->effect.id, send_buffer, t300rs->buffer_length);
 	if (ret)
 		hid_err(t300rs->hdev, "failed starting effect play\n");
 
@@ -402,35 +418,43 @@ int t300rs_play_effect(void *data, struct tmff2_effect_state *state)
 int t300rs_stop_effect(void *data, struct tmff2_effect_state *state)
 {
 	struct t300rs_device_entry *t300rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	struct __packed t300rs_packet_stop {
 		struct t300rs_packet_header header;
 		uint8_t value;
-	} *stop_packet = (struct t300rs_packet_stop *)t300rs->send_buffer;
+	} *stop_packet = (struct t300rs_packet_stop *)send_buffer;
 
 	int ret;
 
 
 	t300rs_fill_header(&stop_packet->header, state->effect.id, 0x89);
 
-	ret = t300rs_send_int(t300rs);
+	ret = tmff2_queue_packet(t300rs->tmff2, TMFF2_PRIO_STOP,
+			state->effect.id, send_buffer, t300rs->buffer_length);
 	if (ret)
 		hid_err(t300rs->hdev, "failed stopping effect play\n");
 
 	return ret;
 }
 
+/* the envelope as the wheel gets it, attack length, attack level, fade length
+ * and fade level */
+static void t300rs_envelope_values(uint16_t values[4], int16_t level,
+		uint16_t duration, struct ff_envelope *envelope)
+{
+	values[0] = tmff2_sat_u16(tmff2_scale(duration, envelope->attack_length));
+	values[1] = tmff2_sat_s16(tmff2_scale(level, envelope->attack_level));
+	values[2] = tmff2_sat_u16(tmff2_scale(duration, envelope->fade_length));
+	values[3] = tmff2_sat_s16(tmff2_scale(level, envelope->fade_level));
+}
+
 static void t300rs_fill_envelope(struct t300rs_packet_envelope *packet_envelope,
-		int16_t level, uint16_t duration, struct ff_envelope *envelope)
+		const uint16_t values[4])
 {
-	uint16_t attack_length = (duration * envelope->attack_length) / 0x7fff;
-	uint16_t attack_level = (level * envelope->attack_level) / 0x7fff;
-	uint16_t fade_length = (duration * envelope->fade_length) / 0x7fff;
-	uint16_t fade_level = (level * envelope->fade_level) / 0x7fff;
-
-	packet_envelope->attack_length = cpu_to_le16(attack_length);
-	packet_envelope->attack_level = cpu_to_le16(attack_level);
-	packet_envelope->fade_length = cpu_to_le16(fade_length);
-	packet_envelope->fade_level = cpu_to_le16(fade_level);
+	packet_envelope->attack_length = cpu_to_le16(values[0]);
+	packet_envelope->attack_level = cpu_to_le16(values[1]);
+	packet_envelope->fade_length = cpu_to_le16(values[2]);
+	packet_envelope->fade_level = cpu_to_le16(values[3]);
 }
 
 static void t300rs_fill_timing(struct t300rs_packet_timing *packet_timing,
@@ -443,160 +467,206 @@ static void t300rs_fill_timing(struct t300rs_packet_timing *packet_timing,
 	packet_timing->end_marker = 0xffff;
 }
 
-static int t300rs_update_envelope(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state,
-		int16_t level,
-		uint16_t duration,
-		uint8_t id,
-		struct ff_envelope envelope,
-		struct ff_envelope envelope_old
-		)
+/* the modify commands take a bitmask of the attributes being changed,
+ * followed by the new value of each attribute in the mask, lowest bit first.
+ * Only the combinations seen in captures are sent as such, ramp difference
+ * and level (0x03) and both deadbands (0x4c), in merge. Every other changed
+ * attribute gets a report of its own, unless combined is set, then all of
+ * them go out in one report */
+struct t300rs_modify {
+	uint8_t code;
+	uint8_t base;
+	uint8_t merge;
+	uint8_t mask;
+	int combined;
+	uint16_t values[4];
+};
+
+#define T300RS_MOD_MAGNITUDE		0
+#define T300RS_MOD_OFFSET		1
+#define T300RS_MOD_PHASE		2
+#define T300RS_MOD_PERIOD		3
+
+#define T300RS_MOD_DIFFERENCE		0
+#define T300RS_MOD_LEVEL		1
+
+#define T300RS_MOD_RIGHT_COEFF		0
+#define T300RS_MOD_LEFT_COEFF		1
+#define T300RS_MOD_RIGHT_DEADBAND	2
+#define T300RS_MOD_LEFT_DEADBAND	3
+
+static void t300rs_modify_init(struct t300rs_device_entry *t300rs,
+		struct t300rs_modify *mod, uint8_t code, uint8_t base, uint8_t merge)
+{
+	mod->code = code;
+	mod->base = base;
+	mod->merge = merge;
+	mod->mask = 0;
+	mod->combined = t300rs->combined_modify;
+}
+
+/* add an attribute to the command, it's only sent if the wheel doesn't
+ * already have that value or it's merged with one that changed. shadow is
+ * the slot's copy of the attributes the command modifies */
+static void t300rs_modify_set(struct t300rs_modify *mod, uint16_t *shadow,
+		int attribute, uint16_t value)
+{
+	mod->values[attribute] = value;
+	if (shadow[attribute] == value)
+		return;
+
+	shadow[attribute] = value;
+	mod->mask |= 1 << attribute;
+}
+
+static int t300rs_encode_attributes(struct tmff2_packets *packets,
+		uint8_t id, struct t300rs_modify *mod, uint8_t mask)
 {
-	struct __packed t300rs_packet_mod_envelope {
+	struct __packed t300rs_packet_modify {
 		struct t300rs_packet_header header;
 		uint8_t attribute;
-		uint16_t value;
-	} *packet_mod_envelope = (struct t300rs_packet_mod_envelope *)t300rs->send_buffer;
+		uint16_t values[ARRAY_SIZE(mod->values)];
+	} *packet_modify;
+	int i, count = 0;
 
-	uint16_t attack_length, attack_level, fade_length, fade_level;
-	int ret = 0;
+	packet_modify = (struct t300rs_packet_modify *)tmff2_packet_next(packets);
+	if (!packet_modify)
+		return -ENOSPC;
 
-	duration = duration - 1;
+	t300rs_fill_header(&packet_modify->header, id, mod->code);
+	packet_modify->attribute = mod->base | mask;
 
-	attack_length = (duration * envelope.attack_length) / 0x7fff;
-	attack_level = (level * envelope.attack_level) / 0x7fff;
-	fade_length = (duration * envelope.fade_length) / 0x7fff;
-	fade_level = (level * envelope.fade_level) / 0x7fff;
+	for (i = 0; i < ARRAY_SIZE(mod->values); ++i) {
+		if (mask & (1 << i))
+			packet_modify->values[count++] = cpu_to_le16(mod->values[i]);
+	}
+
+	return 0;
+}
 
-	if (envelope.attack_length != envelope_old.attack_length) {
-		t300rs_fill_header(&packet_mod_envelope->header, id, 0x31);
-		packet_mod_envelope->attribute = 0x81;
-		packet_mod_envelope->value = cpu_to_le16(attack_length);
+static int t300rs_encode_modify(struct tmff2_packets *packets,
+		uint8_t id, struct t300rs_modify *mod)
+{
+	uint8_t mask = mod->mask;
+	int i, ret;
 
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
+	if (mod->combined) {
+		if (mask & mod->merge)
+			mask |= mod->merge;
+		return mask ? t300rs_encode_attributes(packets, id, mod, mask) : 0;
 	}
 
-	if (envelope.attack_level != envelope_old.attack_level) {
-		t300rs_fill_header(&packet_mod_envelope->header, id, 0x31);
-		packet_mod_envelope->attribute = 0x82;
-		packet_mod_envelope->value = cpu_to_le16(attack_level);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
+	if (mod->mask & mod->merge) {
+		if ((ret = t300rs_encode_attributes(packets, id, mod, mod->merge)))
+			return ret;
 	}
 
-	if (envelope.fade_length != envelope_old.fade_length) {
-		t300rs_fill_header(&packet_mod_envelope->header, id, 0x31);
-		packet_mod_envelope->attribute = 0x84;
-		packet_mod_envelope->value = cpu_to_le16(fade_length);
+	for (i = 0; i < ARRAY_SIZE(mod->values); ++i) {
+		if (!(mod->mask & ~mod->merge & (1 << i)))
+			continue;
 
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
+		if ((ret = t300rs_encode_attributes(packets, id, mod, 1 << i)))
+			return ret;
 	}
 
-	if (envelope.fade_level != envelope_old.fade_level) {
-		t300rs_fill_header(&packet_mod_envelope->header, id, 0x31);
-		packet_mod_envelope->attribute = 0x88;
-		packet_mod_envelope->value = cpu_to_le16(fade_level);
+	return 0;
+}
 
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
-	}
+static int t300rs_update_envelope(struct t300rs_device_entry *t300rs,
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets,
+		int16_t level,
+		struct ff_envelope *envelope)
+{
+	struct tmff2_shadow *shadow = &state->next;
+	struct t300rs_modify mod;
+	uint16_t values[4];
+	int ret, i;
+
+	t300rs_envelope_values(values, level, state->effect.replay.length - 1,
+			envelope);
+
+	t300rs_modify_init(t300rs, &mod, 0x31, 0x80, 0);
+	for (i = 0; i < ARRAY_SIZE(values); ++i)
+		t300rs_modify_set(&mod, shadow->envelope, i, values[i]);
+
+	ret = t300rs_encode_modify(packets, state->effect.id, &mod);
+	if (ret)
+		hid_err(t300rs->hdev, "failed modifying effect envelope\n");
 
-error:
 	return ret;
 }
 
 static int t300rs_update_duration(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct t300rs_packet_mod_duration {
+	struct __packed t300rs_packet_mod_duration {
 		struct t300rs_packet_header header;
 		uint16_t marker;
 		uint16_t duration;
-	} *packet_mod_duration = (struct t300rs_packet_mod_duration *)t300rs->send_buffer;
-
-	uint16_t duration;
-	int ret = 0;
+	} *packet_mod_duration;
+	uint16_t duration = state->effect.replay.length - 1;
 
-	duration = effect.replay.length - 1;
-
-	if (effect.replay.length != old.replay.length) {
+	/* the marker follows the header straight away, 49 00 41 <length> in
+	 * the captures. Unpacked, it went out as 49 00 00 41 <length> */
+	BUILD_BUG_ON(sizeof(*packet_mod_duration) != 7);
 
-		t300rs_fill_header(&packet_mod_duration->header, effect.id, 0x49);
-		packet_mod_duration->marker = cpu_to_le16(0x4100);
-		packet_mod_duration->duration = cpu_to_le16(duration);
+	if (state->next.duration == duration)
+		return 0;
 
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying duration\n");
-			goto error;
-		}
+	packet_mod_duration = (struct t300rs_packet_mod_duration *)
+		tmff2_packet_next(packets);
+	if (!packet_mod_duration) {
+		hid_err(t300rs->hdev, "failed modifying duration\n");
+		return -ENOSPC;
 	}
 
-error:
-	return ret;
+	t300rs_fill_header(&packet_mod_duration->header, state->effect.id, 0x49);
+	packet_mod_duration->marker = cpu_to_le16(0x4100);
+	packet_mod_duration->duration = cpu_to_le16(duration);
+	state->next.duration = duration;
+
+	return 0;
 }
 
 static int t300rs_update_constant(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_constant_effect constant = effect.u.constant;
-	struct ff_constant_effect constant_old = old.u.constant;
+	struct ff_effect *effect = &state->effect;
+	struct ff_constant_effect *constant = &effect->u.constant;
 	struct __packed t300rs_packet_mod_constant {
 		struct t300rs_packet_header header;
 		uint16_t level;
-	} *packet_mod_constant = (struct t300rs_packet_mod_constant *)t300rs->send_buffer;
+	} *packet_mod_constant;
 	int ret;
 	int16_t level;
 
-	level = (constant.level * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-
-	if (constant.level != constant_old.level) {
-
-		t300rs_fill_header(&packet_mod_constant->header, effect.id, 0x0a);
-		packet_mod_constant->level = cpu_to_le16(level);
+	level = tmff2_scale(constant->level, tmff2_projection(state));
 
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
+	if ((uint16_t)level != state->next.level) {
+		packet_mod_constant = (struct t300rs_packet_mod_constant *)
+			tmff2_packet_next(packets);
+		if (!packet_mod_constant) {
 			hid_err(t300rs->hdev, "failed modifying constant effect\n");
+			ret = -ENOSPC;
 			goto error;
 		}
 
+		t300rs_fill_header(&packet_mod_constant->header, effect->id, 0x0a);
+		packet_mod_constant->level = cpu_to_le16(level);
+		state->next.level = level;
 	}
 
-	ret = t300rs_update_envelope(t300rs,
-			state,
-			level,
-			effect.replay.length,
-			effect.id,
-			constant.envelope,
-			constant_old.envelope
-			);
-
+	ret = t300rs_update_envelope(t300rs, state, packets, level,
+			&constant->envelope);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying constant envelope\n");
 		goto error;
 	}
 
-	ret = t300rs_update_duration(t300rs, state);
+	ret = t300rs_update_duration(t300rs, state, packets);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying constant duration\n");
 		goto error;
@@ -607,64 +677,46 @@ error:
 }
 
 static int t300rs_update_ramp(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_ramp_effect ramp = effect.u.ramp;
-	struct ff_ramp_effect ramp_old = old.u.ramp;
-	struct __packed t300rs_packet_mod_ramp {
-		struct t300rs_packet_header header;
-		uint8_t attribute;
-		uint16_t difference;
-		uint16_t level;
-	} *packet_mod_ramp = (struct t300rs_packet_mod_ramp *)t300rs->send_buffer;
+	struct ff_effect *effect = &state->effect;
+	struct ff_ramp_effect *ramp = &effect->u.ramp;
+	struct t300rs_modify mod;
 
 	int ret;
 
 	uint16_t difference, top, bottom;
 	int16_t level;
 
-	top = ramp.end_level > ramp.start_level ? ramp.end_level : ramp.start_level;
-	bottom = ramp.end_level > ramp.start_level ? ramp.start_level : ramp.end_level;
+	top = ramp->end_level > ramp->start_level ? ramp->end_level : ramp->start_level;
+	bottom = ramp->end_level > ramp->start_level ? ramp->start_level : ramp->end_level;
 
 
-	difference = ((top - bottom) * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	difference = tmff2_scale(top - bottom, tmff2_projection(state));
 
 
-	level = (top * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	level = tmff2_scale(top, tmff2_projection(state));
 
-	if (ramp.start_level != ramp_old.start_level || ramp.end_level != ramp_old.end_level) {
-
-		t300rs_fill_header(&packet_mod_ramp->header, effect.id, 0x0e);
-		packet_mod_ramp->attribute = 0x03;
-		packet_mod_ramp->difference = cpu_to_le16(difference);
-		packet_mod_ramp->level = cpu_to_le16(level);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying ramp effect\n");
-			goto error;
-		}
+	t300rs_modify_init(t300rs, &mod, 0x0e, 0x00,
+			BIT(T300RS_MOD_DIFFERENCE) | BIT(T300RS_MOD_LEVEL));
+	t300rs_modify_set(&mod, state->next.values, T300RS_MOD_DIFFERENCE, difference);
+	t300rs_modify_set(&mod, state->next.values, T300RS_MOD_LEVEL, level);
 
+	ret = t300rs_encode_modify(packets, effect->id, &mod);
+	if (ret) {
+		hid_err(t300rs->hdev, "failed modifying ramp effect\n");
+		goto error;
 	}
 
-	ret = t300rs_update_envelope(t300rs,
-			state,
-			level,
-			effect.replay.length,
-			effect.id,
-			ramp.envelope,
-			ramp_old.envelope
-			);
-
-
+	ret = t300rs_update_envelope(t300rs, state, packets, level,
+			&ramp->envelope);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying ramp envelope\n");
 		goto error;
 	}
 
-	ret = t300rs_update_duration(t300rs, state);
+	ret = t300rs_update_duration(t300rs, state, packets);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying ramp duration\n");
 		goto error;
@@ -675,78 +727,44 @@ error:
 }
 
 static int t300rs_update_damper(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_condition_effect damper = effect.u.condition[0];
-	struct ff_condition_effect damper_old = old.u.condition[0];
-	struct __packed t300rs_packet_mod_damper {
-		struct t300rs_packet_header header;
-		uint8_t attribute;
-		uint16_t value0;
-		uint16_t value1;
-	} *packet_mod_damper = (struct t300rs_packet_mod_damper *)t300rs->send_buffer;
+	struct ff_condition_effect *damper = &state->effect.u.condition[0];
+	uint16_t *shadow = state->next.values;
+	struct t300rs_modify mod;
 
 	int ret, input_level;
+	int16_t right_coeff, left_coeff;
+	uint16_t right_deadband, left_deadband;
 
-	input_level = damper_level;
+	input_level = t300rs->tmff2->damper_level;
 	if (state->effect.type == FF_FRICTION)
-		input_level = friction_level;
+		input_level = t300rs->tmff2->friction_level;
 
 	if (state->effect.type == FF_SPRING)
-		input_level = spring_level;
-
-	if (damper.right_coeff != damper_old.right_coeff) {
-		int16_t coeff = damper.right_coeff * input_level / 100;
-
-		t300rs_fill_header(&packet_mod_damper->header, effect.id, 0x0e);
-		packet_mod_damper->attribute = 0x41;
-		packet_mod_damper->value0 = cpu_to_le16(coeff);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying damper rc\n");
-			goto error;
-		}
-
-	}
-
-	if (damper.left_coeff != damper_old.left_coeff) {
-		int16_t coeff = damper.left_coeff * input_level / 100;
-
-		t300rs_fill_header(&packet_mod_damper->header, effect.id, 0x0e);
-		packet_mod_damper->attribute = 0x42;
-		packet_mod_damper->value0 = cpu_to_le16(coeff);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying damper lc\n");
-			goto error;
-		}
-
-	}
-
-	if ((damper.deadband != damper_old.deadband)
-			|| (damper.center != damper_old.center)) {
-
-		uint16_t right_deadband = 0xfffe - damper.deadband - damper.center;
-		uint16_t left_deadband = 0xfffe - damper.deadband + damper.center;
-
-		t300rs_fill_header(&packet_mod_damper->header, effect.id, 0x0e);
-		packet_mod_damper->attribute = 0x4c;
-		packet_mod_damper->value0 = cpu_to_le16(right_deadband);
-		packet_mod_damper->value1 = cpu_to_le16(left_deadband);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying damper deadband\n");
-			goto error;
-		}
-
+		input_level = t300rs->tmff2->spring_level;
+	input_level = tmff2_condition_level(t300rs->tmff2, input_level);
+
+	right_coeff = tmff2_percent(damper->right_coeff, input_level);
+	left_coeff = tmff2_percent(damper->left_coeff, input_level);
+	right_deadband = 0xfffe - damper->deadband - damper->center;
+	left_deadband = 0xfffe - damper->deadband + damper->center;
+
+	t300rs_modify_init(t300rs, &mod, 0x0e, 0x40,
+			BIT(T300RS_MOD_RIGHT_DEADBAND) | BIT(T300RS_MOD_LEFT_DEADBAND));
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_RIGHT_COEFF, right_coeff);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_LEFT_COEFF, left_coeff);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_RIGHT_DEADBAND, right_deadband);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_LEFT_DEADBAND, left_deadband);
+
+	ret = t300rs_encode_modify(packets, state->effect.id, &mod);
+	if (ret) {
+		hid_err(t300rs->hdev, "failed modifying damper\n");
+		goto error;
 	}
 
-	ret = t300rs_update_duration(t300rs, state);
+	ret = t300rs_update_duration(t300rs, state, packets);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying damper duration\n");
 		goto error;
@@ -757,113 +775,55 @@ error:
 }
 
 static int t300rs_update_spring(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	return t300rs_update_damper(t300rs, state);
+	return t300rs_update_damper(t300rs, state, packets);
 }
 
 
 static int t300rs_update_periodic(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_periodic_effect periodic = effect.u.periodic;
-	struct ff_periodic_effect periodic_old = old.u.periodic;
-	struct __packed t300rs_packet_mod_periodic {
-		struct t300rs_packet_header header;
-		uint8_t attribute;
-		uint16_t value;
-	} *packet_mod_periodic = (struct t300rs_packet_mod_periodic *)t300rs->send_buffer;
+	struct ff_effect *effect = &state->effect;
+	struct ff_periodic_effect *periodic = &effect->u.periodic;
+	uint16_t *shadow = state->next.values;
+	struct t300rs_modify mod;
 
 	int ret;
 	int16_t magnitude;
 	uint16_t phase;
-	bool update_phase = false;
 
-	magnitude = (periodic.magnitude * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-	phase = periodic.phase;
+	magnitude = tmff2_scale(periodic->magnitude, tmff2_projection(state));
+	phase = periodic->phase;
 	if(magnitude < 0){
 		phase += 0x4000;
 		phase = phase < 0 ? -phase : phase;
-		update_phase = true;
 	}
 
 	magnitude = magnitude < 0 ? -magnitude : magnitude;
 
-	if (periodic.magnitude != periodic_old.magnitude) {
-
-		t300rs_fill_header(&packet_mod_periodic->header, effect.id, 0x0e);
-		packet_mod_periodic->attribute = 0x01;
-		packet_mod_periodic->value = cpu_to_le16(magnitude);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying periodic magnitude\n");
-			goto error;
-		}
-
-	}
-
-	if (periodic.offset != periodic_old.offset) {
-		int16_t offset = periodic.offset;
-
-		t300rs_fill_header(&packet_mod_periodic->header, effect.id, 0x0e);
-		packet_mod_periodic->attribute = 0x02;
-		packet_mod_periodic->value = cpu_to_le16(offset);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying periodic offset\n");
-			goto error;
-		}
-
-	}
-
-	if (periodic.phase != periodic_old.phase || update_phase) {
-
-		t300rs_fill_header(&packet_mod_periodic->header, effect.id, 0x0e);
-		packet_mod_periodic->attribute = 0x04;
-		packet_mod_periodic->value = cpu_to_le16(phase);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying periodic phase\n");
-			goto error;
-		}
-
-	}
-
-	if (periodic.period != periodic_old.period) {
-		int16_t period = periodic.period;
-
-		t300rs_fill_header(&packet_mod_periodic->header, effect.id, 0x0e);
-		packet_mod_periodic->attribute = 0x08;
-		packet_mod_periodic->value = cpu_to_le16(period);
-
-		ret = t300rs_send_int(t300rs);
-		if (ret) {
-			hid_err(t300rs->hdev, "failed modifying periodic period\n");
-			goto error;
-		}
+	t300rs_modify_init(t300rs, &mod, 0x0e, 0x00, 0);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_MAGNITUDE, magnitude);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_OFFSET, periodic->offset);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_PHASE, phase);
+	t300rs_modify_set(&mod, shadow, T300RS_MOD_PERIOD, periodic->period);
 
+	ret = t300rs_encode_modify(packets, effect->id, &mod);
+	if (ret) {
+		hid_err(t300rs->hdev, "failed modifying periodic effect\n");
+		goto error;
 	}
 
-	ret = t300rs_update_envelope(t300rs,
-			state,
-			magnitude,
-			effect.replay.length,
-			effect.id,
-			periodic.envelope,
-			periodic_old.envelope
-			);
-
+	ret = t300rs_update_envelope(t300rs, state, packets, magnitude,
+			&periodic->envelope);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying periodic envelope\n");
 		goto error;
 	}
 
-	ret = t300rs_update_duration(t300rs, state);
+	ret = t300rs_update_duration(t300rs, state, packets);
 	if (ret) {
 		hid_err(t300rs->hdev, "failed modifying periodic duration\n");
 		goto error;
@@ -874,7 +834,8 @@ error:
 }
 
 static int t300rs_upload_constant(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 	struct ff_effect effect = state->effect;
 	struct ff_constant_effect constant = state->effect.u.constant;
@@ -884,35 +845,38 @@ static int t300rs_upload_constant(struct t300rs_device_entry *t300rs,
 		struct t300rs_packet_envelope envelope;
 		uint8_t zero;
 		struct t300rs_packet_timing timing;
-	} *packet_constant = (struct t300rs_packet_constant *)t300rs->send_buffer;
+	} *packet_constant = (struct t300rs_packet_constant *)tmff2_packet_next(packets);
 
 	int16_t level;
 	uint16_t duration, offset;
 
-	int ret;
-
-	level = (constant.level * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	level = tmff2_scale(constant.level, tmff2_projection(state));
 	duration = effect.replay.length - 1;
 
 	offset = effect.replay.delay;
 
+	if (!packet_constant) {
+		hid_err(t300rs->hdev, "failed uploading constant effect\n");
+		return -ENOSPC;
+	}
+
 	t300rs_fill_header(&packet_constant->header, effect.id, 0x6a);
 
 	packet_constant->level = cpu_to_le16(level);
+	state->next.level = level;
 
-	t300rs_fill_envelope(&packet_constant->envelope, level, duration,
+	t300rs_envelope_values(state->next.envelope, level, duration,
 			&constant.envelope);
+	t300rs_fill_envelope(&packet_constant->envelope, state->next.envelope);
 	t300rs_fill_timing(&packet_constant->timing, duration, offset);
+	state->next.duration = duration;
 
-	ret = t300rs_send_int(t300rs);
-	if (ret)
-		hid_err(t300rs->hdev, "failed uploading constant effect\n");
-
-	return ret;
+	return 0;
 }
 
 static int t300rs_upload_ramp(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 	struct ff_effect effect = state->effect;
 	struct ff_ramp_effect ramp = state->effect.u.ramp;
@@ -926,9 +890,8 @@ static int t300rs_upload_ramp(struct t300rs_device_entry *t300rs,
 		struct t300rs_packet_envelope envelope;
 		uint8_t direction;
 		struct t300rs_packet_timing timing;
-	} *packet_ramp = (struct t300rs_packet_ramp *)t300rs->send_buffer;
+	} *packet_ramp = (struct t300rs_packet_ramp *)tmff2_packet_next(packets);
 
-	int ret;
 	uint16_t difference, offset, top, bottom, duration;
 	int16_t level;
 
@@ -938,11 +901,16 @@ static int t300rs_upload_ramp(struct t300rs_device_entry *t300rs,
 	bottom = ramp.end_level > ramp.start_level ? ramp.start_level : ramp.end_level;
 
 
-	difference = ((top - bottom) * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-	level = (top * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	difference = tmff2_scale(top - bottom, tmff2_projection(state));
+	level = tmff2_scale(top, tmff2_projection(state));
 	offset = effect.replay.delay;
 
 
+	if (!packet_ramp) {
+		hid_err(t300rs->hdev, "failed uploading ramp");
+		return -ENOSPC;
+	}
+
 	t300rs_fill_header(&packet_ramp->header, effect.id, 0x6b);
 
 	packet_ramp->difference = cpu_to_le16(difference);
@@ -951,21 +919,23 @@ static int t300rs_upload_ramp(struct t300rs_device_entry *t300rs,
 
 	packet_ramp->marker = cpu_to_le16(0x8000);
 
-	t300rs_fill_envelope(&packet_ramp->envelope, level, duration,
+	t300rs_envelope_values(state->next.envelope, level, duration,
 			&ramp.envelope);
+	t300rs_fill_envelope(&packet_ramp->envelope, state->next.envelope);
 
 	packet_ramp->direction = ramp.end_level > ramp.start_level ? 0x04 : 0x05;
 	t300rs_fill_timing(&packet_ramp->timing, duration, offset);
 
-	ret = t300rs_send_int(t300rs);
-	if (ret)
-		hid_err(t300rs->hdev, "failed uploading ramp");
+	state->next.values[T300RS_MOD_DIFFERENCE] = difference;
+	state->next.values[T300RS_MOD_LEVEL] = level;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
 static int t300rs_upload_spring(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 	struct ff_effect effect = state->effect;
 	/* we only care about the first axis */
@@ -978,21 +948,28 @@ static int t300rs_upload_spring(struct t300rs_device_entry *t300rs,
 		uint16_t left_deadband;
 		uint8_t spring_start[17];
 		struct t300rs_packet_timing timing;
-	} *packet_spring = (struct t300rs_packet_spring *)t300rs->send_buffer;
+	} *packet_spring = (struct t300rs_packet_spring *)tmff2_packet_next(packets);
 
-	int ret;
+	int input_level;
 	uint16_t duration, right_coeff, left_coeff, right_deadband, left_deadband, offset;
 
 	duration = effect.replay.length - 1;
 
-	right_coeff = spring.right_coeff * spring_level / 100;
-	left_coeff = spring.left_coeff * spring_level / 100;
+	input_level = tmff2_condition_level(t300rs->tmff2,
+			t300rs->tmff2->spring_level);
+	right_coeff = tmff2_percent(spring.right_coeff, input_level);
+	left_coeff = tmff2_percent(spring.left_coeff, input_level);
 
 	right_deadband = 0xfffe - spring.deadband - spring.center;
 	left_deadband = 0xfffe - spring.deadband + spring.center;
 
 	offset = effect.replay.delay;
 
+	if (!packet_spring) {
+		hid_err(t300rs->hdev, "failed uploading spring\n");
+		return -ENOSPC;
+	}
+
 	t300rs_fill_header(&packet_spring->header, effect.id, 0x64);
 
 	packet_spring->right_coeff = cpu_to_le16(right_coeff);
@@ -1003,15 +980,18 @@ static int t300rs_upload_spring(struct t300rs_device_entry *t300rs,
 	memcpy(&packet_spring->spring_start, spring_values, ARRAY_SIZE(spring_values));
 	t300rs_fill_timing(&packet_spring->timing, duration, offset);
 
-	ret = t300rs_send_int(t300rs);
-	if (ret)
-		hid_err(t300rs->hdev, "failed uploading spring\n");
+	state->next.values[T300RS_MOD_RIGHT_COEFF] = right_coeff;
+	state->next.values[T300RS_MOD_LEFT_COEFF] = left_coeff;
+	state->next.values[T300RS_MOD_RIGHT_DEADBAND] = right_deadband;
+	state->next.values[T300RS_MOD_LEFT_DEADBAND] = left_deadband;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
 static int t300rs_upload_damper(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 
 	struct ff_effect effect = state->effect;
@@ -1025,25 +1005,31 @@ static int t300rs_upload_damper(struct t300rs_device_entry *t300rs,
 		uint16_t left_deadband;
 		uint8_t damper_start[17];
 		struct t300rs_packet_timing timing;
-	} *packet_damper = (struct t300rs_packet_damper *)t300rs->send_buffer;
+	} *packet_damper = (struct t300rs_packet_damper *)tmff2_packet_next(packets);
 
-	int ret, input_level;
+	int input_level;
 	uint16_t duration, right_coeff, left_coeff, right_deadband, left_deadband, offset;
 
 	duration = effect.replay.length - 1;
 
-	input_level = damper_level;
+	input_level = t300rs->tmff2->damper_level;
 	if (state->effect.type == FF_FRICTION)
-		input_level = friction_level;
+		input_level = t300rs->tmff2->friction_level;
+	input_level = tmff2_condition_level(t300rs->tmff2, input_level);
 
-	right_coeff = spring.right_coeff * input_level / 100;
-	left_coeff = spring.left_coeff * input_level / 100;
+	right_coeff = tmff2_percent(spring.right_coeff, input_level);
+	left_coeff = tmff2_percent(spring.left_coeff, input_level);
 
 	right_deadband = 0xfffe - spring.deadband - spring.center;
 	left_deadband = 0xfffe - spring.deadband + spring.center;
 
 	offset = effect.replay.delay;
 
+	if (!packet_damper) {
+		hid_err(t300rs->hdev, "failed uploading spring\n");
+		return -ENOSPC;
+	}
+
 	t300rs_fill_header(&packet_damper->header, effect.id, 0x64);
 
 	packet_damper->right_coeff = cpu_to_le16(right_coeff);
@@ -1054,15 +1040,18 @@ static int t300rs_upload_damper(struct t300rs_device_entry *t300rs,
 	memcpy(&packet_damper->damper_start, damper_values, ARRAY_SIZE(damper_values));
 	t300rs_fill_timing(&packet_damper->timing, duration, offset);
 
-	ret = t300rs_send_int(t300rs);
-	if (ret)
-		hid_err(t300rs->hdev, "failed uploading spring\n");
+	state->next.values[T300RS_MOD_RIGHT_COEFF] = right_coeff;
+	state->next.values[T300RS_MOD_LEFT_COEFF] = left_coeff;
+	state->next.values[T300RS_MOD_RIGHT_DEADBAND] = right_deadband;
+	state->next.values[T300RS_MOD_LEFT_DEADBAND] = left_deadband;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
 static int t300rs_upload_periodic(struct t300rs_device_entry *t300rs,
-		struct tmff2_effect_state *state)
+		struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 	struct ff_effect effect = state->effect;
 	struct ff_periodic_effect periodic = state->effect.u.periodic;
@@ -1076,15 +1065,14 @@ static int t300rs_upload_periodic(struct t300rs_device_entry *t300rs,
 		struct t300rs_packet_envelope envelope;
 		uint8_t waveform;
 		struct t300rs_packet_timing timing;
-	} *packet_periodic = (struct t300rs_packet_periodic *)t300rs->send_buffer;
+	} *packet_periodic = (struct t300rs_packet_periodic *)tmff2_packet_next(packets);
 
-	int ret;
 	uint16_t duration, magnitude, period, offset;
 	int16_t periodic_offset, phase;
 
 	duration = effect.replay.length - 1;
 
-	magnitude = (periodic.magnitude * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	magnitude = tmff2_scale(periodic.magnitude, tmff2_projection(state));
 
 	phase = periodic.phase;
 	if(magnitude < 0){
@@ -1097,6 +1085,11 @@ static int t300rs_upload_periodic(struct t300rs_device_entry *t300rs,
 	period = periodic.period;
 	offset = effect.replay.delay;
 
+	if (!packet_periodic) {
+		hid_err(t300rs->hdev, "failed uploading periodic effect");
+		return -ENOSPC;
+	}
+
 	t300rs_fill_header(&packet_periodic->header, effect.id, 0x6b);
 
 	packet_periodic->magnitude = cpu_to_le16(magnitude);
@@ -1106,58 +1099,63 @@ static int t300rs_upload_periodic(struct t300rs_device_entry *t300rs,
 
 	packet_periodic->marker = cpu_to_le16(0x8000);
 
-	t300rs_fill_envelope(&packet_periodic->envelope, magnitude, duration,
+	t300rs_envelope_values(state->next.envelope, magnitude, duration,
 			&periodic.envelope);
+	t300rs_fill_envelope(&packet_periodic->envelope, state->next.envelope);
 
 	packet_periodic->waveform = periodic.waveform - 0x57;
 
 	t300rs_fill_timing(&packet_periodic->timing, duration, offset);
 
-	ret = t300rs_send_int(t300rs);
-	if (ret)
-		hid_err(t300rs->hdev, "failed uploading periodic effect");
+	state->next.values[T300RS_MOD_MAGNITUDE] = magnitude;
+	state->next.values[T300RS_MOD_OFFSET] = periodic_offset;
+	state->next.values[T300RS_MOD_PHASE] = phase;
+	state->next.values[T300RS_MOD_PERIOD] = period;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
-int t300rs_update_effect(void *data, struct tmff2_effect_state *state)
+int t300rs_update_effect(void *data, struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 	struct t300rs_device_entry *t300rs = data;
 	switch (state->effect.type) {
 		case FF_CONSTANT:
-			return t300rs_update_constant(t300rs, state);
+			return t300rs_update_constant(t300rs, state, packets);
 		case FF_RAMP:
-			return t300rs_update_ramp(t300rs, state);
+			return t300rs_update_ramp(t300rs, state, packets);
 		case FF_SPRING:
-			return t300rs_update_spring(t300rs, state);
+			return t300rs_update_spring(t300rs, state, packets);
 		case FF_DAMPER:
 		case FF_FRICTION:
 		case FF_INERTIA:
-			return t300rs_update_damper(t300rs, state);
+			return t300rs_update_damper(t300rs, state, packets);
 		case FF_PERIODIC:
-			return t300rs_update_periodic(t300rs, state);
+			return t300rs_update_periodic(t300rs, state, packets);
 		default:
 			hid_err(t300rs->hdev, "invalid effect type: %x", state->effect.type);
 			return -1;
 	}
 }
 
-int t300rs_upload_effect(void *data, struct tmff2_effect_state *state)
+int t300rs_upload_effect(void *data, struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
 	struct t300rs_device_entry *t300rs = data;
 	switch (state->effect.type) {
 		case FF_CONSTANT:
-			return t300rs_upload_constant(t300rs, state);
+			return t300rs_upload_constant(t300rs, state, packets);
 		case FF_RAMP:
-			return t300rs_upload_ramp(t300rs, state);
+			return t300rs_upload_ramp(t300rs, state, packets);
 		case FF_SPRING:
-			return t300rs_upload_spring(t300rs, state);
+			return t300rs_upload_spring(t300rs, state, packets);
 		case FF_DAMPER:
 		case FF_FRICTION:
 		case FF_INERTIA:
-			return t300rs_upload_damper(t300rs, state);
+			return t300rs_upload_damper(t300rs, state, packets);
 		case FF_PERIODIC:
-			return t300rs_upload_periodic(t300rs, state);
+			return t300rs_upload_periodic(t300rs, state, packets);
 		default:
 			hid_err(t300rs->hdev, "invalid effect type: %x", state->effect.type);
 			return -1;
@@ -1173,6 +1171,11 @@ static int t300rs_switch_mode(void *data, uint16_t mode)
 	if(t300rs->mode == mode) /* already in specified mode */
 		return 0;
 
+	if (!t300rs->usbdev) {
+		hid_warn(t300rs->hdev, "switching modes needs usb\n");
+		return -EOPNOTSUPP;
+	}
+
 	if (mode == 0)
 		/* go to normal mode */
 		usb_control_msg(t300rs->usbdev,
@@ -1269,6 +1272,7 @@ static ssize_t t300rs_alt_mode_store(void *data, const char *buf, size_t count)
 int t300rs_set_autocenter(void *data, uint16_t value)
 {
 	struct t300rs_device_entry *t300rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	struct __packed t300rs_packet_autocenter {
 		struct t300rs_setup_header header;
 		uint16_t value;
@@ -1278,14 +1282,13 @@ int t300rs_set_autocenter(void *data, uint16_t value)
 	if (!t300rs)
 		return -ENODEV;
 
-	/* TODO: this should probably also use a separately allocated buffer? */
-	autocenter_packet = (struct t300rs_packet_autocenter *)t300rs->send_buffer;
+	autocenter_packet = (struct t300rs_packet_autocenter *)send_buffer;
 
 	autocenter_packet->header.cmd = 0x08;
 	autocenter_packet->header.code = 0x04;
 	autocenter_packet->value = cpu_to_le16(0x01);
 
-	if ((ret = t300rs_send_int(t300rs))) {
+	if ((ret = t300rs_send_buf(t300rs, send_buffer, t300rs->buffer_length))) {
 		hid_err(t300rs->hdev, "failed setting autocenter");
 		return ret;
 	}
@@ -1295,7 +1298,7 @@ int t300rs_set_autocenter(void *data, uint16_t value)
 
 	autocenter_packet->value = cpu_to_le16(value);
 
-	if ((ret = t300rs_send_int(t300rs)))
+	if ((ret = t300rs_send_buf(t300rs, send_buffer, t300rs->buffer_length)))
 		hid_err(t300rs->hdev, "failed setting autocenter");
 
 	return ret;
@@ -1304,6 +1307,7 @@ int t300rs_set_autocenter(void *data, uint16_t value)
 int t300rs_set_gain(void *data, uint16_t gain)
 {
 	struct t300rs_device_entry *t300rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	struct __packed t300rs_packet_gain {
 		struct t300rs_setup_header header;
 	} *gain_packet;
@@ -1312,11 +1316,11 @@ int t300rs_set_gain(void *data, uint16_t gain)
 	if (!t300rs)
 		return -ENODEV;
 
-	gain_packet = (struct t300rs_packet_gain *)t300rs->send_buffer;
+	gain_packet = (struct t300rs_packet_gain *)send_buffer;
 	gain_packet->header.cmd = 0x02;
 	gain_packet->header.code = (gain >> 8) & 0xff;
 
-	if ((ret = t300rs_send_int(t300rs)))
+	if ((ret = t300rs_send_buf(t300rs, send_buffer, t300rs->buffer_length)))
 		hid_err(t300rs->hdev, "failed setting gain: %i\n", ret);
 
 	return ret;
@@ -1325,10 +1329,7 @@ int t300rs_set_gain(void *data, uint16_t gain)
 int t300rs_set_range(void *data, uint16_t value)
 {
 	struct t300rs_device_entry *t300rs = data;
-	/* it's important that we don't use t300rs->send_buffer, as range can be
-	 * set from outside of the FFB environment, and we don't want to
-	 * accidentally overwrite any data. */
-	u8 *send_buffer = kzalloc(t300rs->buffer_length, GFP_KERNEL);
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	uint16_t scaled_value;
 	int ret;
 
@@ -1342,12 +1343,6 @@ int t300rs_set_range(void *data, uint16_t value)
 		value = 1080;
 	}
 
-	if (!send_buffer) {
-		ret = -EINVAL;
-		hid_err(t300rs->hdev, "could not allocate send_buffer\n");
-		goto err;
-	}
-
 	scaled_value = value * 0x3c;
 	send_buffer[0] = 0x08;
 	send_buffer[1] = 0x11;
@@ -1358,15 +1353,14 @@ int t300rs_set_range(void *data, uint16_t value)
 		hid_warn(t300rs->hdev, "failed setting range\n");
 
 	/* since everythin went OK, update the current range */
-	range = value;
-err:
-	kfree(send_buffer);
+	t300rs->tmff2->range = value;
 	return ret;
 }
 
 int t300rs_open(void *data)
 {
 	struct t300rs_device_entry *t300rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	struct __packed t300rs_packet_open {
 		struct t300rs_setup_header header;
 	} *open_packet;
@@ -1374,11 +1368,11 @@ int t300rs_open(void *data)
 	if (!t300rs)
 		return -ENODEV;
 
-	open_packet = (struct t300rs_packet_open *)t300rs->send_buffer;
+	open_packet = (struct t300rs_packet_open *)send_buffer;
 	open_packet->header.cmd = 0x01;
 	open_packet->header.code = 0x05;
 
-	if (t300rs_send_int(t300rs))
+	if (t300rs_send_buf(t300rs, send_buffer, t300rs->buffer_length))
 		hid_warn(t300rs->hdev, "failed sending open command\n");
 
 	return t300rs->open(t300rs->input_dev);
@@ -1387,6 +1381,7 @@ int t300rs_open(void *data)
 int t300rs_close(void *data)
 {
 	struct t300rs_device_entry *t300rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 	struct t300rs_packet_close {
 		struct t300rs_setup_header header;
 	} *close_packet;
@@ -1395,10 +1390,10 @@ int t300rs_close(void *data)
 	if (!t300rs)
 		return -ENODEV;
 
-	close_packet = (struct t300rs_packet_close *)t300rs->send_buffer;
+	close_packet = (struct t300rs_packet_close *)send_buffer;
 	close_packet->header.cmd = 0x01;
 
-	if ((ret = t300rs_send_int(t300rs)))
+	if ((ret = t300rs_send_buf(t300rs, send_buffer, t300rs->buffer_length)))
 		hid_warn(t300rs->hdev, "failed sending close command\n");
 
 	t300rs->close(t300rs->input_dev);
@@ -1408,8 +1403,10 @@ int t300rs_close(void *data)
 static int t300rs_check_firmware(struct t300rs_device_entry *t300rs)
 {
 	int ret;
+	/* the wheel may answer with all of wLength, which is more than we
+	 * care about */
 	struct t300rs_fw_response *fw_response =
-		kzalloc(sizeof(struct t300rs_fw_response), GFP_KERNEL);
+		kzalloc(t300rs_fw_request.wLength, GFP_KERNEL);
 
 	if (!fw_response) {
 		hid_err(t300rs->hdev, "could not allocate fw_response\n");
@@ -1433,8 +1430,14 @@ static int t300rs_check_firmware(struct t300rs_device_entry *t300rs)
 		goto out;
 	}
 
+	if (ret < offsetofend(struct t300rs_fw_response, fw_version)) {
+		hid_err(t300rs->hdev, "short firmware version response: %i bytes\n", ret);
+		ret = -EPROTO;
+		goto out;
+	}
+
 	/* Educated guess */
-	if (fw_response->fw_version < 31 && ret >= 0) {
+	if (fw_response->fw_version < 31) {
 		hid_err(t300rs->hdev,
 				"firmware version %i is too old, please update.\n",
 				fw_response->fw_version
@@ -1480,7 +1483,7 @@ static int t300rs_get_attachment(struct t300rs_device_entry *t300rs)
 				uint8_t model;
 			} b;
 		};
-	} *response = kzalloc(GFP_KERNEL, sizeof(struct t300rs_attachment_response));
+	} *response = kzalloc(sizeof(struct t300rs_attachment_response), GFP_KERNEL);
 	struct usb_ctrlrequest t300rs_attachment_rq = {
 		.bRequestType = 0xc1,
 		.bRequest = 73,
@@ -1490,7 +1493,7 @@ static int t300rs_get_attachment(struct t300rs_device_entry *t300rs)
 	};
 	int ret, attachment;
 	if (!response)
-		return -ENODEV;
+		return -ENOMEM;
 
 	ret = usb_control_msg(t300rs->usbdev,
 			usb_rcvctrlpipe(t300rs->usbdev, 0),
@@ -1508,13 +1511,20 @@ static int t300rs_get_attachment(struct t300rs_device_entry *t300rs)
 		goto out;
 	}
 
+	/* both layouts have the attachment at the same offset */
+	if (ret < offsetofend(struct t300rs_attachment_response, b.attachment)) {
+		hid_err(t300rs->hdev, "short attachment response: %i bytes\n", ret);
+		ret = -EPROTO;
+		goto out;
+	}
+
 	if (response->type == cpu_to_le16(0x49)) {
 		attachment = response->a.attachment;
 	} else if (response->type == cpu_to_le16(0x47)) {
 		attachment = response->b.attachment;
 	} else {
-		hid_err(t300rs->hdev, "unknown packet type %hx\n, please contact a maintainer",
-				response->type);
+		hid_err(t300rs->hdev, "unknown packet type %hx, please contact a maintainer\n",
+				le16_to_cpu(response->type));
 		ret = -EINVAL;
 		goto out;
 	}
@@ -1538,22 +1548,28 @@ static int t300rs_wheel_init(struct tmff2_device_entry *tmff2)
 		goto t300rs_err;
 	}
 
+	t300rs->tmff2 = tmff2;
 	t300rs->hdev = tmff2->hdev;
 	t300rs->input_dev = tmff2->input_dev;
-	t300rs->usbdev = to_usb_device(tmff2->hdev->dev.parent->parent);
+	/* without usb there is nothing to ask about firmware or attachments,
+	 * and the packets go out through the hid core */
+	if (tmff2->is_usb)
+		t300rs->usbdev = to_usb_device(tmff2->hdev->dev.parent->parent);
 
 	if(t300rs->hdev->product == TMT300RS_PS4_NORM_ID)
 		t300rs->buffer_length = T300RS_PS4_BUFFER_LENGTH;
 	else
 		t300rs->buffer_length = T300RS_NORM_BUFFER_LENGTH;
 
-	t300rs->send_buffer = kzalloc(t300rs->buffer_length, GFP_KERNEL);
-	if (!t300rs->send_buffer) {
+	/* usb transfer buffers have to be dma capable, so no stack or
+	 * embedded buffers here */
+	t300rs->out_buffer = kzalloc(t300rs->buffer_length + 1, GFP_KERNEL);
+	if (!t300rs->out_buffer) {
 		ret = -ENOMEM;
 		goto send_err;
 	}
 
-	if ((ret = t300rs_check_firmware(t300rs)))
+	if (t300rs->usbdev && (ret = t300rs_check_firmware(t300rs)))
 		goto firmware_err;
 
 	report_list = &t300rs->hdev->report_enum[HID_OUTPUT_REPORT].report_list;
@@ -1562,12 +1578,17 @@ static int t300rs_wheel_init(struct tmff2_device_entry *tmff2)
 	t300rs->report = list_entry(report_list->next, struct hid_report, list);
 	t300rs->ff_field = t300rs->report->field[0];
 
+	t300rs->out_buffer[0] = t300rs->report->id;
+	t300rs->raw_output = 1;
+	t300rs->combined_modify = combined_modify;
+
 	t300rs->open = t300rs->input_dev->open;
 	t300rs->close = t300rs->input_dev->close;
 
 	/* TODO: PS4 advanced mode? */
 	alt_mode = (t300rs->mode = (t300rs->hdev->product == TMT300RS_PS3_ADV_ID));
-	if ((t300rs->attachment = t300rs_get_attachment(t300rs)) < 0)
+	if (!t300rs->usbdev
+			|| (t300rs->attachment = t300rs_get_attachment(t300rs)) < 0)
 		t300rs->attachment = T300RS_DEFAULT_ATTACHMENT;
 
 	/* everythin went OK */
@@ -1580,7 +1601,7 @@ static int t300rs_wheel_init(struct tmff2_device_entry *tmff2)
 	return 0;
 
 firmware_err:
-	kfree(t300rs->send_buffer);
+	kfree(t300rs->out_buffer);
 send_err:
 	kfree(t300rs);
 t300rs_err:
@@ -1594,7 +1615,7 @@ static int t300rs_wheel_destroy(void *data)
 	if (!t300rs)
 		return -ENODEV;
 
-	kfree(t300rs->send_buffer);
+	kfree(t300rs->out_buffer);
 	kfree(t300rs);
 	return 0;
 }
@@ -1632,6 +1653,7 @@ int t300rs_populate_api(struct tmff2_device_entry *tmff2)
 	tmff2->upload_effect = t300rs_upload_effect;
 	tmff2->update_effect = t300rs_update_effect;
 	tmff2->stop_effect = t300rs_stop_effect;
+	tmff2->send_packet = t300rs_send_packet;
 
 	tmff2->wheel_init = t300rs_wheel_init;
 	tmff2->wheel_destroy = t300rs_wheel_destroy;
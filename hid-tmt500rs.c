@@ -1,631 +1,669 @@
 // SPDX-License-Identifier: GPL-2.0
+#include <linux/usb.h>
+#include <linux/hid.h>
 #include "hid-tmt500rs.h"
 
-static int timer_msecs = DEFAULT_TIMER_PERIOD;
-module_param(timer_msecs, int, 0660);
-MODULE_PARM_DESC(timer_msecs, "Timer resolution in msecs");
+static const unsigned long t500rs_params =
+	PARAM_SPRING_LEVEL
+	| PARAM_DAMPER_LEVEL
+	| PARAM_FRICTION_LEVEL
+	| PARAM_RANGE
+	| PARAM_GAIN
+	;
+
+static const signed short t500rs_effects[] = {
+	FF_CONSTANT,
+	FF_RAMP,
+	FF_SPRING,
+	FF_DAMPER,
+	FF_FRICTION,
+	FF_INERTIA,
+	FF_PERIODIC,
+	FF_SINE,
+	FF_TRIANGLE,
+	FF_SQUARE,
+	FF_SAW_UP,
+	FF_SAW_DOWN,
+	FF_AUTOCENTER,
+	FF_GAIN,
+	-1
+};
 
-static int spring_level = 30;
-module_param(spring_level, int, 0);
-MODULE_PARM_DESC(spring_level, "Level of spring force (0-100), as per Oversteer standards");
+static const struct usb_ctrlrequest t500rs_firmware_request = {
+	.bRequestType = 0xc1,
+	.bRequest = 86,
+	.wValue = 0,
+	.wIndex = 0,
+	.wLength = 8
+};
 
-static int damper_level = 30;
-module_param(damper_level, int, 0);
-MODULE_PARM_DESC(damper_level, "Level of damper force (0-100), as per Oversteer standards");
+static const u8 spring_values[] = {
+	0xa6, 0x6a, 0xa6, 0x6a, 0xfe,
+	0xff, 0xfe, 0xff, 0xfe, 0xff,
+	0xfe, 0xff, 0xdf, 0x58, 0xa6,
+	0x6a, 0x06
+};
 
-static int friction_level = 30;
-module_param(friction_level, int, 0);
-MODULE_PARM_DESC(friction_level, "Level of friction force (0-100), as per Oversteer standards");
+static const u8 damper_values[] = {
+	0xfc, 0x7f, 0xfc, 0x7f, 0xfe,
+	0xff, 0xfe, 0xff, 0xfe, 0xff,
+	0xfe, 0xff, 0xfc, 0x7f, 0xfc,
+	0x7f, 0x07
+};
 
-static struct t500rs_device_entry *t500rs_get_device(struct hid_device *hdev)
+static void t500rs_int_callback(struct urb *urb)
 {
-	struct t500rs_data *drv_data;
-	struct t500rs_device_entry *t500rs;
+	struct t500rs_urb *p = urb->context;
+	struct t500rs_device_entry *t500rs = p->t500rs;
+	u64 latency = ktime_to_ns(ktime_sub(ktime_get(), p->submitted));
+	unsigned long flags;
+	bool killed = urb->status == -ENOENT || urb->status == -ECONNRESET
+		|| urb->status == -ESHUTDOWN;
+
+	/* killed on remove, nothing to report */
+	if (urb->status && !killed)
+		hid_warn(t500rs->hdev, "urb status %i received\n", urb->status);
+
+	spin_lock_irqsave(&t500rs->pool_lock, flags);
+	/* the pool lock keeps completions on different cpus from
+	 * recording at the same time */
+	if (!killed)
+		tmff2_packet_done(t500rs->tmff2, &p->inflight, urb->status);
+	t500rs->completed++;
+	t500rs->latency_total_ns += latency;
+	if (latency > t500rs->latency_max_ns)
+		t500rs->latency_max_ns = latency;
+	tmff2_hist_add(&t500rs->latency, latency);
+	__set_bit(p - t500rs->pool, &t500rs->pool_free);
+	t500rs->stalled = false;
+	spin_unlock_irqrestore(&t500rs->pool_lock, flags);
+
+	wake_up(&t500rs->pool_wait);
+}
 
-	spin_lock_irqsave(&lock, lock_flags);
-	drv_data = hid_get_drvdata(hdev);
-	if (!drv_data) {
-		hid_err(hdev, "private data not found\n");
-		return NULL;
+static int t500rs_pool_init(struct t500rs_device_entry *t500rs)
+{
+	struct usb_host_endpoint *ep = &t500rs->usbif->cur_altsetting->endpoint[1];
+	struct t500rs_urb *p;
+	int i;
+
+	spin_lock_init(&t500rs->pool_lock);
+	init_waitqueue_head(&t500rs->pool_wait);
+	init_usb_anchor(&t500rs->anchor);
+
+	for (i = 0; i < T500RS_URB_POOL_SIZE; ++i) {
+		p = &t500rs->pool[i];
+		p->t500rs = t500rs;
+
+		p->urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!p->urb)
+			return -ENOMEM;
+
+		p->buf = usb_alloc_coherent(t500rs->usbdev, T500RS_BUFFER_LENGTH + 1,
+				GFP_KERNEL, &p->urb->transfer_dma);
+		if (!p->buf)
+			return -ENOMEM;
+
+		usb_fill_int_urb(p->urb,
+				t500rs->usbdev,
+				usb_sndintpipe(t500rs->usbdev, 1),
+				p->buf,
+				T500RS_BUFFER_LENGTH + 1,
+				t500rs_int_callback,
+				p,
+				ep->desc.bInterval);
+		p->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+		__set_bit(i, &t500rs->pool_free);
 	}
 
-	t500rs = drv_data->device_props;
-	if (!t500rs) {
-		hid_err(hdev, "device properties not found\n");
-		return NULL;
+	return 0;
+}
+
+/* kills whatever is still in flight, safe to call on a partially set up pool */
+static void t500rs_pool_destroy(struct t500rs_device_entry *t500rs)
+{
+	struct t500rs_urb *p;
+	int i;
+
+	usb_kill_anchored_urbs(&t500rs->anchor);
+
+	for (i = 0; i < T500RS_URB_POOL_SIZE; ++i) {
+		p = &t500rs->pool[i];
+
+		if (p->buf)
+			usb_free_coherent(t500rs->usbdev, T500RS_BUFFER_LENGTH + 1,
+					p->buf, p->urb->transfer_dma);
+		usb_free_urb(p->urb);
+
+		p->buf = NULL;
+		p->urb = NULL;
 	}
-	spin_unlock_irqrestore(&lock, lock_flags);
-	return t500rs;
+
+	t500rs->pool_free = 0;
 }
 
-static int t500rs_send_int(struct input_dev *dev, u8 *send_buffer, int *trans)
+/* claim a free urb, -1 if they're all in flight */
+static int t500rs_pool_get(struct t500rs_device_entry *t500rs)
 {
-	struct hid_device *hdev = input_get_drvdata(dev);
-	struct t500rs_device_entry *t500rs;
+	unsigned long flags;
+	unsigned int in_flight;
 	int i;
 
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return -1;
+	spin_lock_irqsave(&t500rs->pool_lock, flags);
+	i = find_first_bit(&t500rs->pool_free, T500RS_URB_POOL_SIZE);
+	if (i >= T500RS_URB_POOL_SIZE) {
+		i = -1;
+		goto out;
 	}
 
-	for (i = 0; i < T500RS_BUFFER_LENGTH; ++i)
-		t500rs->ff_field->value[i] = send_buffer[i];
+	__clear_bit(i, &t500rs->pool_free);
+	in_flight = T500RS_URB_POOL_SIZE - hweight_long(t500rs->pool_free);
+	if (in_flight > t500rs->in_flight_max)
+		t500rs->in_flight_max = in_flight;
+	t500rs->submitted++;
+out:
+	spin_unlock_irqrestore(&t500rs->pool_lock, flags);
+	return i;
+}
 
-	hid_hw_request(t500rs->hdev, t500rs->report, HID_REQ_SET_REPORT);
+static void t500rs_pool_put(struct t500rs_device_entry *t500rs, int i)
+{
+	unsigned long flags;
 
-	memset(send_buffer, 0, T500RS_BUFFER_LENGTH);
+	spin_lock_irqsave(&t500rs->pool_lock, flags);
+	__set_bit(i, &t500rs->pool_free);
+	spin_unlock_irqrestore(&t500rs->pool_lock, flags);
 
-	return 0;
+	wake_up(&t500rs->pool_wait);
 }
 
-static void t500rs_int_callback(struct urb *urb){
-    if(urb->status){
-        hid_warn(urb->dev, "urb status %i received\n", urb->status);
-    }
+/* wait a little for a urb to come back, -EBUSY if none did. Once a wait
+ * timed out we don't wait again until the wheel completes one */
+static int t500rs_pool_wait(struct t500rs_device_entry *t500rs)
+{
+	unsigned long flags;
+	bool stalled;
+	int i = -1;
+
+	spin_lock_irqsave(&t500rs->pool_lock, flags);
+	stalled = t500rs->stalled;
+	t500rs->waited++;
+	spin_unlock_irqrestore(&t500rs->pool_lock, flags);
+
+	if (!stalled)
+		wait_event_timeout(t500rs->pool_wait,
+				(i = t500rs_pool_get(t500rs)) >= 0,
+				msecs_to_jiffies(T500RS_POOL_WAIT_MS));
+	if (i >= 0)
+		return i;
+
+	spin_lock_irqsave(&t500rs->pool_lock, flags);
+	t500rs->stalled = true;
+	t500rs->timeouts++;
+	spin_unlock_irqrestore(&t500rs->pool_lock, flags);
+
+	return -EBUSY;
+}
+
+/* only called from the drain work. If every urb is in flight we wait for the
+ * wheel to catch up, which keeps the queue from being emptied faster than the
+ * wheel can take it. The wait is short so the drain work is never held up for
+ * long, packets that don't make it are requeued by the core */
+static int t500rs_send_packet(void *data, const u8 *buf,
+		const struct tmff2_inflight *inflight)
+{
+	struct t500rs_device_entry *t500rs = data;
+	struct t500rs_urb *p;
+	int i, ret;
+
+	if ((i = t500rs_pool_get(t500rs)) < 0
+			&& (i = t500rs_pool_wait(t500rs)) < 0)
+		return i;
+
+	p = &t500rs->pool[i];
+	p->buf[0] = t500rs->report->id;
+	memcpy(p->buf + 1, buf, T500RS_BUFFER_LENGTH);
+	p->inflight = *inflight;
+	p->submitted = ktime_get();
+
+	usb_anchor_urb(p->urb, &t500rs->anchor);
+	if ((ret = usb_submit_urb(p->urb, GFP_KERNEL))) {
+		usb_unanchor_urb(p->urb);
+		t500rs_pool_put(t500rs, i);
+	}
 
-    usb_free_urb(urb);
+	return ret;
 }
 
-static int t500rs_send_custom_int(struct input_dev *dev, u8 *send_buffer, int *trans){
-    struct hid_device *hdev = input_get_drvdata(dev);
-    struct t500rs_device_entry *t500rs;
-    struct usb_device *usbdev;
-    struct usb_interface *usbif;
-    struct usb_host_endpoint *ep;
-    struct urb *urb = usb_alloc_urb(0, GFP_ATOMIC);
-    
-    t500rs = t500rs_get_device(hdev);
-    if(!t500rs){
-        hid_err(hdev, "could not get device\n");
-    }
-
-    usbdev = t500rs->usbdev;
-    usbif = t500rs->usbif;
-    ep = &usbif->cur_altsetting->endpoint[1];
-
-    usb_fill_int_urb(
-            urb,
-            usbdev,
-            usb_sndintpipe(usbdev, 1),
-            send_buffer,
-            T500RS_BUFFER_LENGTH,
-            t500rs_int_callback,
-            hdev,
-            ep->desc.bInterval
-            );
-
-    return usb_submit_urb(urb, GFP_ATOMIC);
+static int t500rs_send_buf(struct t500rs_device_entry *t500rs, const u8 *send_buffer)
+{
+	return tmff2_queue_packet(t500rs->tmff2, TMFF2_PRIO_SETTINGS, -1,
+			send_buffer, T500RS_BUFFER_LENGTH);
 }
 
-static int t500rs_play_effect(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+/* reserve the next packet and fill in which effect and command it's for, NULL
+ * if there's no room left */
+static u8 *t500rs_packet_next(struct tmff2_packets *packets, u8 id, u8 code)
 {
-	u8 *send_buffer = t500rs->send_buffer;
-	int ret, trans;
+	u8 *send_buffer = tmff2_packet_next(packets);
+
+	if (!send_buffer)
+		return NULL;
+
+	send_buffer[1] = id + 1;
+	send_buffer[2] = code;
+	return send_buffer;
+}
 
+static int t500rs_play_effect(void *data, struct tmff2_effect_state *state)
+{
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
+	int ret;
 
 	send_buffer[1] = state->effect.id + 1;
 	send_buffer[2] = 0x89;
 	send_buffer[3] = 0x01;
 
-	ret = t500rs_send_custom_int(t500rs->input_dev, send_buffer, &trans);
+	ret = tmff2_queue_packet(t500rs->tmff2, TMFF2_PRIO_PLAY,
+			state->effect.id, send_buffer, T500RS_BUFFER_LENGTH);
 	if (ret)
 		hid_err(t500rs->hdev, "failed starting effect play\n");
 
 	return ret;
 }
 
-static int t500rs_stop_effect(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+static int t500rs_stop_effect(void *data, struct tmff2_effect_state *state)
 {
-	u8 *send_buffer = t500rs->send_buffer;
-	int ret, trans;
-
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
+	int ret;
 
 	send_buffer[1] = state->effect.id + 1;
 	send_buffer[2] = 0x89;
 
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
+	ret = tmff2_queue_packet(t500rs->tmff2, TMFF2_PRIO_STOP,
+			state->effect.id, send_buffer, T500RS_BUFFER_LENGTH);
 	if (ret)
 		hid_err(t500rs->hdev, "failed stopping effect play\n");
 
 	return ret;
 }
 
-static void t500rs_fill_envelope(u8 *send_buffer, int i, s16 level,
-		u16 duration, struct ff_envelope *envelope)
+/* the envelope as the wheel gets it, attack length, attack level, fade length
+ * and fade level */
+static void t500rs_envelope_values(u16 values[4], s16 level, u16 duration,
+		struct ff_envelope *envelope)
 {
-	u16 attack_length = (duration * envelope->attack_length) / 0x7fff;
-	u16 attack_level = (level * envelope->attack_level) / 0x7fff;
-	u16 fade_length = (duration * envelope->fade_length) / 0x7fff;
-	u16 fade_level = (level * envelope->fade_level) / 0x7fff;
-
-	send_buffer[i + 0] = attack_length & 0xff;
-	send_buffer[i + 1] = attack_length >> 8;
-	send_buffer[i + 2] = attack_level & 0xff;
-	send_buffer[i + 3] = attack_level >> 8;
-	send_buffer[i + 4] = fade_length & 0xff;
-	send_buffer[i + 5] = fade_length >> 8;
-	send_buffer[i + 6] = fade_level & 0xff;
-	send_buffer[i + 7] = fade_level >> 8;
+	values[0] = tmff2_sat_u16(tmff2_scale(duration, envelope->attack_length));
+	values[1] = tmff2_sat_s16(tmff2_scale(level, envelope->attack_level));
+	values[2] = tmff2_sat_u16(tmff2_scale(duration, envelope->fade_length));
+	values[3] = tmff2_sat_s16(tmff2_scale(level, envelope->fade_level));
 }
 
-static int t500rs_modify_envelope(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state,
-		u8 *send_buffer,
-		s16 level,
-		u16 duration,
-		u8 id,
-		struct ff_envelope envelope,
-		struct ff_envelope envelope_old
-		)
+static void t500rs_fill_envelope(u8 *send_buffer, int i, const u16 values[4])
 {
-	u16 attack_length, attack_level, fade_length, fade_level;
-	int ret = 0, trans;
+	int j;
 
-	if (duration == 0)
-		duration = 0xffff;
+	for (j = 0; j < 4; ++j) {
+		send_buffer[i + 2 * j] = values[j] & 0xff;
+		send_buffer[i + 2 * j + 1] = values[j] >> 8;
+	}
+}
 
-	attack_length = (duration * envelope.attack_length) / 0x7fff;
-	attack_level = (level * envelope.attack_level) / 0x7fff;
-	fade_length = (duration * envelope.fade_length) / 0x7fff;
-	fade_level = (level * envelope.fade_level) / 0x7fff;
+/* the modify commands take a bitmask of the attributes being changed,
+ * followed by the new value of each attribute in the mask, lowest bit first,
+ * the same as on the T300RS. Only the combinations seen in captures, ramp
+ * difference and level (0x03) and both deadbands (0x4c), are sent together,
+ * as given in merge. Every other changed attribute gets a packet of its own. */
+struct t500rs_modify {
+	u8 code;
+	u8 base;
+	u8 merge;
+	u8 mask;
+	u16 values[4];
+};
 
+#define T500RS_MOD_MAGNITUDE		0
+#define T500RS_MOD_OFFSET		1
+#define T500RS_MOD_PHASE		2
+#define T500RS_MOD_PERIOD		3
 
-	send_buffer[1] = id + 1;
-	send_buffer[2] = 0x31;
+#define T500RS_MOD_DIFFERENCE		0
+#define T500RS_MOD_LEVEL		1
 
-	if (envelope.attack_length != envelope_old.attack_length) {
-		send_buffer[3] = 0x81;
+#define T500RS_MOD_RIGHT_COEFF		0
+#define T500RS_MOD_LEFT_COEFF		1
+#define T500RS_MOD_RIGHT_DEADBAND	2
+#define T500RS_MOD_LEFT_DEADBAND	3
 
-		send_buffer[4] = attack_length & 0xff;
-		send_buffer[5] = attack_length >> 8;
+static void t500rs_modify_init(struct t500rs_modify *mod, u8 code, u8 base,
+		u8 merge)
+{
+	mod->code = code;
+	mod->base = base;
+	mod->merge = merge;
+	mod->mask = 0;
+}
 
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
-	}
+/* add an attribute to the command, it's only sent if the wheel doesn't
+ * already have that value or it's merged with one that changed. shadow is
+ * the slot's copy of the attributes the command modifies */
+static void t500rs_modify_set(struct t500rs_modify *mod, u16 *shadow,
+		int attribute, u16 value)
+{
+	mod->values[attribute] = value;
+	if (shadow[attribute] == value)
+		return;
 
-	if (envelope.attack_level != envelope_old.attack_level) {
-		send_buffer[3] = 0x82;
+	shadow[attribute] = value;
+	mod->mask |= 1 << attribute;
+}
 
-		send_buffer[4] = attack_level & 0xff;
-		send_buffer[5] = attack_level >> 8;
+static int t500rs_encode_attributes(struct tmff2_packets *packets, u8 id,
+		struct t500rs_modify *mod, u8 mask)
+{
+	u8 *send_buffer;
+	int i, j = 4;
 
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
-	}
+	send_buffer = t500rs_packet_next(packets, id, mod->code);
+	if (!send_buffer)
+		return -ENOSPC;
 
-	if (envelope.fade_length != envelope_old.fade_length) {
-		send_buffer[3] = 0x84;
+	send_buffer[3] = mod->base | mask;
 
-		send_buffer[4] = fade_length & 0xff;
-		send_buffer[5] = fade_length >> 8;
+	for (i = 0; i < ARRAY_SIZE(mod->values); ++i) {
+		if (!(mask & (1 << i)))
+			continue;
 
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
+		send_buffer[j++] = mod->values[i] & 0xff;
+		send_buffer[j++] = mod->values[i] >> 8;
 	}
 
-	if (envelope.fade_level != envelope_old.fade_level) {
-		send_buffer[3] = 0x88;
+	return 0;
+}
+
+static int t500rs_encode_modify(struct tmff2_packets *packets, u8 id,
+		struct t500rs_modify *mod)
+{
+	int i, ret;
+
+	if (mod->mask & mod->merge) {
+		ret = t500rs_encode_attributes(packets, id, mod, mod->merge);
+		if (ret)
+			return ret;
+	}
 
-		send_buffer[4] = fade_level & 0xff;
-		send_buffer[5] = fade_level >> 8;
+	for (i = 0; i < ARRAY_SIZE(mod->values); ++i) {
+		if (!(mod->mask & ~mod->merge & (1 << i)))
+			continue;
 
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying effect envelope\n");
-			goto error;
-		}
+		ret = t500rs_encode_attributes(packets, id, mod, 1 << i);
+		if (ret)
+			return ret;
 	}
 
-error:
-	return ret;
+	return 0;
 }
 
-static int t500rs_modify_duration(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state, u8 *send_buffer)
+/* the T500 takes 0xffff for effects that play until they're stopped */
+static u16 t500rs_duration(struct ff_effect *effect)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	u16 duration;
-	int ret = 0, trans;
+	return effect->replay.length ? effect->replay.length : 0xffff;
+}
 
-	if (effect.replay.length == 0)
-		duration = 0xffff;
-	else
-		duration = effect.replay.length;
+static int t500rs_modify_envelope(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets,
+		s16 level, struct ff_envelope *envelope)
+{
+	struct t500rs_modify mod;
+	u16 values[4];
+	int ret, i;
 
-	if (effect.replay.length != old.replay.length) {
+	t500rs_envelope_values(values, level, t500rs_duration(&state->effect),
+			envelope);
 
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x49;
-		send_buffer[4] = 0x41;
+	t500rs_modify_init(&mod, 0x31, 0x80, 0);
+	for (i = 0; i < ARRAY_SIZE(values); ++i)
+		t500rs_modify_set(&mod, state->next.envelope, i, values[i]);
 
-		send_buffer[5] = duration & 0xff;
-		send_buffer[6] = duration >> 8;
+	ret = t500rs_encode_modify(packets, state->effect.id, &mod);
+	if (ret)
+		hid_err(t500rs->hdev, "failed modifying effect envelope\n");
 
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying duration\n");
-			goto error;
-		}
-	}
-error:
 	return ret;
 }
 
-static int t500rs_modify_constant(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state, u8 *send_buffer)
+static int t500rs_modify_duration(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_constant_effect constant = effect.u.constant;
-	struct ff_constant_effect constant_old = old.u.constant;
-	int ret, trans;
-	s16 level;
+	u16 duration = t500rs_duration(&state->effect);
+	u8 *send_buffer;
+
+	if (state->next.duration == duration)
+		return 0;
 
-	level = (constant.level * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	send_buffer = t500rs_packet_next(packets, state->effect.id, 0x49);
+	if (!send_buffer) {
+		hid_err(t500rs->hdev, "failed modifying duration\n");
+		return -ENOSPC;
+	}
 
-	if (constant.level != constant_old.level) {
+	send_buffer[4] = 0x41;
+	send_buffer[5] = duration & 0xff;
+	send_buffer[6] = duration >> 8;
+	state->next.duration = duration;
 
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0a;
+	return 0;
+}
 
-		send_buffer[3] = level & 0xff;
-		send_buffer[4] = level >> 8;
+static int t500rs_modify_constant(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
+{
+	struct ff_effect *effect = &state->effect;
+	struct ff_constant_effect *constant = &effect->u.constant;
+	u8 *send_buffer;
+	int ret;
+	s16 level;
+
+	level = tmff2_scale(constant->level, tmff2_projection(state));
 
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
+	if ((u16)level != state->next.level) {
+		send_buffer = t500rs_packet_next(packets, effect->id, 0x0a);
+		if (!send_buffer) {
 			hid_err(t500rs->hdev, "failed modifying constant effect\n");
+			ret = -ENOSPC;
 			goto error;
 		}
 
+		send_buffer[3] = level & 0xff;
+		send_buffer[4] = level >> 8;
+		state->next.level = level;
 	}
 
-	ret = t500rs_modify_envelope(t500rs,
-			state,
-			send_buffer,
-			level,
-			effect.replay.length,
-			effect.id,
-			constant.envelope,
-			constant_old.envelope
-			);
+	ret = t500rs_modify_envelope(t500rs, state, packets, level,
+			&constant->envelope);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying constant envelope\n");
 		goto error;
 	}
 
-	ret = t500rs_modify_duration(t500rs, state, send_buffer);
+	ret = t500rs_modify_duration(t500rs, state, packets);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying constant duration\n");
 		goto error;
 	}
 
 error:
-
 	return ret;
 }
 
 static int t500rs_modify_ramp(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state, u8 *send_buffer)
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_ramp_effect ramp = effect.u.ramp;
-	struct ff_ramp_effect ramp_old = old.u.ramp;
-	int ret, trans;
+	struct ff_effect *effect = &state->effect;
+	struct ff_ramp_effect *ramp = &effect->u.ramp;
+	struct t500rs_modify mod;
+	int ret;
 
 	u16 difference, top, bottom;
 	s16 level;
 
-	top = ramp.end_level > ramp.start_level ? ramp.end_level : ramp.start_level;
-	bottom = ramp.end_level > ramp.start_level ? ramp.start_level : ramp.end_level;
-
-
-	difference = ((top - bottom) * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-
-
-	level = (top * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	top = ramp->end_level > ramp->start_level ? ramp->end_level : ramp->start_level;
+	bottom = ramp->end_level > ramp->start_level ? ramp->start_level : ramp->end_level;
 
-	if (ramp.start_level != ramp_old.start_level || ramp.end_level != ramp_old.end_level) {
+	difference = tmff2_scale(top - bottom, tmff2_projection(state));
+	level = tmff2_scale(top, tmff2_projection(state));
 
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x03;
-
-		send_buffer[4] = difference & 0xff;
-		send_buffer[5] = difference >> 8;
-
-		send_buffer[6] = level & 0xff;
-		send_buffer[7] = level >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying ramp effect\n");
-			goto error;
-		}
+	t500rs_modify_init(&mod, 0x0e, 0x00,
+			BIT(T500RS_MOD_DIFFERENCE) | BIT(T500RS_MOD_LEVEL));
+	t500rs_modify_set(&mod, state->next.values, T500RS_MOD_DIFFERENCE, difference);
+	t500rs_modify_set(&mod, state->next.values, T500RS_MOD_LEVEL, level);
 
+	ret = t500rs_encode_modify(packets, effect->id, &mod);
+	if (ret) {
+		hid_err(t500rs->hdev, "failed modifying ramp effect\n");
+		goto error;
 	}
 
-	ret = t500rs_modify_envelope(t500rs,
-			state,
-			send_buffer,
-			level,
-			effect.replay.length,
-			effect.id,
-			ramp.envelope,
-			ramp_old.envelope
-			);
-
+	ret = t500rs_modify_envelope(t500rs, state, packets, level,
+			&ramp->envelope);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying ramp envelope\n");
 		goto error;
 	}
 
-	ret = t500rs_modify_duration(t500rs, state, send_buffer);
+	ret = t500rs_modify_duration(t500rs, state, packets);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying ramp duration\n");
 		goto error;
 	}
 
 error:
-
 	return ret;
 }
+
 static int t500rs_modify_damper(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state, u8 *send_buffer)
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_condition_effect damper = effect.u.condition[0];
-	struct ff_condition_effect damper_old = old.u.condition[0];
-	int ret, trans, input_level;
-
-	input_level = damper_level;
+	struct ff_condition_effect *damper = &state->effect.u.condition[0];
+	u16 *shadow = state->next.values;
+	struct t500rs_modify mod;
+	int ret, input_level;
+	s16 right_coeff, left_coeff;
+	u16 deadband_right, deadband_left;
+
+	input_level = t500rs->tmff2->damper_level;
 	if (state->effect.type == FF_FRICTION)
-		input_level = friction_level;
+		input_level = t500rs->tmff2->friction_level;
 
 	if (state->effect.type == FF_SPRING)
-		input_level = spring_level;
-
-	if (damper.right_coeff != damper_old.right_coeff) {
-		s16 coeff = damper.right_coeff * input_level / 100;
-
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x41;
-
-		send_buffer[4] = coeff & 0xff;
-		send_buffer[5] = coeff >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying damper rc\n");
-			goto error;
-		}
-
-	}
-
-	if (damper.left_coeff != damper_old.left_coeff) {
-		s16 coeff = damper.left_coeff * input_level / 100;
-
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x42;
-
-		send_buffer[4] = coeff & 0xff;
-		send_buffer[5] = coeff >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying damper lc\n");
-			goto error;
-		}
-
-	}
-
-	if ((damper.deadband != damper_old.deadband)  ||
-		(damper.center	 != damper_old.center)) {
-		u16 deadband_right = 0xfffe - damper.deadband - damper.center;
-		u16 deadband_left = 0xfffe - damper.deadband + damper.center;
-
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x4c;
-
-		send_buffer[4] = deadband_right & 0xff;
-		send_buffer[5] = deadband_right >> 8;
-
-		send_buffer[6] = deadband_left & 0xff;
-		send_buffer[7] = deadband_left >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying damper deadband\n");
-			goto error;
-		}
-
+		input_level = t500rs->tmff2->spring_level;
+	input_level = tmff2_condition_level(t500rs->tmff2, input_level);
+
+	right_coeff = tmff2_percent(damper->right_coeff, input_level);
+	left_coeff = tmff2_percent(damper->left_coeff, input_level);
+	deadband_right = 0xfffe - damper->deadband - damper->center;
+	deadband_left = 0xfffe - damper->deadband + damper->center;
+
+	t500rs_modify_init(&mod, 0x0e, 0x40,
+			BIT(T500RS_MOD_RIGHT_DEADBAND) | BIT(T500RS_MOD_LEFT_DEADBAND));
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_RIGHT_COEFF, right_coeff);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_LEFT_COEFF, left_coeff);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_RIGHT_DEADBAND, deadband_right);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_LEFT_DEADBAND, deadband_left);
+
+	ret = t500rs_encode_modify(packets, state->effect.id, &mod);
+	if (ret) {
+		hid_err(t500rs->hdev, "failed modifying damper\n");
+		goto error;
 	}
 
-	ret = t500rs_modify_duration(t500rs, state, send_buffer);
+	ret = t500rs_modify_duration(t500rs, state, packets);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying damper duration\n");
 		goto error;
 	}
 
 error:
-
 	return ret;
 }
 
-
 static int t500rs_modify_periodic(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state, u8 *send_buffer)
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	struct ff_effect effect = state->effect;
-	struct ff_effect old = state->old;
-	struct ff_periodic_effect periodic = effect.u.periodic;
-	struct ff_periodic_effect periodic_old = old.u.periodic;
-	int ret, trans;
+	struct ff_effect *effect = &state->effect;
+	struct ff_periodic_effect *periodic = &effect->u.periodic;
+	u16 *shadow = state->next.values;
+	struct t500rs_modify mod;
+	int ret;
 	s16 level;
 
-	level = (periodic.magnitude * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-
-
-	if (periodic.magnitude != periodic_old.magnitude) {
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x01;
-
-		send_buffer[4] = level & 0xff;
-		send_buffer[5] = level >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying periodic magnitude\n");
-			goto error;
-		}
-
-	}
-
-	if (periodic.offset != periodic_old.offset) {
-		s16 offset = periodic.offset;
-
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x02;
-
-		send_buffer[4] = offset & 0xff;
-		send_buffer[5] = offset >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying periodic offset\n");
-			goto error;
-		}
-
-	}
-
-	if (periodic.phase != periodic_old.phase) {
-		s16 phase = periodic.phase;
-
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x04;
-
-		send_buffer[4] = phase & 0xff;
-		send_buffer[5] = phase >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying periodic phase\n");
-			goto error;
-		}
-
-	}
-
-	if (periodic.period != periodic_old.period) {
-		s16 period = periodic.period;
-
-
-		send_buffer[1] = effect.id + 1;
-		send_buffer[2] = 0x0e;
-		send_buffer[3] = 0x08;
+	level = tmff2_scale(periodic->magnitude, tmff2_projection(state));
 
-		send_buffer[4] = period & 0xff;
-		send_buffer[5] = period >> 8;
-
-		ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-		if (ret) {
-			hid_err(t500rs->hdev, "failed modifying periodic period\n");
-			goto error;
-		}
+	t500rs_modify_init(&mod, 0x0e, 0x00, 0);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_MAGNITUDE, level);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_OFFSET, periodic->offset);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_PHASE, periodic->phase);
+	t500rs_modify_set(&mod, shadow, T500RS_MOD_PERIOD, periodic->period);
 
+	ret = t500rs_encode_modify(packets, effect->id, &mod);
+	if (ret) {
+		hid_err(t500rs->hdev, "failed modifying periodic effect\n");
+		goto error;
 	}
 
-	ret = t500rs_modify_envelope(t500rs,
-			state,
-			send_buffer,
-			level,
-			effect.replay.length,
-			effect.id,
-			periodic.envelope,
-			periodic_old.envelope);
+	ret = t500rs_modify_envelope(t500rs, state, packets, level,
+			&periodic->envelope);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying periodic envelope\n");
 		goto error;
 	}
 
-	ret = t500rs_modify_duration(t500rs, state, send_buffer);
+	ret = t500rs_modify_duration(t500rs, state, packets);
 	if (ret) {
 		hid_err(t500rs->hdev, "failed modifying periodic duration\n");
 		goto error;
 	}
 
 error:
-
 	return ret;
 }
 
-
 static int t500rs_upload_constant(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	u8 *send_buffer = t500rs->send_buffer;
 	struct ff_effect effect = state->effect;
 	struct ff_constant_effect constant = state->effect.u.constant;
+	u8 *send_buffer;
 	s16 level;
 	u16 duration, offset;
 
-	int ret, trans;
-
 	/* some games, such as DiRT Rally 2 have a weird feeling to them, sort of
 	 * like the wheel pulls just a bit to the right or left and then it just
 	 * stops. I wouldn't be surprised if it's got something to do with the
 	 * constant envelope, but right now I don't know.
 	 */
 
-	if (test_bit(FF_EFFECT_PLAYING, &state->flags)	&&
-		test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
-		__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-		return t500rs_modify_constant(t500rs, state, send_buffer);
-	}
-
-	level = (constant.level * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-	if (effect.replay.length == 0)
-		duration = 0xffff;
-	else
-		duration = effect.replay.length;
+	level = tmff2_scale(constant.level, tmff2_projection(state));
+	duration = t500rs_duration(&effect);
 
 	offset = effect.replay.delay;
 
-
-	send_buffer[1] = effect.id + 1;
-	send_buffer[2] = 0x6a;
+	send_buffer = t500rs_packet_next(packets, effect.id, 0x6a);
+	if (!send_buffer) {
+		hid_err(t500rs->hdev, "failed uploading constant effect\n");
+		return -ENOSPC;
+	}
 
 	send_buffer[3] = level & 0xff;
 	send_buffer[4] = level >> 8;
+	state->next.level = level;
 
-	t500rs_fill_envelope(send_buffer, 5, level,
-			duration, &constant.envelope);
+	t500rs_envelope_values(state->next.envelope, level, duration,
+			&constant.envelope);
+	t500rs_fill_envelope(send_buffer, 5, state->next.envelope);
 
 	send_buffer[14] = 0x4f;
 
@@ -638,47 +676,34 @@ static int t500rs_upload_constant(struct t500rs_device_entry *t500rs,
 	send_buffer[22] = 0xff;
 	send_buffer[23] = 0xff;
 
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-	if (ret)
-		hid_err(t500rs->hdev, "failed uploading constant effect\n");
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
 static int t500rs_upload_ramp(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	u8 *send_buffer = t500rs->send_buffer;
 	struct ff_effect effect = state->effect;
 	struct ff_ramp_effect ramp = state->effect.u.ramp;
-	int ret, trans;
+	u8 *send_buffer;
 	u16 difference, offset, top, bottom, duration;
 	s16 level;
 
-	if (test_bit(FF_EFFECT_PLAYING, &state->flags)	&&
-		test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
-
-		__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-
-		return t500rs_modify_ramp(t500rs, state, send_buffer);
-	}
-
-	if (effect.replay.length == 0)
-		duration = 0xffff;
-	else
-		duration = effect.replay.length;
+	duration = t500rs_duration(&effect);
 
 	top = ramp.end_level > ramp.start_level ? ramp.end_level : ramp.start_level;
 	bottom = ramp.end_level > ramp.start_level ? ramp.start_level : ramp.end_level;
 
-
-	difference = ((top - bottom) * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
-	level = (top * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	difference = tmff2_scale(top - bottom, tmff2_projection(state));
+	level = tmff2_scale(top, tmff2_projection(state));
 	offset = effect.replay.delay;
 
-
-	send_buffer[1] = effect.id + 1;
-	send_buffer[2] = 0x6b;
+	send_buffer = t500rs_packet_next(packets, effect.id, 0x6b);
+	if (!send_buffer) {
+		hid_err(t500rs->hdev, "failed uploading ramp\n");
+		return -ENOSPC;
+	}
 
 	send_buffer[3] = difference & 0xff;
 	send_buffer[4] = difference >> 8;
@@ -691,8 +716,9 @@ static int t500rs_upload_ramp(struct t500rs_device_entry *t500rs,
 
 	send_buffer[12] = 0x80;
 
-	t500rs_fill_envelope(send_buffer, 13, level,
-			effect.replay.length, &ramp.envelope);
+	t500rs_envelope_values(state->next.envelope, level, duration,
+			&ramp.envelope);
+	t500rs_fill_envelope(send_buffer, 13, state->next.envelope);
 
 	send_buffer[22] = ramp.end_level > ramp.start_level ? 0x04 : 0x05;
 	send_buffer[23] = 0x4f;
@@ -706,47 +732,41 @@ static int t500rs_upload_ramp(struct t500rs_device_entry *t500rs,
 	send_buffer[31] = 0xff;
 	send_buffer[32] = 0xff;
 
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-	if (ret)
-		hid_err(t500rs->hdev, "failed uploading ramp");
+	state->next.values[T500RS_MOD_DIFFERENCE] = difference;
+	state->next.values[T500RS_MOD_LEVEL] = level;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
-static int t500rs_upload_spring(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+/* springs, dampers, friction and inertia only differ in which level they're
+ * scaled by and the values following the deadband */
+static int t500rs_upload_condition(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets,
+		int input_level, const u8 *values)
 {
-	u8 *send_buffer = t500rs->send_buffer;
 	struct ff_effect effect = state->effect;
 	/* we only care about the first axis */
-	struct ff_condition_effect spring = state->effect.u.condition[0];
-	int ret, trans;
+	struct ff_condition_effect condition = state->effect.u.condition[0];
+	u8 *send_buffer;
 	u16 duration, right_coeff, left_coeff, deadband_right, deadband_left, offset;
 
-	if (test_bit(FF_EFFECT_PLAYING, &state->flags)	&&
-		test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
-
-		__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-
-		return t500rs_modify_damper(t500rs, state, send_buffer);
-	}
-
-	if (effect.replay.length == 0)
-		duration = 0xffff;
-	else
-		duration = effect.replay.length;
-
-	send_buffer[1] = effect.id + 1;
-	send_buffer[2] = 0x64;
+	duration = t500rs_duration(&effect);
 
-	right_coeff = spring.right_coeff * spring_level / 100;
-	left_coeff = spring.left_coeff * spring_level / 100;
+	right_coeff = tmff2_percent(condition.right_coeff, input_level);
+	left_coeff = tmff2_percent(condition.left_coeff, input_level);
 
-	deadband_right = 0xfffe - spring.deadband - spring.center;
-	deadband_left = 0xfffe - spring.deadband + spring.center;
+	deadband_right = 0xfffe - condition.deadband - condition.center;
+	deadband_left = 0xfffe - condition.deadband + condition.center;
 
 	offset = effect.replay.delay;
 
+	send_buffer = t500rs_packet_next(packets, effect.id, 0x64);
+	if (!send_buffer) {
+		hid_err(t500rs->hdev, "failed uploading condition effect\n");
+		return -ENOSPC;
+	}
+
 	send_buffer[3] = right_coeff & 0xff;
 	send_buffer[4] = right_coeff >> 8;
 
@@ -759,7 +779,7 @@ static int t500rs_upload_spring(struct t500rs_device_entry *t500rs,
 	send_buffer[9] = deadband_left & 0xff;
 	send_buffer[10] = deadband_left >> 8;
 
-	memcpy(&send_buffer[11], spring_values, ARRAY_SIZE(spring_values));
+	memcpy(&send_buffer[11], values, ARRAY_SIZE(spring_values));
 	send_buffer[28] = 0x4f;
 
 	send_buffer[29] = duration & 0xff;
@@ -771,133 +791,77 @@ static int t500rs_upload_spring(struct t500rs_device_entry *t500rs,
 	send_buffer[36] = 0xff;
 	send_buffer[37] = 0xff;
 
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-	if (ret)
-		hid_err(t500rs->hdev, "failed uploading spring\n");
+	state->next.values[T500RS_MOD_RIGHT_COEFF] = right_coeff;
+	state->next.values[T500RS_MOD_LEFT_COEFF] = left_coeff;
+	state->next.values[T500RS_MOD_RIGHT_DEADBAND] = deadband_right;
+	state->next.values[T500RS_MOD_LEFT_DEADBAND] = deadband_left;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
-static int t500rs_upload_damper(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+static int t500rs_upload_spring(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
 {
-	u8 *send_buffer = t500rs->send_buffer;
-	struct ff_effect effect = state->effect;
-	/* we only care about the first axis */
-	struct ff_condition_effect spring = state->effect.u.condition[0];
-	int ret, trans, input_level;
-	u16 duration, right_coeff, left_coeff, deadband_right, deadband_left, offset;
+	return t500rs_upload_condition(t500rs, state, packets,
+			tmff2_condition_level(t500rs->tmff2,
+				t500rs->tmff2->spring_level), spring_values);
+}
 
-	if (test_bit(FF_EFFECT_PLAYING, &state->flags)	&&
-		test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
+static int t500rs_upload_damper(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
+{
+	int input_level = t500rs->tmff2->damper_level;
 
-		__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
+	if (state->effect.type == FF_FRICTION)
+		input_level = t500rs->tmff2->friction_level;
 
-		return t500rs_modify_damper(t500rs, state, send_buffer);
-	}
+	return t500rs_upload_condition(t500rs, state, packets,
+			tmff2_condition_level(t500rs->tmff2, input_level),
+			damper_values);
+}
 
-	if (effect.replay.length == 0)
-		duration = 0xffff;
-	else
-		duration = effect.replay.length;
+static int t500rs_upload_periodic(struct t500rs_device_entry *t500rs,
+		struct tmff2_effect_state *state, struct tmff2_packets *packets)
+{
+	struct ff_effect effect = state->effect;
+	struct ff_periodic_effect periodic = state->effect.u.periodic;
+	u8 *send_buffer;
+	u16 duration, magnitude, phase, period, offset;
+	s16 periodic_offset;
 
-	input_level = damper_level;
-	if (state->effect.type == FF_FRICTION)
-		input_level = friction_level;
+	duration = t500rs_duration(&effect);
 
-
-	send_buffer[1] = effect.id + 1;
-	send_buffer[2] = 0x64;
-
-	right_coeff = spring.right_coeff * input_level / 100;
-	left_coeff = spring.left_coeff * input_level / 100;
-
-	deadband_right = 0xfffe - spring.deadband - spring.center;
-	deadband_left = 0xfffe - spring.deadband + spring.center;
-
-	offset = effect.replay.delay;
-
-	send_buffer[3] = right_coeff & 0xff;
-	send_buffer[4] = right_coeff >> 8;
-
-	send_buffer[5] = left_coeff & 0xff;
-	send_buffer[6] = left_coeff >> 8;
-
-	send_buffer[7] = deadband_right & 0xff;
-	send_buffer[8] = deadband_right >> 8;
-
-	send_buffer[9] = deadband_left & 0xff;
-	send_buffer[10] = deadband_left >> 8;
-
-	memcpy(&send_buffer[11], damper_values, ARRAY_SIZE(damper_values));
-	send_buffer[28] = 0x4f;
-
-	send_buffer[29] = duration & 0xff;
-	send_buffer[30] = duration >> 8;
-
-	send_buffer[33] = offset & 0xff;
-	send_buffer[34] = offset >> 8;
-
-	send_buffer[36] = 0xff;
-	send_buffer[37] = 0xff;
-
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-	if (ret)
-		hid_err(t500rs->hdev, "failed uploading spring\n");
-
-	return ret;
-}
-
-static int t500rs_upload_periodic(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
-{
-	u8 *send_buffer = t500rs->send_buffer;
-	struct ff_effect effect = state->effect;
-	struct ff_periodic_effect periodic = state->effect.u.periodic;
-	int ret, trans;
-	u16 duration, magnitude, phase, period, offset;
-	s16 periodic_offset;
-
-	if (test_bit(FF_EFFECT_PLAYING, &state->flags)	&&
-		test_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags)) {
-
-		__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-
-		return t500rs_modify_periodic(t500rs, state, send_buffer);
-	}
-
-	if (effect.replay.length == 0)
-		duration = 0xffff;
-	else
-		duration = effect.replay.length;
-
-	magnitude = (periodic.magnitude * fixp_sin16(effect.direction * 360 / 0x10000)) / 0x7fff;
+	magnitude = tmff2_scale(periodic.magnitude, tmff2_projection(state));
 
 	phase = periodic.phase;
 	periodic_offset = periodic.offset;
 	period = periodic.period;
 	offset = effect.replay.delay;
 
-
-	send_buffer[1] = effect.id + 1;
-	send_buffer[2] = 0x6b;
+	send_buffer = t500rs_packet_next(packets, effect.id, 0x6b);
+	if (!send_buffer) {
+		hid_err(t500rs->hdev, "failed uploading periodic effect\n");
+		return -ENOSPC;
+	}
 
 	send_buffer[3] = magnitude & 0xff;
 	send_buffer[4] = magnitude >> 8;
 
-	send_buffer[7] = phase & 0xff;
-	send_buffer[8] = phase >> 8;
-
 	send_buffer[5] = periodic_offset & 0xff;
 	send_buffer[6] = periodic_offset >> 8;
 
+	send_buffer[7] = phase & 0xff;
+	send_buffer[8] = phase >> 8;
+
 	send_buffer[9] = period & 0xff;
 	send_buffer[10] = period >> 8;
 
 	send_buffer[12] = 0x80;
 
-	t500rs_fill_envelope(send_buffer, 13, magnitude,
-			effect.replay.length, &periodic.envelope);
+	t500rs_envelope_values(state->next.envelope, magnitude, duration,
+			&periodic.envelope);
+	t500rs_fill_envelope(send_buffer, 13, state->next.envelope);
 
 	send_buffer[21] = periodic.waveform - 0x57;
 	send_buffer[22] = 0x4f;
@@ -911,379 +875,80 @@ static int t500rs_upload_periodic(struct t500rs_device_entry *t500rs,
 	send_buffer[30] = 0xff;
 	send_buffer[31] = 0xff;
 
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-	if (ret)
-		hid_err(t500rs->hdev, "failed uploading periodic effect");
+	state->next.values[T500RS_MOD_MAGNITUDE] = magnitude;
+	state->next.values[T500RS_MOD_OFFSET] = periodic_offset;
+	state->next.values[T500RS_MOD_PHASE] = phase;
+	state->next.values[T500RS_MOD_PERIOD] = period;
+	state->next.duration = duration;
 
-	return ret;
+	return 0;
 }
 
-static int t500rs_upload_effect(struct t500rs_device_entry *t500rs,
-		struct t500rs_effect_state *state)
+static int t500rs_upload_effect(void *data, struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
+	struct t500rs_device_entry *t500rs = data;
+
 	switch (state->effect.type) {
 	case FF_CONSTANT:
-		return t500rs_upload_constant(t500rs, state);
+		return t500rs_upload_constant(t500rs, state, packets);
 	case FF_RAMP:
-		return t500rs_upload_ramp(t500rs, state);
+		return t500rs_upload_ramp(t500rs, state, packets);
 	case FF_SPRING:
-		return t500rs_upload_spring(t500rs, state);
+		return t500rs_upload_spring(t500rs, state, packets);
 	case FF_DAMPER:
 	case FF_FRICTION:
 	case FF_INERTIA:
-		return t500rs_upload_damper(t500rs, state);
+		return t500rs_upload_damper(t500rs, state, packets);
 	case FF_PERIODIC:
-		return t500rs_upload_periodic(t500rs, state);
+		return t500rs_upload_periodic(t500rs, state, packets);
 	default:
 		hid_err(t500rs->hdev, "invalid effect type: %x", state->effect.type);
 		return -1;
 	}
 }
 
-static int t500rs_timer_helper(struct t500rs_device_entry *t500rs)
-{
-	struct t500rs_effect_state *state;
-	unsigned long jiffies_now = JIFFIES2MS(jiffies);
-	int max_count = 0, effect_id, ret;
-
-	for (effect_id = 0; effect_id < T500RS_MAX_EFFECTS; ++effect_id) {
-
-		state = &t500rs->states[effect_id];
-
-		if (test_bit(FF_EFFECT_PLAYING, &state->flags) && state->effect.replay.length) {
-			if ((jiffies_now - state->start_time) >= state->effect.replay.length) {
-				__clear_bit(FF_EFFECT_PLAYING, &state->flags);
-
-				/* lazy bum fix? */
-				__clear_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
-
-				if (state->count)
-					state->count--;
-
-				if (state->count)
-					__set_bit(FF_EFFECT_QUEUE_START, &state->flags);
-			}
-		}
-
-		if (test_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags)) {
-			__clear_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-
-			ret = t500rs_upload_effect(t500rs, state);
-			if (ret) {
-				hid_err(t500rs->hdev, "failed uploading effects");
-				return ret;
-			}
-		}
-
-		if (test_bit(FF_EFFECT_QUEUE_START, &state->flags)) {
-			__clear_bit(FF_EFFECT_QUEUE_START, &state->flags);
-			__set_bit(FF_EFFECT_PLAYING, &state->flags);
-
-			ret = t500rs_play_effect(t500rs, state);
-			if (ret) {
-				hid_err(t500rs->hdev, "failed starting effects\n");
-				return ret;
-			}
-
-		}
-
-		if (test_bit(FF_EFFECT_QUEUE_STOP, &state->flags)) {
-			__clear_bit(FF_EFFECT_QUEUE_STOP, &state->flags);
-			__clear_bit(FF_EFFECT_PLAYING, &state->flags);
-
-			ret = t500rs_stop_effect(t500rs, state);
-			if (ret) {
-				hid_err(t500rs->hdev, "failed stopping effect\n");
-				return ret;
-			}
-		}
-
-		if (state->count > max_count)
-			max_count = state->count;
-	}
-
-	return max_count;
-}
-
-static enum hrtimer_restart t500rs_timer(struct hrtimer *t)
-{
-	struct t500rs_device_entry *t500rs = container_of(t, struct t500rs_device_entry, hrtimer);
-	int max_count;
-
-	max_count = t500rs_timer_helper(t500rs);
-
-	if (max_count > 0) {
-		hrtimer_forward_now(&t500rs->hrtimer, ms_to_ktime(timer_msecs));
-		return HRTIMER_RESTART;
-	} else {
-		return HRTIMER_NORESTART;
-	}
-}
-
-static int t500rs_upload(struct input_dev *dev,
-		struct ff_effect *effect, struct ff_effect *old)
-{
-	struct hid_device *hdev = input_get_drvdata(dev);
-	struct t500rs_device_entry *t500rs;
-	struct t500rs_effect_state *state;
-
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return -1;
-	}
-
-	if (effect->type == FF_PERIODIC && effect->u.periodic.period == 0)
-		return -EINVAL;
-
-	state = &t500rs->states[effect->id];
-
-	spin_lock_irqsave(&t500rs->lock, t500rs->lock_flags);
-
-	state->effect = *effect;
-
-	if (old) {
-		state->old = *old;
-		__set_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
-	} else {
-		__clear_bit(FF_EFFECT_QUEUE_UPDATE, &state->flags);
-	}
-	__set_bit(FF_EFFECT_QUEUE_UPLOAD, &state->flags);
-
-	spin_unlock_irqrestore(&t500rs->lock, t500rs->lock_flags);
-
-	return 0;
-}
-
-static int t500rs_play(struct input_dev *dev, int effect_id, int value)
-{
-	struct hid_device *hdev = input_get_drvdata(dev);
-	struct t500rs_device_entry *t500rs;
-	struct t500rs_effect_state *state;
-
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return -1;
-	}
-
-	state = &t500rs->states[effect_id];
-
-	if (&state->effect == 0)
-		return 0;
-
-	spin_lock_irqsave(&t500rs->lock, t500rs->lock_flags);
-
-	if (value > 0) {
-		state->count = value;
-		state->start_time = JIFFIES2MS(jiffies);
-		__set_bit(FF_EFFECT_QUEUE_START, &state->flags);
-
-		if (test_bit(FF_EFFECT_QUEUE_STOP, &state->flags))
-			__clear_bit(FF_EFFECT_QUEUE_STOP, &state->flags);
-
-	} else {
-		__set_bit(FF_EFFECT_QUEUE_STOP, &state->flags);
-	}
-
-	if (!hrtimer_active(&t500rs->hrtimer))
-		hrtimer_start(&t500rs->hrtimer, ms_to_ktime(timer_msecs), HRTIMER_MODE_REL);
-
-	spin_unlock_irqrestore(&t500rs->lock, t500rs->lock_flags);
-	return 0;
-}
-
-static ssize_t spring_level_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t count)
-{
-	struct hid_device *hdev = to_hid_device(dev);
-	unsigned int value;
-    int ret;
-
-	ret = kstrtouint(buf, 0, &value);
-    if (ret) {
-        hid_err(hdev, "kstrtouint failed at spring_level_store: %i", ret);
-        return ret;
-    }
-
-	if (value > 100)
-		value = 100;
-
-	spring_level = value;
-
-	return count;
-}
-static ssize_t spring_level_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
-{
-	size_t count;
-
-	count = scnprintf(buf, PAGE_SIZE, "%u\n", spring_level);
-
-	return count;
-}
-
-static DEVICE_ATTR_RW(spring_level);
-
-static ssize_t damper_level_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t count)
-{
-	struct hid_device *hdev = to_hid_device(dev);
-	unsigned int value;
-    int ret;
-
-	ret = kstrtouint(buf, 0, &value);
-    if (ret) {
-        hid_err(hdev, "kstrtouint failed at damper_level_store: %i", ret);
-        return ret;
-    }
-
-	if (value > 100)
-		value = 100;
-
-	damper_level = value;
-
-	return count;
-}
-
-static ssize_t damper_level_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
-{
-	size_t count;
-
-	count = scnprintf(buf, PAGE_SIZE, "%u\n", damper_level);
-
-	return count;
-}
-
-static DEVICE_ATTR_RW(damper_level);
-
-static ssize_t friction_level_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t count)
-{
-	struct hid_device *hdev = to_hid_device(dev);
-	unsigned int value;
-    int ret;
-
-	ret = kstrtouint(buf, 0, &value);
-    if (ret) {
-        hid_err(hdev, "kstrtouint failed at friction_level_store: %i", ret);
-        return ret;
-    }
-
-	if (value > 100)
-		value = 100;
-
-	friction_level = value;
-
-	return count;
-}
-static ssize_t friction_level_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
-{
-	size_t count;
-
-	count = scnprintf(buf, PAGE_SIZE, "%u\n", friction_level);
-
-	return count;
-}
-
-static DEVICE_ATTR_RW(friction_level);
-
-static ssize_t range_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t count)
-{
-	struct hid_device *hdev = to_hid_device(dev);
-	struct t500rs_device_entry *t500rs;
-	u8 *send_buffer;
-	unsigned int range;
-	int ret, trans;
-
-	ret = kstrtouint(buf, 0, &range);
-    if (ret) {
-        hid_err(hdev, "kstrtouint failed at range_store: %i", ret);
-        return ret;
-    }
-
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return -1;
-	}
-
-	send_buffer = t500rs->send_buffer;
-
-	if (range < 40)
-		range = 40;
-
-	if (range > 1080)
-		range = 1080;
-
-	range *= 0x3c;
-
-
-	send_buffer[0] = 0x08;
-	send_buffer[1] = 0x11;
-	send_buffer[2] = range & 0xff;
-	send_buffer[3] = range >> 8;
-
-	ret = t500rs_send_int(t500rs->input_dev, send_buffer, &trans);
-	if (ret) {
-		hid_err(hdev, "failed sending interrupts\n");
-		return -1;
-	}
-
-	t500rs->range = range / 0x3c;
-
-    hid_info(hdev, "Current range is [%i] \n", t500rs->range);
-
-	return count;
-}
-
-static ssize_t range_show(struct device *dev,
-		struct device_attribute *attr, char *buf)
+/* state->next starts out as what the wheel has, so only what changed since
+ * then has to be sent, see t500rs_modify for how changes are grouped */
+static int t500rs_update_effect(void *data, struct tmff2_effect_state *state,
+		struct tmff2_packets *packets)
 {
-	struct hid_device *hdev = to_hid_device(dev);
-	struct t500rs_device_entry *t500rs;
-	size_t count = 0;
+	struct t500rs_device_entry *t500rs = data;
 
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
+	switch (state->effect.type) {
+	case FF_CONSTANT:
+		return t500rs_modify_constant(t500rs, state, packets);
+	case FF_RAMP:
+		return t500rs_modify_ramp(t500rs, state, packets);
+	case FF_SPRING:
+	case FF_DAMPER:
+	case FF_FRICTION:
+	case FF_INERTIA:
+		return t500rs_modify_damper(t500rs, state, packets);
+	case FF_PERIODIC:
+		return t500rs_modify_periodic(t500rs, state, packets);
+	default:
+		hid_err(t500rs->hdev, "invalid effect type: %x", state->effect.type);
 		return -1;
 	}
-
-	count = scnprintf(buf, PAGE_SIZE, "%u\n", t500rs->range);
-	return count;
 }
 
-static DEVICE_ATTR_RW(range);
-
-static void t500rs_set_autocenter(struct input_dev *dev, u16 value)
+static int t500rs_set_autocenter(void *data, uint16_t value)
 {
-	struct hid_device *hdev = input_get_drvdata(dev);
-	struct t500rs_device_entry *t500rs;
-	u8 *send_buffer;
-	int ret, trans;
-
-    hid_info(hdev, "Begin autocenter \n");
-
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return;
-	}
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
+	int ret;
 
-	send_buffer = t500rs->send_buffer;
+	if (!t500rs)
+		return -ENODEV;
 
 	send_buffer[0] = 0x08;
 	send_buffer[1] = 0x04;
 	send_buffer[2] = 0x01;
 
-	ret = t500rs_send_int(dev, send_buffer, &trans);
-	if (ret) {
-		hid_err(hdev, "failed setting autocenter");
-		return;
+	if ((ret = t500rs_send_buf(t500rs, send_buffer))) {
+		hid_err(t500rs->hdev, "failed setting autocenter");
+		return ret;
 	}
 
 	send_buffer[0] = 0x08;
@@ -1292,387 +957,287 @@ static void t500rs_set_autocenter(struct input_dev *dev, u16 value)
 	send_buffer[2] = value & 0xff;
 	send_buffer[3] = value >> 8;
 
-	ret = t500rs_send_int(dev, send_buffer, &trans);
-	if (ret)
-		hid_err(hdev, "failed setting autocenter");
+	if ((ret = t500rs_send_buf(t500rs, send_buffer)))
+		hid_err(t500rs->hdev, "failed setting autocenter");
 
-    hid_info(hdev, "set autocenter \n");
+	return ret;
 }
 
-static void t500rs_set_gain(struct input_dev *dev, u16 gain)
+static int t500rs_set_gain(void *data, uint16_t gain)
 {
-	struct hid_device *hdev = input_get_drvdata(dev);
-	struct t500rs_device_entry *t500rs;
-	u8 *send_buffer;
-	int ret, trans;
-
-    hid_info(hdev, "Starting set gain phase\n");
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
+	int ret;
 
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return;
-	}
+	if (!t500rs)
+		return -ENODEV;
 
-	send_buffer = t500rs->send_buffer;
 	send_buffer[0] = 0x02;
-	send_buffer[1] = SCALE_VALUE_U16(gain, 8);
+	send_buffer[1] = (gain >> 8) & 0xff;
 
-	ret = t500rs_send_int(dev, send_buffer, &trans);
-	if (ret)
-		hid_err(hdev, "failed setting gain: %i\n", ret);
+	if ((ret = t500rs_send_buf(t500rs, send_buffer)))
+		hid_err(t500rs->hdev, "failed setting gain: %i\n", ret);
 
-    hid_info(hdev, "Ending set gain phase\n");
-}
-
-static void t500rs_destroy(struct ff_device *ff)
-{
-	// maybe not necessary?
+	return ret;
 }
 
-static int t500rs_open(struct input_dev *dev)
+static int t500rs_set_range(void *data, uint16_t value)
 {
-	struct t500rs_device_entry *t500rs;
-	struct hid_device *hdev = input_get_drvdata(dev);
-	u8 *send_buffer;
-	int ret, trans;
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
+	uint16_t scaled_value;
+	int ret;
 
-    hid_info(hdev, "Starting open phase\n");
+	if (value < 40) {
+		hid_info(t500rs->hdev, "value %i too small, clamping to 40\n", value);
+		value = 40;
+	}
 
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return -1;
+	if (value > 1080) {
+		hid_info(t500rs->hdev, "value %i too large, clamping to 1080\n", value);
+		value = 1080;
 	}
 
-	send_buffer = t500rs->send_buffer;
+	scaled_value = value * 0x3c;
+	send_buffer[0] = 0x08;
+	send_buffer[1] = 0x11;
+	send_buffer[2] = scaled_value & 0xff;
+	send_buffer[3] = scaled_value >> 8;
 
-	send_buffer[0] = 0x01;
-	send_buffer[1] = 0x05;
+	if ((ret = t500rs_send_buf(t500rs, send_buffer)))
+		hid_warn(t500rs->hdev, "failed setting range\n");
 
-	ret = t500rs_send_int(dev, send_buffer, &trans);
-	if (ret) {
-		hid_err(hdev, "failed sending interrupts\n");
-		goto err;
-	}
-    hid_info(hdev, "Ending open phase\n");
-
-err:
-	return t500rs->open(dev);
+	t500rs->tmff2->range = value;
+	return ret;
 }
 
-static void t500rs_close(struct input_dev *dev)
+static int t500rs_open(void *data)
 {
-	int ret, trans;
-	struct hid_device *hdev = input_get_drvdata(dev);
-	struct t500rs_device_entry *t500rs;
-	u8 *send_buffer;
-
-    hid_info(hdev, "Starting close phase\n");
-
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return;
-	}
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 
-	send_buffer = t500rs->send_buffer;
+	if (!t500rs)
+		return -ENODEV;
 
 	send_buffer[0] = 0x01;
+	send_buffer[1] = 0x05;
 
-	ret = t500rs_send_int(dev, send_buffer, &trans);
-	if (ret) {
-		hid_err(hdev, "failed sending interrupts\n");
-		goto err;
-	}
-    hid_info(hdev, "Ending close phase... ok\n");
-err:
-	t500rs->close(dev);
+	if (t500rs_send_buf(t500rs, send_buffer))
+		hid_warn(t500rs->hdev, "failed sending open command\n");
+
+	return t500rs->open(t500rs->input_dev);
 }
 
-static int t500rs_create_files(struct hid_device *hdev)
+static int t500rs_close(void *data)
 {
-	int ret, ret2, ret3, ret4;
-
-    hid_info(hdev, "Before creation of files\n");
-
-	ret = device_create_file(&hdev->dev, &dev_attr_range);
-    hid_info(hdev, "Creation of range file [%i]\n", ret);
-	if (ret) {
-		hid_warn(hdev, "unable to create sysfs interface for range\n");
-		goto attr_range_err;
-	}
+	struct t500rs_device_entry *t500rs = data;
+	u8 send_buffer[TMFF2_PACKET_SIZE] = {0};
 
-	ret2 = device_create_file(&hdev->dev, &dev_attr_spring_level);
-    hid_info(hdev, "Creation of spring file [%i]\n", ret2);
-	if (ret2) {
-		hid_warn(hdev, "unable to create sysfs interface for spring_level\n");
-		goto attr_spring_err;
-	}
+	if (!t500rs)
+		return -ENODEV;
 
-	ret3 = device_create_file(&hdev->dev, &dev_attr_damper_level);
-    hid_info(hdev, "Creation of damper file [%i]\n", ret3);
-	if (ret3) {
-		hid_warn(hdev, "unable to create sysfs interface for damper_level\n");
-		goto attr_damper_err;
-	}
+	send_buffer[0] = 0x01;
 
-	ret4 = device_create_file(&hdev->dev, &dev_attr_friction_level);
-    hid_info(hdev, "Creation of friction file [%i]\n", ret4);
-	if (ret4) {
-		hid_warn(hdev, "unable to create sysfs interface for friction_level\n");
-		goto attr_friction_err;
-	}
+	if (t500rs_send_buf(t500rs, send_buffer))
+		hid_warn(t500rs->hdev, "failed sending close command\n");
 
-	return ret && ret2 && ret3 && ret4;
-
-	// if the creation of dev_attr_friction fails, we don't need to remove it
-	// device_remove_file(&hdev->dev, &dev_attr_friction_level);
-attr_friction_err:
-	device_remove_file(&hdev->dev, &dev_attr_damper_level);
-attr_damper_err:
-	device_remove_file(&hdev->dev, &dev_attr_spring_level);
-attr_spring_err:
-	device_remove_file(&hdev->dev, &dev_attr_range);
-attr_range_err:
-	return ret;
+	t500rs->close(t500rs->input_dev);
+	return 0;
 }
 
-static int t500rs_init(struct hid_device *hdev, const signed short *ff_bits)
+static int t500rs_urbs_show(struct seq_file *m, void *unused)
 {
-	struct t500rs_device_entry *t500rs;
-	struct t500rs_data *drv_data;
-	struct list_head *report_list;
-	struct hid_input *hidinput = list_entry(hdev->inputs.next,
-			struct hid_input, list);
-	struct input_dev *input_dev = hidinput->input;
-	struct device *dev = &hdev->dev;
-	struct usb_interface *usbif = to_usb_interface(dev->parent);
-	struct usb_device *usbdev = interface_to_usbdev(usbif);
-	struct ff_device *ff;
-	char range[10] = "1024"; // max
-	int i, ret;
+	struct t500rs_device_entry *t500rs = m->private;
+	unsigned long submitted, completed, waited, timeouts, flags;
+	unsigned int in_flight, in_flight_max;
+	u64 latency_total, latency_max;
+	struct tmff2_hist latency;
+
+	spin_lock_irqsave(&t500rs->pool_lock, flags);
+	in_flight = T500RS_URB_POOL_SIZE - hweight_long(t500rs->pool_free);
+	in_flight_max = t500rs->in_flight_max;
+	submitted = t500rs->submitted;
+	completed = t500rs->completed;
+	waited = t500rs->waited;
+	timeouts = t500rs->timeouts;
+	latency_total = t500rs->latency_total_ns;
+	latency_max = t500rs->latency_max_ns;
+	latency = t500rs->latency;
+	spin_unlock_irqrestore(&t500rs->pool_lock, flags);
+
+	seq_printf(m, "in_flight: %u/%u\n", in_flight, T500RS_URB_POOL_SIZE);
+	seq_printf(m, "in_flight_max: %u\n", in_flight_max);
+	seq_printf(m, "submitted: %lu\n", submitted);
+	seq_printf(m, "completed: %lu\n", completed);
+	seq_printf(m, "waited: %lu\n", waited);
+	seq_printf(m, "timeouts: %lu\n", timeouts);
+	seq_printf(m, "latency_avg_us: %llu\n",
+			completed ? div64_u64(latency_total, completed) / 1000 : 0);
+	seq_printf(m, "latency_max_us: %llu\n", latency_max / 1000);
+	tmff2_hist_show(m, "latency", &latency);
 
-	drv_data = hid_get_drvdata(hdev);
-	if (!drv_data) {
-		hid_err(hdev, "private driver data not allocated\n");
-		ret = -ENOMEM;
-		goto err;
-	}
-
-	t500rs = kzalloc(sizeof(struct t500rs_device_entry), GFP_KERNEL);
-	if (!t500rs) {
-		ret = -ENOMEM;
-		goto t500rs_err;
-	}
-
-	t500rs->input_dev = input_dev;
-	t500rs->hdev = hdev;
-	t500rs->usbdev = usbdev;
-	t500rs->usbif = usbif;
-
-	t500rs->states = kzalloc(
-			sizeof(struct t500rs_effect_state) * T500RS_MAX_EFFECTS, GFP_KERNEL);
-
-	if (!t500rs->states) {
-		ret = -ENOMEM;
-		goto states_err;
-	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(t500rs_urbs);
 
-	t500rs->send_buffer = kzalloc(T500RS_BUFFER_LENGTH, GFP_KERNEL);
-	if (!t500rs->send_buffer) {
-		ret = -ENOMEM;
-		goto send_err;
-	}
+static void t500rs_debugfs_init(void *data, struct dentry *dir)
+{
+	debugfs_create_file("urbs", 0444, dir, data, &t500rs_urbs_fops);
+}
 
-	t500rs->firmware_response = kzalloc(sizeof(struct t500rs_firmware_response), GFP_KERNEL);
-	if (!t500rs->firmware_response) {
-		ret = -ENOMEM;
-		goto firmware_err;
+static int t500rs_check_firmware(struct t500rs_device_entry *t500rs)
+{
+	int ret;
+	/* the wheel may answer with all of wLength, which is more than we
+	 * care about */
+	struct t500rs_firmware_response *fw_response =
+		kzalloc(t500rs_firmware_request.wLength, GFP_KERNEL);
+
+	if (!fw_response) {
+		hid_err(t500rs->hdev, "could not allocate fw_response\n");
+		return -ENOMEM;
 	}
 
-	// Check firmware version
+	/* Fetch firmware version */
 	ret = usb_control_msg(t500rs->usbdev,
 			usb_rcvctrlpipe(t500rs->usbdev, 0),
 			t500rs_firmware_request.bRequest,
 			t500rs_firmware_request.bRequestType,
 			t500rs_firmware_request.wValue,
 			t500rs_firmware_request.wIndex,
-			t500rs->firmware_response,
+			fw_response,
 			t500rs_firmware_request.wLength,
 			USB_CTRL_SET_TIMEOUT
-			   );
-
-	// Educated guess
-    hid_info(hdev, "Current firmware version: %i", t500rs->firmware_response->firmware_version);
-	if (t500rs->firmware_response->firmware_version < 31 && ret >= 0) {
-		hid_err(t500rs->hdev,
-			"firmware version %i is too old, please update.",
-			t500rs->firmware_response->firmware_version
 			);
 
-		hid_info(t500rs->hdev, "note: this has to be done through Windows.");
-
-		ret = -EINVAL;
+	if (ret < 0) {
+		hid_err(t500rs->hdev, "could not fetch firmware version: %i\n", ret);
 		goto out;
 	}
 
-	spin_lock_init(&t500rs->lock);
-
-	drv_data->device_props = t500rs;
-
-	report_list = &hdev->report_enum[HID_OUTPUT_REPORT].report_list;
-
-	// because we set the rdesc, we know exactly which report and field to use
-	t500rs->report = list_entry(report_list->next, struct hid_report, list);
-	t500rs->ff_field = t500rs->report->field[0];
-
-	// set ff capabilities
-	for (i = 0; ff_bits[i] >= 0; ++i)
-		__set_bit(ff_bits[i], input_dev->ffbit);
-
-	ret = input_ff_create(input_dev, T500RS_MAX_EFFECTS);
-	if (ret) {
-		hid_err(hdev, "could not create input_ff\n");
+	if (ret < offsetofend(struct t500rs_firmware_response, firmware_version)) {
+		hid_err(t500rs->hdev, "short firmware version response: %i bytes\n", ret);
+		ret = -EPROTO;
 		goto out;
 	}
 
-	ff = input_dev->ff;
-	ff->upload = t500rs_upload;
-	ff->playback = t500rs_play;
-	ff->set_gain = t500rs_set_gain;
-	ff->set_autocenter = t500rs_set_autocenter;
-	ff->destroy = t500rs_destroy;
+	hid_info(t500rs->hdev, "current firmware version: %i\n",
+			fw_response->firmware_version);
 
-	t500rs->open = input_dev->open;
-	t500rs->close = input_dev->close;
+	/* Educated guess */
+	if (fw_response->firmware_version < 31) {
+		hid_err(t500rs->hdev,
+				"firmware version %i is too old, please update.\n",
+				fw_response->firmware_version
+		       );
 
-	input_dev->open = t500rs_open;
-	input_dev->close = t500rs_close;
+		hid_info(t500rs->hdev, "note: this has to be done through Windows.\n");
 
-    hid_info(hdev, "Before create files\n");
-	ret = t500rs_create_files(hdev);
-	if (ret) {
-		// this might not be a catastrophic issue, but it could affect
-		// programs such as oversteer, best play it safe
-		hid_err(hdev, "could not create sysfs files\n");
+		ret = -EINVAL;
 		goto out;
 	}
-    hid_info(hdev, "After create files\n");
-
-    hid_info(hdev, "Before timer init\n");
-	hrtimer_init(&t500rs->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	t500rs->hrtimer.function = t500rs_timer;
 
-    hid_info(hdev, "Before range store\n");
-	range_store(dev, &dev_attr_range, range, 10);
-	t500rs_set_gain(input_dev, 0xffff);
-
-	hid_info(hdev, "force feedback for t500rs\n");
-	return 0;
+	/* everything OK */
+	ret = 0;
 
 out:
-	kfree(t500rs->firmware_response);
-firmware_err:
-	kfree(t500rs->send_buffer);
-send_err:
-	kfree(t500rs->states);
-states_err:
-	kfree(t500rs);
-t500rs_err:
-	kfree(drv_data);
-err:
-	hid_err(hdev, "failed creating force feedback device\n");
+	kfree(fw_response);
 	return ret;
-
 }
 
-static int t500rs_probe(struct hid_device *hdev, const struct hid_device_id *id)
+static int t500rs_wheel_init(struct tmff2_device_entry *tmff2)
 {
+	struct t500rs_device_entry *t500rs = kzalloc(sizeof(struct t500rs_device_entry), GFP_KERNEL);
+	struct list_head *report_list;
 	int ret;
-	struct t500rs_data *drv_data;
-
-	spin_lock_init(&lock);
 
-	drv_data = kzalloc(sizeof(struct t500rs_data), GFP_KERNEL);
-	if (!drv_data) {
+	if (!t500rs) {
 		ret = -ENOMEM;
-		goto err;
+		goto t500rs_err;
 	}
 
-	drv_data->quirks = id->driver_data;
-	hid_set_drvdata(hdev, (void *)drv_data);
-
-	ret = hid_parse(hdev);
-	if (ret) {
-		hid_err(hdev, "parse failed\n");
-		goto err;
+	/* everything goes through our own urbs */
+	if (!tmff2->is_usb) {
+		hid_err(tmff2->hdev, "T500RS is only supported over usb\n");
+		ret = -ENODEV;
+		goto firmware_err;
 	}
 
-	ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT & ~HID_CONNECT_FF);
-	if (ret) {
-		hid_err(hdev, "hw start failed\n");
-		goto err;
+	t500rs->tmff2 = tmff2;
+	t500rs->hdev = tmff2->hdev;
+	t500rs->input_dev = tmff2->input_dev;
+	t500rs->usbif = to_usb_interface(tmff2->hdev->dev.parent);
+	t500rs->usbdev = interface_to_usbdev(t500rs->usbif);
+
+	if ((ret = t500rs_check_firmware(t500rs)))
+		goto firmware_err;
+
+	report_list = &t500rs->hdev->report_enum[HID_OUTPUT_REPORT].report_list;
+	if (list_empty(report_list)) {
+		hid_err(t500rs->hdev, "no output report found\n");
+		ret = -ENODEV;
+		goto firmware_err;
 	}
 
-	ret = t500rs_init(hdev, (void *)id->driver_data);
-	if (ret) {
-		hid_err(hdev, "t500rs_init failed\n");
-		goto err;
+	t500rs->report = list_entry(report_list->next, struct hid_report, list);
+
+	if ((ret = t500rs_pool_init(t500rs))) {
+		hid_err(t500rs->hdev, "could not allocate urbs\n");
+		goto pool_err;
 	}
+
+	t500rs->open = t500rs->input_dev->open;
+	t500rs->close = t500rs->input_dev->close;
+
+	/* everything went OK */
+	tmff2->data = t500rs;
+	tmff2->params = t500rs_params;
+	tmff2->max_effects = T500RS_MAX_EFFECTS;
+	memcpy(tmff2->supported_effects, t500rs_effects, sizeof(t500rs_effects));
+
+	hid_info(t500rs->hdev, "force feedback for T500RS\n");
 	return 0;
-err:
+
+pool_err:
+	t500rs_pool_destroy(t500rs);
+firmware_err:
+	kfree(t500rs);
+t500rs_err:
+	hid_err(tmff2->hdev, "failed initializing T500RS\n");
 	return ret;
 }
 
-static void t500rs_remove(struct hid_device *hdev)
+static int t500rs_wheel_destroy(void *data)
 {
-	struct t500rs_device_entry *t500rs;
-	struct t500rs_data *drv_data;
-
-	drv_data = hid_get_drvdata(hdev);
-	t500rs = t500rs_get_device(hdev);
-	if (!t500rs) {
-		hid_err(hdev, "could not get device\n");
-		return;
-	}
-
-	hrtimer_cancel(&t500rs->hrtimer);
+	struct t500rs_device_entry *t500rs = data;
 
-	device_remove_file(&hdev->dev, &dev_attr_range);
-	device_remove_file(&hdev->dev, &dev_attr_spring_level);
-	device_remove_file(&hdev->dev, &dev_attr_damper_level);
-	device_remove_file(&hdev->dev, &dev_attr_friction_level);
+	if (!t500rs)
+		return -ENODEV;
 
-	hid_hw_stop(hdev);
-	kfree(t500rs->states);
-	kfree(t500rs->send_buffer);
-	kfree(t500rs->firmware_response);
+	t500rs_pool_destroy(t500rs);
 	kfree(t500rs);
-	kfree(drv_data);
+	return 0;
 }
 
-static __u8 *t500rs_report_fixup(struct hid_device *hdev, __u8 *rdesc, unsigned int *rsize)
+int t500rs_populate_api(struct tmff2_device_entry *tmff2)
 {
-	rdesc = t500rs_rdesc_fixed;
-	*rsize = sizeof(t500rs_rdesc_fixed);
-	return rdesc;
-}
+	tmff2->play_effect = t500rs_play_effect;
+	tmff2->upload_effect = t500rs_upload_effect;
+	tmff2->update_effect = t500rs_update_effect;
+	tmff2->stop_effect = t500rs_stop_effect;
+	tmff2->send_packet = t500rs_send_packet;
+	tmff2->async_send = 1;
 
-static const struct hid_device_id t500rs_devices[] = {
-	{HID_USB_DEVICE(USB_VENDOR_ID_THRUSTMASTER, 0xb65e),
-		.driver_data = (unsigned long)t500rs_ff_effects},
-	{}
-};
-MODULE_DEVICE_TABLE(hid, t500rs_devices);
-
-static struct hid_driver t500rs_driver = {
-	.name = "t500rs",
-	.id_table = t500rs_devices,
-	.probe = t500rs_probe,
-	.remove = t500rs_remove,
-	.report_fixup = t500rs_report_fixup,
-};
-module_hid_driver(t500rs_driver);
+	tmff2->set_gain = t500rs_set_gain;
+	tmff2->set_autocenter = t500rs_set_autocenter;
+	tmff2->set_range = t500rs_set_range;
+	tmff2->debugfs_init = t500rs_debugfs_init;
+
+	tmff2->open = t500rs_open;
+	tmff2->close = t500rs_close;
+
+	tmff2->wheel_init = t500rs_wheel_init;
+	tmff2->wheel_destroy = t500rs_wheel_destroy;
 
-MODULE_LICENSE("GPL");
+	return 0;
+}
@@ -0,0 +1,570 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Userspace benchmark of the effect paths, built against the shim in shim/.
+ * The wheel is a fake hid device on a virtual bus, so every packet goes
+ * through hid_hw_output_report() to bench_output_report() and is only
+ * counted. Time inside the driver is virtual and only moves when we say so,
+ * the numbers reported are real time around the calls into the driver. */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <linux/hid.h>
+#include "hid-tmff2.h"
+
+int shim_module_init(void);
+void shim_module_exit(void);
+
+static const struct bench_wheel {
+	const char *name;
+	u32 product;
+	/* the output report id in the driver's rdesc */
+	unsigned int report_id;
+} bench_wheels[] = {
+	{ "t300rs", TMT300RS_PS3_NORM_ID, 0x60 },
+	{ "t248", TMT248_PC_ID, 0x60 },
+};
+
+static void bench_fill_constant(struct ff_effect *effect, int round)
+{
+	effect->u.constant.level = round & 1 ? 0x2000 : 0x3000;
+}
+
+static void bench_fill_periodic(struct ff_effect *effect, int round)
+{
+	effect->u.periodic.waveform = FF_SINE;
+	effect->u.periodic.period = 100;
+	effect->u.periodic.magnitude = round & 1 ? 0x2000 : 0x3000;
+}
+
+static void bench_fill_ramp(struct ff_effect *effect, int round)
+{
+	effect->u.ramp.start_level = round & 1 ? 0x1000 : 0x2000;
+	effect->u.ramp.end_level = -effect->u.ramp.start_level;
+}
+
+static void bench_fill_condition(struct ff_effect *effect, int round)
+{
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		effect->u.condition[i].right_saturation = 0xffff;
+		effect->u.condition[i].left_saturation = 0xffff;
+		effect->u.condition[i].right_coeff = round & 1 ? 0x2000 : 0x3000;
+		effect->u.condition[i].left_coeff = round & 1 ? 0x2000 : 0x3000;
+	}
+}
+
+static const struct bench_type {
+	const char *name;
+	__u16 type;
+	void (*fill)(struct ff_effect *effect, int round);
+} bench_types[] = {
+	{ "constant", FF_CONSTANT, bench_fill_constant },
+	{ "periodic", FF_PERIODIC, bench_fill_periodic },
+	{ "ramp", FF_RAMP, bench_fill_ramp },
+	{ "spring", FF_SPRING, bench_fill_condition },
+	{ "damper", FF_DAMPER, bench_fill_condition },
+	{ "friction", FF_FRICTION, bench_fill_condition },
+	{ "inertia", FF_INERTIA, bench_fill_condition },
+};
+
+static const int bench_counts[] = { 1, 2, 4, 8, 16 };
+
+/* with -c, how many of the playing effects a round updates, the others just
+ * keep playing */
+static int bench_changed;
+
+struct bench_device {
+	struct hid_device hdev;
+	struct hid_report report;
+	struct hid_field field;
+	struct hid_input hidinput;
+	struct input_dev input;
+	s32 values[64];
+};
+
+static unsigned long bench_packets;
+
+/* what the wheel makes of the packets, for the -m comparison. Only
+ * constant forces are tracked by level, a periodic is rendered from when
+ * the wheel started it */
+#define BENCH_SLOTS 16
+
+static struct bench_wheel_state {
+	s16 level[BENCH_SLOTS];
+	bool periodic[BENCH_SLOTS];
+	bool playing[BENCH_SLOTS];
+	ktime_t start[BENCH_SLOTS];
+	/* the wheel only takes the high byte */
+	unsigned int gain;
+} bench_wheel;
+
+static void bench_decode(const __u8 *buf, size_t len)
+{
+	int id;
+
+	if (len && buf[0] == 0x60) {
+		buf++;
+		len--;
+	}
+
+	if (len >= 2 && buf[0] == 0x02) {
+		bench_wheel.gain = buf[1];
+		return;
+	}
+
+	if (len < 5 || buf[0] || buf[1] < 1 || buf[1] > BENCH_SLOTS)
+		return;
+
+	id = buf[1] - 1;
+	switch (buf[2]) {
+	case 0x6a:
+	case 0x0a:
+		bench_wheel.level[id] = buf[3] | buf[4] << 8;
+		bench_wheel.periodic[id] = false;
+		break;
+	case 0x6b:
+		bench_wheel.periodic[id] = true;
+		break;
+	case 0x89:
+		bench_wheel.playing[id] = buf[3];
+		bench_wheel.start[id] = shim_now;
+		break;
+	}
+}
+
+static bool bench_wheel_playing(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_SLOTS; ++i)
+		if (bench_wheel.playing[i])
+			return true;
+
+	return false;
+}
+
+/* the fake transport, nothing leaves the process */
+static int bench_output_report(struct hid_device *hdev, __u8 *buf, size_t len)
+{
+	bench_packets++;
+	bench_decode(buf, len);
+	return len;
+}
+
+/* what hid-input would have set, the driver chains to it */
+static int bench_input_open(struct input_dev *input)
+{
+	return 0;
+}
+
+static void bench_input_close(struct input_dev *input)
+{
+}
+
+static s64 bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* move virtual time on by one timer period and run whatever came due */
+static void bench_tick(void)
+{
+	shim_now += ms_to_ktime(timer_msecs);
+	shim_run_work();
+}
+
+static struct input_dev *bench_probe(struct bench_device *dev,
+		const struct bench_wheel *wheel)
+{
+	struct hid_device_id id = {
+		.bus = BUS_USB,
+		.vendor = USB_VENDOR_ID_THRUSTMASTER,
+		.product = wheel->product,
+	};
+	int i;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->hdev.dev.name = "bench";
+	dev->hdev.bus = BUS_VIRTUAL;
+	dev->hdev.vendor = USB_VENDOR_ID_THRUSTMASTER;
+	dev->hdev.product = wheel->product;
+
+	for (i = 0; i < ARRAY_SIZE(dev->hdev.report_enum); ++i)
+		INIT_LIST_HEAD(&dev->hdev.report_enum[i].report_list);
+	dev->field.value = dev->values;
+	dev->report.id = wheel->report_id;
+	dev->report.field[0] = &dev->field;
+	list_add_tail(&dev->report.list,
+			&dev->hdev.report_enum[HID_OUTPUT_REPORT].report_list);
+
+	INIT_LIST_HEAD(&dev->hdev.inputs);
+	dev->input.dev.parent = &dev->hdev.dev;
+	dev->input.dev.driver_data = &dev->hdev;
+	dev->input.open = bench_input_open;
+	dev->input.close = bench_input_close;
+	dev->hidinput.input = &dev->input;
+	list_add_tail(&dev->hidinput.list, &dev->hdev.inputs);
+
+	if (shim_hid_driver->probe(&dev->hdev, &id))
+		return NULL;
+
+	if (dev->input.open(&dev->input)) {
+		shim_hid_driver->remove(&dev->hdev);
+		return NULL;
+	}
+
+	shim_run_work();
+	return &dev->input;
+}
+
+static void bench_remove(struct bench_device *dev)
+{
+	dev->input.close(&dev->input);
+
+	shim_hid_driver->remove(&dev->hdev);
+	input_ff_destroy(&dev->input);
+	shim_forget_work();
+}
+
+static void bench_effect(struct ff_effect *effect,
+		const struct bench_type *type, int id, int round)
+{
+	memset(effect, 0, sizeof(*effect));
+	effect->type = type->type;
+	effect->id = id;
+	effect->direction = 0x4000;
+	type->fill(effect, round);
+}
+
+struct bench_result {
+	double upload_ns;
+	double update_ns;
+	double tick_ns;
+	double packets;
+};
+
+static int bench_run(const struct bench_wheel *wheel,
+		const struct bench_type *type, int count, int rounds,
+		struct bench_result *result)
+{
+	struct ff_effect effects[16], old;
+	struct bench_device dev;
+	struct input_dev *input;
+	struct ff_device *ff;
+	s64 upload = 0, update = 0, tick = 0, start;
+	unsigned long packets;
+	int round, i, changed, ret = -EIO;
+
+	if (!(input = bench_probe(&dev, wheel)))
+		return -ENODEV;
+	ff = input->ff;
+
+	/* uploads of new effects, torn down again between rounds */
+	for (round = 0; round < rounds; ++round) {
+		for (i = 0; i < count; ++i)
+			bench_effect(&effects[i], type, i, round);
+
+		start = bench_ns();
+		for (i = 0; i < count; ++i)
+			if (ff->upload(input, &effects[i], NULL))
+				goto out;
+		upload += bench_ns() - start;
+
+		for (i = 0; i < count; ++i)
+			ff->playback(input, i, 1);
+		bench_tick();
+
+		for (i = 0; i < count; ++i) {
+			ff->playback(input, i, 0);
+			ff->erase(input, i);
+		}
+		bench_tick();
+	}
+
+	/* updates of playing effects, and the ticks that send them */
+	for (i = 0; i < count; ++i) {
+		bench_effect(&effects[i], type, i, 0);
+		if (ff->upload(input, &effects[i], NULL))
+			goto out;
+		ff->playback(input, i, 1);
+	}
+	bench_tick();
+
+	changed = bench_changed ? min(bench_changed, count) : count;
+	packets = bench_packets;
+	for (round = 1; round <= rounds; ++round) {
+		start = bench_ns();
+		for (i = 0; i < changed; ++i) {
+			old = effects[i];
+			bench_effect(&effects[i], type, i, round);
+			if (ff->upload(input, &effects[i], &old))
+				goto out;
+		}
+		update += bench_ns() - start;
+
+		shim_now += ms_to_ktime(timer_msecs);
+		start = bench_ns();
+		shim_run_work();
+		tick += bench_ns() - start;
+	}
+	packets = bench_packets - packets;
+
+	result->upload_ns = (double)upload / ((double)rounds * count);
+	result->update_ns = (double)update / ((double)rounds * changed);
+	result->tick_ns = (double)tick / rounds;
+	result->packets = (double)packets / rounds;
+	ret = 0;
+
+out:
+	bench_remove(&dev);
+	return ret;
+}
+
+/* -m: a game layering count constant forces, each updated every frame, over
+ * a sine the way racing games layer road, kerb and engine effects. Once per
+ * millisecond of virtual time the force the wheel puts out, going by the
+ * packets it got, is compared with what the game asked for. Packets reach
+ * the wheel the moment they're sent, how fast a real one takes them is up to
+ * the emulators in tools/emu */
+#define BENCH_MIX_HZ		60
+#define BENCH_MIX_PERIOD	200
+
+static s16 bench_mix_level(int i, int frame)
+{
+	return 0x1800 * sin(2 * M_PI * frame / BENCH_MIX_HZ * (0.5 + 0.3 * i));
+}
+
+static double bench_mix_sine(s64 ms)
+{
+	return 0x2000 * sin(2 * M_PI * (ms % BENCH_MIX_PERIOD) / BENCH_MIX_PERIOD);
+}
+
+/* the sum scaled by the gain, then saturated */
+static double bench_mix_force(double sum, double gain)
+{
+	return fmax(fmin(sum * gain, 0x7fff), -0x7fff);
+}
+
+struct bench_mix_result {
+	double packets;
+	double rms;
+	double max;
+};
+
+static int bench_mix(const struct bench_wheel *wheel, int count, int seconds,
+		int mixing, struct bench_mix_result *result)
+{
+	struct ff_effect effects[BENCH_SLOTS], old;
+	struct bench_device dev;
+	struct input_dev *input;
+	struct ff_device *ff;
+	double ideal, force, error, squares = 0, max = 0;
+	unsigned long packets;
+	ktime_t begin;
+	s64 ms;
+	int i, frame = 0, ret = -EIO;
+
+	memset(&bench_wheel, 0, sizeof(bench_wheel));
+	host_mixing = mixing;
+	input = bench_probe(&dev, wheel);
+	host_mixing = 0;
+	if (!input)
+		return -ENODEV;
+	ff = input->ff;
+
+	for (i = 0; i <= count; ++i) {
+		memset(&effects[i], 0, sizeof(effects[i]));
+		effects[i].id = i;
+		effects[i].direction = 0x4000;
+		if (i < count) {
+			effects[i].type = FF_CONSTANT;
+			effects[i].u.constant.level = bench_mix_level(i, 0);
+		} else {
+			effects[i].type = FF_PERIODIC;
+			effects[i].u.periodic.waveform = FF_SINE;
+			effects[i].u.periodic.period = BENCH_MIX_PERIOD;
+			effects[i].u.periodic.magnitude = 0x2000;
+		}
+
+		if (ff->upload(input, &effects[i], NULL))
+			goto out;
+		ff->playback(input, i, 1);
+	}
+
+	/* how long the first start takes isn't what's compared here, time
+	 * starts once the wheel got it */
+	for (shim_run_work(); !bench_wheel_playing(); shim_run_work())
+		shim_now += ms_to_ktime(1);
+	begin = shim_now;
+	packets = bench_packets;
+
+	for (ms = 0; ms < seconds * 1000; ++ms) {
+		shim_now = begin + ms_to_ktime(ms);
+		if (ms * BENCH_MIX_HZ / 1000 != frame) {
+			frame = ms * BENCH_MIX_HZ / 1000;
+			for (i = 0; i < count; ++i) {
+				old = effects[i];
+				effects[i].u.constant.level = bench_mix_level(i, frame);
+				if (ff->upload(input, &effects[i], &old))
+					goto out;
+			}
+		}
+		shim_run_work();
+
+		ideal = bench_mix_sine(ms);
+		for (i = 0; i < count; ++i)
+			ideal += effects[i].u.constant.level;
+		ideal = bench_mix_force(ideal, (double)gain / GAIN_MAX);
+
+		force = 0;
+		for (i = 0; i < BENCH_SLOTS; ++i) {
+			if (!bench_wheel.playing[i])
+				continue;
+
+			if (bench_wheel.periodic[i])
+				force += bench_mix_sine(ktime_ms_delta(shim_now,
+							bench_wheel.start[i]));
+			else
+				force += bench_wheel.level[i];
+		}
+		force = bench_mix_force(force, bench_wheel.gain / 255.0);
+
+		error = fabs(force - ideal) / 0x7fff;
+		squares += error * error;
+		max = fmax(max, error);
+	}
+
+	result->packets = (double)(bench_packets - packets) / seconds;
+	result->rms = 100 * sqrt(squares / (seconds * 1000));
+	result->max = 100 * max;
+	ret = 0;
+
+out:
+	bench_remove(&dev);
+	return ret;
+}
+
+static int bench_mix_table(const struct bench_wheel *wheel, int seconds)
+{
+	struct bench_mix_result result;
+	int i, mixing;
+
+	printf("wheel %s, %d s at %d Hz, timer_msecs %d, gain %d\n",
+			wheel->name, seconds, BENCH_MIX_HZ, timer_msecs, gain);
+	printf("%-7s %8s %10s %11s %11s\n", "mode", "effects", "packets/s",
+			"rms_error%", "max_error%");
+
+	for (mixing = 0; mixing <= 1; ++mixing) {
+		for (i = 0; i < ARRAY_SIZE(bench_counts) - 1; ++i) {
+			if (bench_mix(wheel, bench_counts[i], seconds, mixing,
+						&result)) {
+				fprintf(stderr, "mixing %d effects failed\n",
+						bench_counts[i]);
+				return 1;
+			}
+
+			/* the sine counts as one more effect */
+			printf("%-7s %8d %10.0f %11.2f %11.2f\n",
+					mixing ? "mixed" : "native",
+					bench_counts[i] + 1, result.packets,
+					result.rms, result.max);
+		}
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-w t300rs|t248] [-r rounds] [-c changed]\n"
+			"          [-m seconds]\n"
+			"  -c  only update this many of the playing effects per round\n"
+			"  -m  compare host_mixing with the wheel mixing instead\n",
+			name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct bench_wheel *wheel = &bench_wheels[0];
+	struct bench_result result;
+	int rounds = 2000, seconds = 0;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "w:r:c:m:h")) != -1) {
+		switch (opt) {
+		case 'w':
+			for (i = 0; i < ARRAY_SIZE(bench_wheels); ++i)
+				if (!strcmp(optarg, bench_wheels[i].name))
+					break;
+			if (i == ARRAY_SIZE(bench_wheels)) {
+				usage(argv[0]);
+				return 1;
+			}
+			wheel = &bench_wheels[i];
+			break;
+		case 'c':
+			bench_changed = atoi(optarg);
+			if (bench_changed > 0)
+				break;
+			usage(argv[0]);
+			return 1;
+		case 'm':
+			seconds = atoi(optarg);
+			if (seconds > 0)
+				break;
+			usage(argv[0]);
+			return 1;
+		case 'r':
+			rounds = atoi(optarg);
+			if (rounds > 0)
+				break;
+			/* fall through */
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	shim_output_report = bench_output_report;
+	if (shim_module_init() || !shim_hid_driver) {
+		fprintf(stderr, "driver didn't register\n");
+		return 1;
+	}
+
+	if (seconds) {
+		i = bench_mix_table(wheel, seconds);
+		shim_module_exit();
+		return i;
+	}
+
+	printf("wheel %s, %d rounds, timer_msecs %d", wheel->name, rounds,
+			timer_msecs);
+	if (bench_changed)
+		printf(", %d updated per round", bench_changed);
+	printf("\n");
+	printf("%-10s %7s %10s %10s %10s %12s\n", "type", "effects",
+			"upload_ns", "update_ns", "tick_ns", "packets/tick");
+
+	for (i = 0; i < ARRAY_SIZE(bench_types); ++i) {
+		for (j = 0; j < ARRAY_SIZE(bench_counts); ++j) {
+			if (bench_run(wheel, &bench_types[i], bench_counts[j],
+						rounds, &result)) {
+				fprintf(stderr, "%s with %d effects failed\n",
+						bench_types[i].name, bench_counts[j]);
+				return 1;
+			}
+
+			printf("%-10s %7d %10.0f %10.0f %10.0f %12.1f\n",
+					bench_types[i].name, bench_counts[j],
+					result.upload_ns, result.update_ns,
+					result.tick_ns, result.packets);
+		}
+	}
+
+	shim_module_exit();
+	return 0;
+}
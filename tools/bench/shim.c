@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-2.0
+/* the parts of the kernel API in shim/ that need more than a macro */
+#define _GNU_SOURCE
+#include <math.h>
+#include <linux/hid.h>
+#include <linux/workqueue.h>
+
+ktime_t shim_now;
+struct hid_driver *shim_hid_driver;
+int (*shim_output_report)(struct hid_device *hdev, __u8 *buf, size_t len);
+
+unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset)
+{
+	unsigned long word;
+
+	while (offset < size) {
+		word = addr[offset / BITS_PER_LONG] >> (offset % BITS_PER_LONG);
+		if (word) {
+			offset += __builtin_ctzl(word);
+			return min(offset, size);
+		}
+		offset = (offset / BITS_PER_LONG + 1) * BITS_PER_LONG;
+	}
+
+	return size;
+}
+
+unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset)
+{
+	for (; offset < size; ++offset) {
+		if (!test_bit(offset, addr))
+			return offset;
+	}
+
+	return size;
+}
+
+int bitmap_empty(const unsigned long *addr, unsigned int bits)
+{
+	return find_first_bit(addr, bits) >= bits;
+}
+
+/* a word at a time, like the kernel's */
+int bitmap_weight(const unsigned long *addr, unsigned int bits)
+{
+	unsigned int i;
+	int weight = 0;
+
+	for (i = 0; i < bits / BITS_PER_LONG; ++i)
+		weight += __builtin_popcountl(addr[i]);
+	if (bits % BITS_PER_LONG)
+		weight += __builtin_popcountl(addr[i] &
+				(~0ul >> (BITS_PER_LONG - bits % BITS_PER_LONG)));
+
+	return weight;
+}
+
+void sort(void *base, size_t num, size_t size,
+		int (*cmp)(const void *, const void *),
+		void (*swap)(void *, void *, int))
+{
+	qsort(base, num, size, cmp);
+}
+
+/* same rounding as the kernel's table */
+s32 fixp_sin32(int degrees)
+{
+	degrees %= 360;
+	if (degrees < 0)
+		degrees += 360;
+
+	return lround(sin(degrees * M_PI / 180) * 0x7fffffff);
+}
+
+char *kasprintf(gfp_t gfp, const char *fmt, ...)
+{
+	va_list args;
+	char *buf;
+
+	va_start(args, fmt);
+	if (vasprintf(&buf, fmt, args) < 0)
+		buf = NULL;
+	va_end(args);
+
+	return buf;
+}
+
+int sysfs_emit(char *buf, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, 4096, fmt, args);
+	va_end(args);
+
+	return len;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	char *end;
+
+	*res = strtoul(s, &end, base);
+	return end == s ? -EINVAL : 0;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+	char *end;
+
+	*res = strtol(s, &end, base);
+	return end == s ? -EINVAL : 0;
+}
+
+int input_ff_create(struct input_dev *dev, unsigned int max_effects)
+{
+	dev->ff = calloc(1, sizeof(*dev->ff));
+	if (!dev->ff)
+		return -ENOMEM;
+
+	dev->ff->max_effects = max_effects;
+	return 0;
+}
+
+void input_ff_destroy(struct input_dev *dev)
+{
+	free(dev->ff);
+	dev->ff = NULL;
+}
+
+/* every work item the driver initialized, so the bench can run them */
+static struct shim_work {
+	struct work_struct *work;
+	struct delayed_work *dwork;
+} shim_works[8];
+static unsigned int shim_work_count;
+
+static void shim_register_work(struct work_struct *work,
+		struct delayed_work *dwork)
+{
+	if (shim_work_count >= ARRAY_SIZE(shim_works)) {
+		fprintf(stderr, "shim: too many work items\n");
+		abort();
+	}
+
+	shim_works[shim_work_count].work = work;
+	shim_works[shim_work_count].dwork = dwork;
+	shim_work_count++;
+}
+
+void shim_init_work(struct work_struct *work, work_func_t func)
+{
+	work->func = func;
+	work->pending = false;
+	shim_register_work(work, NULL);
+}
+
+void shim_init_delayed_work(struct delayed_work *work, work_func_t func)
+{
+	work->work.func = func;
+	work->work.pending = false;
+	shim_register_work(&work->work, work);
+}
+
+struct workqueue_struct *alloc_ordered_workqueue(const char *fmt,
+		unsigned int flags, ...)
+{
+	return calloc(1, sizeof(struct workqueue_struct));
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	shim_run_work();
+	free(wq);
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	if (work->pending)
+		return false;
+
+	work->pending = true;
+	return true;
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *work,
+		unsigned long delay)
+{
+	bool pending = work->work.pending;
+
+	work->due = shim_now + (ktime_t)delay * (NSEC_PER_SEC / HZ);
+	work->work.pending = true;
+	return pending;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *work)
+{
+	bool pending = work->work.pending;
+
+	work->work.pending = false;
+	return pending;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	bool pending = work->pending;
+
+	work->pending = false;
+	return pending;
+}
+
+int shim_run_work(void)
+{
+	struct shim_work *w;
+	int ran, total = 0;
+	unsigned int i;
+
+	do {
+		ran = 0;
+		for (i = 0; i < shim_work_count; ++i) {
+			w = &shim_works[i];
+			if (!w->work->pending
+					|| (w->dwork && w->dwork->due > shim_now))
+				continue;
+
+			w->work->pending = false;
+			w->work->func(w->work);
+			ran++;
+		}
+		total += ran;
+	} while (ran);
+
+	return total;
+}
+
+void shim_forget_work(void)
+{
+	shim_work_count = 0;
+}
+
+ktime_t shim_next_work(void)
+{
+	ktime_t next = KTIME_MAX;
+	unsigned int i;
+
+	for (i = 0; i < shim_work_count; ++i) {
+		if (shim_works[i].dwork && shim_works[i].work->pending)
+			next = min(next, shim_works[i].dwork->due);
+	}
+
+	return next;
+}
@@ -0,0 +1,23 @@
+#ifndef __TMFF2_SHIM_DEBUGFS_H
+#define __TMFF2_SHIM_DEBUGFS_H
+#include "../shim.h"
+#include "seq_file.h"
+
+struct dentry;
+
+static inline struct dentry *debugfs_create_dir(const char *name,
+		struct dentry *parent)
+{
+	return NULL;
+}
+
+static inline struct dentry *debugfs_create_file(const char *name,
+		umode_t mode, struct dentry *parent, void *data,
+		const struct file_operations *fops)
+{
+	return NULL;
+}
+
+static inline void debugfs_remove_recursive(struct dentry *dentry) {}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __TMFF2_SHIM_HID_H
+#define __TMFF2_SHIM_HID_H
+#include "../shim.h"
+#include "input.h"
+
+/* a hid device on a virtual bus, like uhid makes. Output reports go to
+ * shim_output_report */
+#define BUS_USB 0x03
+#define BUS_VIRTUAL 0x06
+#define HID_INPUT_REPORT 0
+#define HID_OUTPUT_REPORT 1
+#define HID_FEATURE_REPORT 2
+#define HID_REQ_SET_REPORT 0x09
+#define HID_CONNECT_DEFAULT 0x3f
+#define HID_CONNECT_FF 0x20
+
+struct hid_field {
+	s32 *value;
+};
+
+struct hid_report {
+	struct list_head list;
+	unsigned int id;
+	struct hid_field *field[1];
+};
+
+struct hid_report_enum {
+	struct list_head report_list;
+};
+
+struct hid_device {
+	struct device dev;
+	u16 bus;
+	u32 vendor;
+	u32 product;
+	unsigned int id;
+	struct hid_report_enum report_enum[3];
+	struct list_head inputs;
+};
+
+struct hid_input {
+	struct list_head list;
+	struct input_dev *input;
+};
+
+struct hid_device_id {
+	u16 bus;
+	u32 vendor;
+	u32 product;
+	unsigned long driver_data;
+};
+
+#define HID_USB_DEVICE(ven, prod) .bus = BUS_USB, .vendor = (ven), .product = (prod)
+
+struct hid_driver {
+	const char *name;
+	const struct hid_device_id *id_table;
+	int (*probe)(struct hid_device *hdev, const struct hid_device_id *id);
+	void (*remove)(struct hid_device *hdev);
+	__u8 *(*report_fixup)(struct hid_device *hdev, __u8 *buf,
+			unsigned int *size);
+};
+
+/* the registered driver and the transport, filled in by the bench */
+extern struct hid_driver *shim_hid_driver;
+extern int (*shim_output_report)(struct hid_device *hdev, __u8 *buf,
+		size_t len);
+
+#define to_hid_device(d) container_of(d, struct hid_device, dev)
+#define hid_get_drvdata(hdev) ((hdev)->dev.driver_data)
+#define hid_set_drvdata(hdev, data) ((hdev)->dev.driver_data = (data))
+#define hid_is_usb(hdev) ((hdev)->bus == BUS_USB)
+#define hid_parse(hdev) ((void)(hdev), 0)
+#define hid_hw_start(hdev, mask) ((void)(hdev), 0)
+#define hid_hw_stop(hdev) ((void)(hdev))
+#define hid_hw_output_report(hdev, buf, len) shim_output_report((hdev), (buf), (len))
+#define hid_hw_request(hdev, report, req) ((void)(hdev), (void)(report))
+#define hid_register_driver(driver) (shim_hid_driver = (driver), 0)
+#define hid_unregister_driver(driver) (shim_hid_driver = NULL)
+#define module_hid_driver(driver)
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __TMFF2_SHIM_KTHREAD_H
+#define __TMFF2_SHIM_KTHREAD_H
+#include "../shim.h"
+#include "workqueue.h"
+
+/* the bench always uses the workqueue, none of these are ever called with
+ * a worker */
+struct kthread_worker {
+	struct task_struct *task;
+};
+
+struct kthread_work {
+	int unused;
+};
+
+struct kthread_delayed_work {
+	struct kthread_work work;
+};
+
+typedef void (*kthread_work_func_t)(struct kthread_work *work);
+
+#define kthread_init_work(w, f) ((void)(w), (void)(f))
+#define kthread_init_delayed_work(w, f) ((void)(w), (void)(f))
+#define kthread_run_worker(flags, fmt, ...) \
+	((struct kthread_worker *)ERR_PTR(-ENOSYS))
+#define kthread_create_worker(flags, fmt, ...) \
+	((struct kthread_worker *)ERR_PTR(-ENOSYS))
+#define kthread_create_worker_on_cpu(cpu, flags, fmt, ...) \
+	((struct kthread_worker *)ERR_PTR(-ENOSYS))
+
+static inline void kthread_destroy_worker(struct kthread_worker *worker) {}
+
+static inline bool kthread_queue_work(struct kthread_worker *worker,
+		struct kthread_work *work)
+{
+	return false;
+}
+
+static inline bool kthread_mod_delayed_work(struct kthread_worker *worker,
+		struct kthread_delayed_work *work, unsigned long delay)
+{
+	return false;
+}
+
+static inline bool kthread_cancel_delayed_work_sync(
+		struct kthread_delayed_work *work)
+{
+	return false;
+}
+
+static inline bool kthread_cancel_work_sync(struct kthread_work *work)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __TMFF2_SHIM_SEQ_FILE_H
+#define __TMFF2_SHIM_SEQ_FILE_H
+#include "../shim.h"
+
+/* debugfs files are never read, they only have to build */
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	void *private_data;
+};
+
+struct seq_file {
+	void *private;
+};
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	ssize_t (*read)(struct file *file, char *buf, size_t len, loff_t *pos);
+	ssize_t (*write)(struct file *file, const char __user *buf, size_t len,
+			loff_t *pos);
+	loff_t (*llseek)(struct file *file, loff_t offset, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+static inline void seq_printf(struct seq_file *m, const char *fmt, ...) {}
+static inline void seq_puts(struct seq_file *m, const char *s) {}
+static inline void seq_putc(struct seq_file *m, char c) {}
+#define single_open(file, show, data) ((void)(show), 0)
+#define seq_read NULL
+#define seq_lseek NULL
+#define single_release NULL
+#define simple_open NULL
+#define noop_llseek NULL
+#define DEFINE_SHOW_ATTRIBUTE(__name) \
+static int __name ## _open(struct inode *inode, struct file *file) \
+{ \
+	return single_open(file, __name ## _show, inode->i_private); \
+} \
+static const struct file_operations __name ## _fops = { \
+	.open = __name ## _open, \
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __TMFF2_SHIM_TRACEPOINT_H
+#define __TMFF2_SHIM_TRACEPOINT_H
+#include "../shim.h"
+
+/* tracepoints are disabled, like they are by default in the kernel */
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+
+#endif
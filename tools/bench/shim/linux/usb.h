@@ -0,0 +1,117 @@
+#ifndef __TMFF2_SHIM_USB_H
+#define __TMFF2_SHIM_USB_H
+#include "../shim.h"
+#include "wait.h"
+
+/* the bench device isn't on usb, so none of this is ever called, it only
+ * has to build */
+struct usb_device {
+	int unused;
+};
+
+struct usb_endpoint_descriptor {
+	u8 bEndpointAddress;
+	u8 bInterval;
+};
+
+struct usb_host_endpoint {
+	struct usb_endpoint_descriptor desc;
+};
+
+struct usb_host_interface {
+	struct usb_host_endpoint *endpoint;
+};
+
+struct usb_interface {
+	struct usb_host_interface *cur_altsetting;
+	struct device dev;
+};
+
+struct usb_ctrlrequest {
+	u8 bRequestType;
+	u8 bRequest;
+	__le16 wValue;
+	__le16 wIndex;
+	__le16 wLength;
+} __packed;
+
+struct usb_anchor {
+	int unused;
+};
+
+struct urb {
+	int status;
+	void *context;
+	dma_addr_t transfer_dma;
+	unsigned int transfer_flags;
+};
+
+typedef void (*usb_complete_t)(struct urb *urb);
+
+#define URB_NO_TRANSFER_DMA_MAP 0x0004
+#define USB_CTRL_SET_TIMEOUT 5000
+#define USB_CTRL_GET_TIMEOUT 5000
+
+#define to_usb_device(d) ((struct usb_device *)NULL)
+#define to_usb_interface(d) container_of(d, struct usb_interface, dev)
+#define interface_to_usbdev(intf) ((void)(intf), (struct usb_device *)NULL)
+
+static inline unsigned int usb_sndctrlpipe(struct usb_device *dev, int ep)
+{
+	return 0;
+}
+
+static inline unsigned int usb_rcvctrlpipe(struct usb_device *dev, int ep)
+{
+	return 0;
+}
+
+static inline unsigned int usb_sndintpipe(struct usb_device *dev, int ep)
+{
+	return 0;
+}
+
+static inline int usb_control_msg(struct usb_device *dev, unsigned int pipe,
+		u8 request, u8 requesttype, u16 value, u16 index, void *data,
+		u16 size, int timeout)
+{
+	return -ENODEV;
+}
+
+static inline int usb_interrupt_msg(struct usb_device *dev, unsigned int pipe,
+		void *data, int len, int *actual_length, int timeout)
+{
+	return -ENODEV;
+}
+
+static inline struct urb *usb_alloc_urb(int iso_packets, gfp_t gfp)
+{
+	return NULL;
+}
+
+static inline void usb_free_urb(struct urb *urb) {}
+
+static inline int usb_submit_urb(struct urb *urb, gfp_t gfp)
+{
+	return -ENODEV;
+}
+
+static inline void usb_fill_int_urb(struct urb *urb, struct usb_device *dev,
+		unsigned int pipe, void *buf, int len, usb_complete_t complete,
+		void *context, int interval) {}
+
+static inline void *usb_alloc_coherent(struct usb_device *dev, size_t size,
+		gfp_t gfp, dma_addr_t *dma)
+{
+	return NULL;
+}
+
+static inline void usb_free_coherent(struct usb_device *dev, size_t size,
+		void *buf, dma_addr_t dma) {}
+
+static inline void init_usb_anchor(struct usb_anchor *anchor) {}
+static inline void usb_anchor_urb(struct urb *urb, struct usb_anchor *anchor) {}
+static inline void usb_unanchor_urb(struct urb *urb) {}
+static inline void usb_kill_anchored_urbs(struct usb_anchor *anchor) {}
+
+#endif
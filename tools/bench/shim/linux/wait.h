@@ -0,0 +1,14 @@
+#ifndef __TMFF2_SHIM_WAIT_H
+#define __TMFF2_SHIM_WAIT_H
+#include "../shim.h"
+
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(wq) ((void)(wq))
+#define wake_up(wq) ((void)(wq))
+/* nothing completes behind the bench's back, so there's no point waiting */
+#define wait_event_timeout(wq, cond, timeout) ({ (void)(wq); (cond) ? 1L : 0L; })
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __TMFF2_SHIM_WORKQUEUE_H
+#define __TMFF2_SHIM_WORKQUEUE_H
+#include "../shim.h"
+
+/* work only runs from shim_run_work(), called by the bench */
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	work_func_t func;
+	bool pending;
+};
+
+struct delayed_work {
+	struct work_struct work;
+	/* virtual time the work is due, with work.pending set */
+	ktime_t due;
+};
+
+struct workqueue_struct {
+	int unused;
+};
+
+void shim_init_work(struct work_struct *work, work_func_t func);
+void shim_init_delayed_work(struct delayed_work *work, work_func_t func);
+#define INIT_WORK(w, f) shim_init_work((w), (f))
+#define INIT_DELAYED_WORK(w, f) shim_init_delayed_work((w), (f))
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+struct workqueue_struct *alloc_ordered_workqueue(const char *fmt,
+		unsigned int flags, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+#define WQ_HIGHPRI 0
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *work,
+		unsigned long delay);
+bool cancel_delayed_work_sync(struct delayed_work *work);
+bool cancel_work_sync(struct work_struct *work);
+
+/* run whatever work is due at shim_now until there's none left, returns
+ * how many work items ran */
+int shim_run_work(void);
+/* drop all work items, once the device that owned them is gone */
+void shim_forget_work(void);
+/* when the next delayed work is due, KTIME_MAX if none is */
+ktime_t shim_next_work(void);
+
+#endif
@@ -0,0 +1,363 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Just enough of the kernel API to build the driver as a userspace program.
+ * Time is virtual and only moves when the bench says so, work items run when
+ * the bench runs them, and everything is single threaded so locks are no-ops.
+ * Anything the driver only needs for registration (debugfs, sysfs, module
+ * parameters) does nothing. */
+#ifndef __TMFF2_SHIM_H
+#define __TMFF2_SHIM_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s16 __s16;
+typedef s32 __s32;
+typedef u16 __le16;
+typedef u32 __le32;
+typedef unsigned int gfp_t;
+typedef unsigned short umode_t;
+typedef s64 ktime_t;
+typedef u64 dma_addr_t;
+
+#define __packed __attribute__((packed))
+#define __init
+#define __exit
+#define __ro_after_init
+#define __percpu
+#define __user
+#define __maybe_unused __attribute__((unused))
+#define fallthrough __attribute__((fallthrough))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+
+#define BIT(n) (1UL << (n))
+#define BITS_PER_LONG 64
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+#define offsetofend(type, member) \
+	(offsetof(type, member) + sizeof(((type *)0)->member))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(cond) _Static_assert(!(cond), #cond)
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, lo, hi) min(max(v, lo), hi)
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+#define clamp_val(v, lo, hi) clamp(v, lo, hi)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define div_u64(a, b) ((u64)(a) / (b))
+#define div64_u64(a, b) ((u64)(a) / (u64)(b))
+#define div64_s64(a, b) ((s64)(a) / (s64)(b))
+#define div_s64(a, b) ((s64)(a) / (b))
+#define div_u64_rem(a, b, r) ({ *(r) = (u64)(a) % (b); (u64)(a) / (b); })
+#define fls(x) ((x) ? 32 - __builtin_clz(x) : 0)
+#define fls64(x) ((x) ? 64 - __builtin_clzll(x) : 0)
+#define hweight_long(x) __builtin_popcountl(x)
+#define cpu_to_le16(x) ((u16)(x))
+#define le16_to_cpu(x) ((u16)(x))
+#define cpu_to_le32(x) ((u32)(x))
+
+#define U16_MAX 0xffff
+#define S16_MAX 0x7fff
+#define S16_MIN (-0x8000)
+#define U32_MAX 0xffffffffU
+#define KTIME_MAX INT64_MAX
+#define NSEC_PER_SEC 1000000000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_USEC 1000L
+#define HZ 1000
+#define PAGE_SIZE 4096
+
+#define EPERM 1
+#define ENOENT 2
+#define EIO 5
+#define EAGAIN 11
+#define ENOMEM 12
+#define EBUSY 16
+#define ENODEV 19
+#define EINVAL 22
+#define ENOSPC 28
+#define EPIPE 32
+#define ENOSYS 38
+#define EPROTO 71
+#define EOVERFLOW 75
+#define EOPNOTSUPP 95
+#define ECONNRESET 104
+#define ENOBUFS 105
+#define ESHUTDOWN 108
+#define ETIMEDOUT 110
+
+#define IS_ERR(p) ((unsigned long)(p) > (unsigned long)-4096)
+#define PTR_ERR(p) ((long)(p))
+#define ERR_PTR(e) ((void *)(long)(e))
+#define WARN_ON(x) (x)
+#define WARN_ON_ONCE(x) (x)
+#define lockdep_assert_held(l) ((void)(l))
+#define might_sleep() ((void)0)
+
+/* logging, only errors are interesting here */
+#define pr_info(...) ((void)0)
+#define pr_warn(...) ((void)0)
+#define pr_err(...) fprintf(stderr, __VA_ARGS__)
+#define dev_err(d, ...) fprintf(stderr, __VA_ARGS__)
+#define dev_warn(d, ...) fprintf(stderr, __VA_ARGS__)
+#define dev_info(d, ...) ((void)(d))
+#define hid_err(d, ...) fprintf(stderr, __VA_ARGS__)
+#define hid_warn(d, ...) fprintf(stderr, __VA_ARGS__)
+#define hid_info(d, ...) ((void)(d))
+#define hid_dbg(d, ...) ((void)(d))
+
+/* module */
+#define THIS_MODULE NULL
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+#define MODULE_LICENSE(x)
+#define MODULE_DEVICE_TABLE(a, b)
+#define MODULE_PARM_DESC(a, b)
+#define module_param(a, b, c)
+#define module_param_named(n, a, b, c)
+#define module_init(f) int shim_module_init(void) { return f(); }
+#define module_exit(f) void shim_module_exit(void) { f(); }
+
+/* memory */
+#define GFP_KERNEL 0U
+#define GFP_ATOMIC 0U
+#define kzalloc(n, gfp) calloc(1, (n))
+#define kcalloc(n, size, gfp) calloc((n), (size))
+#define kmalloc(n, gfp) malloc(n)
+#define kfree(p) free((void *)(p))
+
+static inline void *kmemdup(const void *src, size_t len, gfp_t gfp)
+{
+	void *p = malloc(len);
+
+	if (p)
+		memcpy(p, src, len);
+	return p;
+}
+
+char *kasprintf(gfp_t gfp, const char *fmt, ...);
+#define scnprintf snprintf
+int sysfs_emit(char *buf, const char *fmt, ...);
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+
+/* locks, everything runs on the bench's thread */
+typedef struct { int unused; } spinlock_t;
+struct mutex { int unused; };
+#define spin_lock_init(l) ((void)(l))
+#define spin_lock(l) ((void)(l))
+#define spin_unlock(l) ((void)(l))
+#define spin_lock_irqsave(l, f) ((void)(l), (f) = 0)
+#define spin_unlock_irqrestore(l, f) ((void)(l), (void)(f))
+#define spin_trylock_irqsave(l, f) ((void)(l), (f) = 0, 1)
+#define mutex_init(m) ((void)(m))
+#define mutex_lock(m) ((void)(m))
+#define mutex_unlock(m) ((void)(m))
+
+/* bitops */
+static inline void __set_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= BIT(nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~BIT(nr % BITS_PER_LONG);
+}
+
+static inline int test_bit(long nr, const unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline int __test_and_clear_bit(long nr, unsigned long *addr)
+{
+	int old = test_bit(nr, addr);
+
+	__clear_bit(nr, addr);
+	return old;
+}
+
+static inline int __test_and_set_bit(long nr, unsigned long *addr)
+{
+	int old = test_bit(nr, addr);
+
+	__set_bit(nr, addr);
+	return old;
+}
+
+#define set_bit __set_bit
+#define clear_bit __clear_bit
+#define test_and_set_bit __test_and_set_bit
+#define test_and_clear_bit __test_and_clear_bit
+
+unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset);
+unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size,
+		unsigned long offset);
+#define find_first_bit(addr, size) find_next_bit((addr), (size), 0)
+#define find_first_zero_bit(addr, size) find_next_zero_bit((addr), (size), 0)
+#define for_each_set_bit(bit, addr, size) \
+	for ((bit) = find_first_bit((addr), (size)); (bit) < (size); \
+			(bit) = find_next_bit((addr), (size), (bit) + 1))
+#define bitmap_zalloc(n, gfp) \
+	((unsigned long *)calloc(BITS_TO_LONGS(n), sizeof(unsigned long)))
+#define bitmap_free(p) free(p)
+#define bitmap_zero(p, n) memset((p), 0, BITS_TO_LONGS(n) * sizeof(unsigned long))
+int bitmap_empty(const unsigned long *addr, unsigned int bits);
+int bitmap_weight(const unsigned long *addr, unsigned int bits);
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void list_add_between(struct list_head *entry,
+		struct list_head *prev, struct list_head *next)
+{
+	next->prev = entry;
+	entry->next = next;
+	entry->prev = prev;
+	prev->next = entry;
+}
+
+#define list_add(entry, head) list_add_between((entry), (head), (head)->next)
+#define list_add_tail(entry, head) list_add_between((entry), (head)->prev, (head))
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void list_move_tail(struct list_head *entry,
+		struct list_head *head)
+{
+	list_del(entry);
+	list_add_tail(entry, head);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_first_entry_or_null(ptr, type, member) \
+	(!list_empty(ptr) ? list_first_entry(ptr, type, member) : NULL)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_first_entry(head, __typeof__(*pos), member); \
+			&pos->member != (head); \
+			pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+/* time, in virtual nanoseconds that only the bench advances */
+extern ktime_t shim_now;
+#define ktime_get() shim_now
+#define ktime_to_ns(t) ((s64)(t))
+#define ktime_to_us(t) ((s64)(t) / NSEC_PER_USEC)
+#define ktime_to_ms(t) ((s64)(t) / NSEC_PER_MSEC)
+#define ms_to_ktime(ms) ((ktime_t)(ms) * NSEC_PER_MSEC)
+#define ns_to_ktime(ns) ((ktime_t)(ns))
+#define ktime_add(a, b) ((a) + (b))
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_add_ms(t, ms) ((t) + (ktime_t)(ms) * NSEC_PER_MSEC)
+#define ktime_add_us(t, us) ((t) + (ktime_t)(us) * NSEC_PER_USEC)
+#define ktime_add_ns(t, ns) ((t) + (ktime_t)(ns))
+#define ktime_after(a, b) ((a) > (b))
+#define ktime_before(a, b) ((a) < (b))
+#define ktime_compare(a, b) ((a) < (b) ? -1 : (a) > (b))
+#define ktime_us_delta(a, b) (((a) - (b)) / NSEC_PER_USEC)
+#define ktime_ms_delta(a, b) (((a) - (b)) / NSEC_PER_MSEC)
+#define msecs_to_jiffies(ms) ((unsigned long)(ms) * HZ / 1000)
+#define usecs_to_jiffies(us) DIV_ROUND_UP((unsigned long)(us) * HZ, 1000000UL)
+
+/* per cpu data, there is only one cpu */
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(p) free(p)
+#define this_cpu_inc(x) ((x)++)
+#define this_cpu_read(x) (x)
+#define this_cpu_write(x, v) ((x) = (v))
+#define get_cpu_ptr(p) (p)
+#define put_cpu_ptr(p) ((void)(p))
+#define per_cpu_ptr(p, cpu) (p)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define nr_cpu_ids 1
+#define cpu_online(cpu) ((cpu) == 0)
+
+void sort(void *base, size_t num, size_t size,
+		int (*cmp)(const void *, const void *),
+		void (*swap)(void *, void *, int));
+
+s32 fixp_sin32(int degrees);
+
+/* devices */
+struct device {
+	struct device *parent;
+	void *driver_data;
+	const char *name;
+};
+
+struct device_attribute {
+	int unused;
+};
+
+#define DEVICE_ATTR_RW(name) struct device_attribute dev_attr_##name
+#define device_create_file(dev, attr) ((void)(dev), (void)(attr), 0)
+#define device_remove_file(dev, attr) ((void)(dev), (void)(attr))
+#define dev_name(dev) ((dev)->name)
+#define dev_get_drvdata(dev) ((dev)->driver_data)
+
+/* scheduling, only used for the kthread worker the bench doesn't use */
+struct task_struct {
+	int unused;
+};
+
+struct sched_param {
+	int sched_priority;
+};
+
+#define SCHED_FIFO 1
+static inline int sched_setscheduler_nocheck(struct task_struct *task,
+		int policy, const struct sched_param *param)
+{
+	return -ENOSYS;
+}
+
+static inline void kthread_bind(struct task_struct *task, unsigned int cpu) {}
+
+static inline int wake_up_process(struct task_struct *task)
+{
+	return 0;
+}
+
+#endif /* __TMFF2_SHIM_H */
@@ -0,0 +1,584 @@
+// SPDX-License-Identifier: GPL-2.0
+/* an emulated T300RS as a usb gadget through raw-gadget, usually on
+ * dummy_hcd, so the driver talks to it through usbhid, the interrupt out
+ * endpoint and usb_control_msg like it does to the real wheel:
+ *
+ *   modprobe dummy_hcd; modprobe raw_gadget
+ *   tmff2-gadget -i 2 -l packets.log
+ *
+ * The wheel only takes a report off the bus when the modelled wheel has
+ * room for it, so a slow wheel holds up the host here like a real one */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hid.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+#include "wheel.h"
+
+#define GADGET_EP0_MAX		4096
+#define GADGET_PACKET_SIZE	64
+
+/* the vendor requests the driver sends on ep0 */
+#define GADGET_REQ_FIRMWARE	86
+#define GADGET_REQ_ATTACHMENT	73
+#define GADGET_REQ_MODE		83
+
+struct __attribute__((packed)) gadget_hid_descriptor {
+	__u8 bLength;
+	__u8 bDescriptorType;
+	__le16 bcdHID;
+	__u8 bCountryCode;
+	__u8 bNumDescriptors;
+	__u8 bReportType;
+	__le16 wReportLength;
+};
+
+struct gadget_event {
+	struct usb_raw_event event;
+	union {
+		struct usb_ctrlrequest ctrl;
+		char data[sizeof(struct usb_ctrlrequest)];
+	};
+};
+
+struct gadget_io {
+	struct usb_raw_ep_io io;
+	__u8 data[GADGET_EP0_MAX];
+};
+
+struct gadget {
+	int fd;
+	unsigned int product;
+	unsigned int interval;
+	unsigned int firmware;
+	unsigned int attachment;
+	bool verbose;
+	FILE *log;
+
+	const uint8_t *rdesc;
+	unsigned int rdesc_size;
+	struct usb_endpoint_descriptor ep_in;
+	struct usb_endpoint_descriptor ep_out;
+	int out_handle;
+	bool configured;
+	pthread_t out_thread;
+
+	/* everything below is shared between ep0 and the out endpoint */
+	pthread_mutex_t lock;
+	struct wheel_state state;
+	struct wheel_model model;
+	struct wheel_workload workload;
+	struct wheel_hist intervals;
+	uint64_t start;
+	uint64_t last;
+};
+
+static volatile sig_atomic_t gadget_stop;
+
+static void gadget_signal(int signal)
+{
+	gadget_stop = 1;
+}
+
+static const char *gadget_strings[] = {
+	NULL,
+	"Thrustmaster",
+	"Thrustmaster T300RS Racing wheel",
+};
+
+static void gadget_device_descriptor(struct gadget *gadget,
+		struct usb_device_descriptor *desc)
+{
+	*desc = (struct usb_device_descriptor){
+		.bLength = USB_DT_DEVICE_SIZE,
+		.bDescriptorType = USB_DT_DEVICE,
+		.bcdUSB = __cpu_to_le16(0x0200),
+		.bMaxPacketSize0 = GADGET_PACKET_SIZE,
+		.idVendor = __cpu_to_le16(WHEEL_VENDOR_ID),
+		.idProduct = __cpu_to_le16(gadget->product),
+		.bcdDevice = __cpu_to_le16(0x0100),
+		.iManufacturer = 1,
+		.iProduct = 2,
+		.bNumConfigurations = 1,
+	};
+}
+
+/* configuration, interface, hid and both endpoint descriptors */
+static int gadget_config_descriptor(struct gadget *gadget, __u8 *buf)
+{
+	struct usb_config_descriptor config = {
+		.bLength = USB_DT_CONFIG_SIZE,
+		.bDescriptorType = USB_DT_CONFIG,
+		.bNumInterfaces = 1,
+		.bConfigurationValue = 1,
+		.bmAttributes = USB_CONFIG_ATT_ONE,
+		.bMaxPower = 50,
+	};
+	struct usb_interface_descriptor interface = {
+		.bLength = USB_DT_INTERFACE_SIZE,
+		.bDescriptorType = USB_DT_INTERFACE,
+		.bNumEndpoints = 2,
+		.bInterfaceClass = USB_CLASS_HID,
+	};
+	struct gadget_hid_descriptor hid = {
+		.bLength = sizeof(hid),
+		.bDescriptorType = HID_DT_HID,
+		.bcdHID = __cpu_to_le16(0x0111),
+		.bNumDescriptors = 1,
+		.bReportType = HID_DT_REPORT,
+		.wReportLength = __cpu_to_le16(gadget->rdesc_size),
+	};
+	int len = 0;
+
+	memcpy(buf + len, &config, USB_DT_CONFIG_SIZE);
+	len += USB_DT_CONFIG_SIZE;
+	memcpy(buf + len, &interface, USB_DT_INTERFACE_SIZE);
+	len += USB_DT_INTERFACE_SIZE;
+	memcpy(buf + len, &hid, sizeof(hid));
+	len += sizeof(hid);
+	memcpy(buf + len, &gadget->ep_in, USB_DT_ENDPOINT_SIZE);
+	len += USB_DT_ENDPOINT_SIZE;
+	memcpy(buf + len, &gadget->ep_out, USB_DT_ENDPOINT_SIZE);
+	len += USB_DT_ENDPOINT_SIZE;
+
+	((struct usb_config_descriptor *)buf)->wTotalLength = __cpu_to_le16(len);
+	return len;
+}
+
+static int gadget_string_descriptor(unsigned int index, __u8 *buf)
+{
+	const char *string;
+	int i;
+
+	if (index == 0) {
+		/* english (us) only */
+		buf[0] = 4;
+		buf[1] = USB_DT_STRING;
+		buf[2] = 0x09;
+		buf[3] = 0x04;
+		return 4;
+	}
+
+	if (index >= sizeof(gadget_strings) / sizeof(*gadget_strings))
+		return -EINVAL;
+
+	string = gadget_strings[index];
+	for (i = 0; string[i]; ++i) {
+		buf[2 + 2 * i] = string[i];
+		buf[3 + 2 * i] = 0;
+	}
+	buf[0] = 2 + 2 * i;
+	buf[1] = USB_DT_STRING;
+	return buf[0];
+}
+
+/* the endpoints dummy_hcd and friends have, an interrupt in for the wheel's
+ * input reports and an interrupt out for the driver's reports */
+static int gadget_assign_endpoints(struct gadget *gadget)
+{
+	struct usb_raw_eps_info info = {0};
+	struct usb_raw_ep_info *ep;
+	int i, count, next = 1;
+	bool in = false, out = false;
+
+	if ((count = ioctl(gadget->fd, USB_RAW_IOCTL_EPS_INFO, &info)) < 0)
+		return -errno;
+
+	for (i = 0; i < count && !(in && out); ++i) {
+		ep = &info.eps[i];
+		if (!ep->caps.type_int)
+			continue;
+
+		if (!in && ep->caps.dir_in) {
+			gadget->ep_in.bEndpointAddress = USB_DIR_IN |
+				(ep->addr == USB_RAW_EP_ADDR_ANY ? next++ : ep->addr);
+			in = true;
+		} else if (!out && ep->caps.dir_out) {
+			gadget->ep_out.bEndpointAddress = USB_DIR_OUT |
+				(ep->addr == USB_RAW_EP_ADDR_ANY ? next++ : ep->addr);
+			out = true;
+		}
+	}
+
+	return in && out ? 0 : -ENODEV;
+}
+
+static void gadget_report(struct gadget *gadget, const __u8 *data, size_t size)
+{
+	uint64_t now = wheel_now(), interval;
+	size_t i;
+
+	if (size && data[0] == WHEEL_REPORT_ID) {
+		data++;
+		size--;
+	}
+
+	pthread_mutex_lock(&gadget->lock);
+	interval = gadget->last ? now - gadget->last : 0;
+	if (gadget->last)
+		wheel_hist_add(&gadget->intervals, interval);
+	gadget->last = now;
+
+	if (wheel_decode(&gadget->state, data, size) >= 0
+			&& gadget->workload.effects)
+		wheel_workload_report(&gadget->workload, now);
+
+	if (gadget->log) {
+		/* time since start and since the last report, in ms */
+		fprintf(gadget->log, "%llu.%03llu %llu.%03llu",
+				(unsigned long long)(now - gadget->start) / 1000000,
+				(unsigned long long)(now - gadget->start) / 1000 % 1000,
+				(unsigned long long)interval / 1000000,
+				(unsigned long long)interval / 1000 % 1000);
+		for (i = 0; i < size && i < 16; ++i)
+			fprintf(gadget->log, " %02x", data[i]);
+		fprintf(gadget->log, "\n");
+	}
+	pthread_mutex_unlock(&gadget->lock);
+}
+
+/* takes the driver's reports off the interrupt out endpoint, as fast as the
+ * modelled wheel lets it */
+static void *gadget_out(void *data)
+{
+	struct gadget *gadget = data;
+	struct gadget_io io;
+	struct timespec ts;
+	uint64_t accept;
+	int ret;
+
+	while (!gadget_stop) {
+		io.io.ep = gadget->out_handle;
+		io.io.flags = 0;
+		io.io.length = GADGET_PACKET_SIZE;
+
+		if ((ret = ioctl(gadget->fd, USB_RAW_IOCTL_EP_READ, &io)) < 0) {
+			if (errno != EINTR)
+				perror("interrupt out");
+			break;
+		}
+
+		gadget_report(gadget, io.data, ret);
+
+		pthread_mutex_lock(&gadget->lock);
+		accept = wheel_model_ingest(&gadget->model, wheel_now());
+		pthread_mutex_unlock(&gadget->lock);
+
+		/* the next report stays on the host side until we read it */
+		ts.tv_sec = accept / 1000000000ull;
+		ts.tv_nsec = accept % 1000000000ull;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	return NULL;
+}
+
+static int gadget_configure(struct gadget *gadget)
+{
+	__u32 power = 100;
+	int ret;
+
+	if (gadget->configured)
+		return 0;
+
+	if (ioctl(gadget->fd, USB_RAW_IOCTL_EP_ENABLE, &gadget->ep_in) < 0
+			|| (gadget->out_handle = ioctl(gadget->fd,
+					USB_RAW_IOCTL_EP_ENABLE, &gadget->ep_out)) < 0) {
+		perror("enabling endpoints");
+		return -errno;
+	}
+
+	if (ioctl(gadget->fd, USB_RAW_IOCTL_VBUS_DRAW, power) < 0
+			|| ioctl(gadget->fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0) {
+		perror("configuring");
+		return -errno;
+	}
+
+	if ((ret = pthread_create(&gadget->out_thread, NULL, gadget_out, gadget)))
+		return -ret;
+
+	gadget->configured = true;
+	if (gadget->workload.effects && wheel_workload_start(&gadget->workload)) {
+		fprintf(stderr, "could not start the workload\n");
+		gadget->workload.effects = 0;
+	}
+
+	return 0;
+}
+
+/* what goes back for a request the driver or usbhid make. Returns the
+ * length of the data stage, or -EOPNOTSUPP to stall */
+static int gadget_control(struct gadget *gadget,
+		const struct usb_ctrlrequest *ctrl, __u8 *buf)
+{
+	unsigned int value = __le16_to_cpu(ctrl->wValue);
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		switch (ctrl->bRequest) {
+		case USB_REQ_GET_DESCRIPTOR:
+			switch (value >> 8) {
+			case USB_DT_DEVICE:
+				gadget_device_descriptor(gadget,
+						(struct usb_device_descriptor *)buf);
+				return USB_DT_DEVICE_SIZE;
+			case USB_DT_CONFIG:
+				return gadget_config_descriptor(gadget, buf);
+			case USB_DT_STRING:
+				return gadget_string_descriptor(value & 0xff, buf);
+			case HID_DT_REPORT:
+				memcpy(buf, gadget->rdesc, gadget->rdesc_size);
+				return gadget->rdesc_size;
+			}
+			break;
+		case USB_REQ_SET_CONFIGURATION:
+			return gadget_configure(gadget);
+		case USB_REQ_SET_INTERFACE:
+			return 0;
+		}
+		break;
+	case USB_TYPE_CLASS:
+		switch (ctrl->bRequest) {
+		case HID_REQ_SET_IDLE:
+			return 0;
+		case HID_REQ_SET_REPORT:
+			/* the report itself comes in the data stage */
+			return __le16_to_cpu(ctrl->wLength);
+		}
+		break;
+	case USB_TYPE_VENDOR:
+		switch (ctrl->bRequest) {
+		case GADGET_REQ_FIRMWARE:
+			memset(buf, 0, 8);
+			buf[2] = gadget->firmware;
+			return 8;
+		case GADGET_REQ_ATTACHMENT:
+			/* the short layout, type 0x47 */
+			memset(buf, 0, 8);
+			buf[0] = 0x47;
+			buf[6] = gadget->attachment;
+			return 8;
+		case GADGET_REQ_MODE:
+			fprintf(stderr, "mode switch to %u ignored\n", value);
+			return 0;
+		}
+		break;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+static int gadget_ep0(struct gadget *gadget, const struct usb_ctrlrequest *ctrl)
+{
+	struct gadget_io io = {0};
+	unsigned int length = __le16_to_cpu(ctrl->wLength);
+	int ret;
+
+	if (gadget->verbose)
+		fprintf(stderr, "ep0: %02x %02x %04x %04x %u\n",
+				ctrl->bRequestType, ctrl->bRequest,
+				__le16_to_cpu(ctrl->wValue),
+				__le16_to_cpu(ctrl->wIndex), length);
+
+	ret = gadget_control(gadget, ctrl, io.data);
+	if (ret < 0) {
+		if (gadget->verbose)
+			fprintf(stderr, "ep0: stalled\n");
+		return ioctl(gadget->fd, USB_RAW_IOCTL_EP0_STALL, 0);
+	}
+
+	if (length > GADGET_EP0_MAX)
+		length = GADGET_EP0_MAX;
+	io.io.length = (unsigned int)ret < length ? (unsigned int)ret : length;
+	if (ctrl->bRequestType & USB_DIR_IN)
+		return ioctl(gadget->fd, USB_RAW_IOCTL_EP0_WRITE, &io);
+
+	if ((ret = ioctl(gadget->fd, USB_RAW_IOCTL_EP0_READ, &io)) < 0)
+		return ret;
+
+	if ((ctrl->bRequestType & USB_TYPE_MASK) == USB_TYPE_CLASS
+			&& ctrl->bRequest == HID_REQ_SET_REPORT)
+		gadget_report(gadget, io.data, ret);
+
+	return 0;
+}
+
+/* the out endpoint may still be taking a report, so everything it touches
+ * is done under the lock */
+static void gadget_finish(struct gadget *gadget)
+{
+	pthread_mutex_lock(&gadget->lock);
+	wheel_print(&gadget->state);
+	wheel_model_print(&gadget->model);
+	wheel_hist_print(&gadget->intervals, "between reports");
+	if (gadget->log)
+		fclose(gadget->log);
+	gadget->log = NULL;
+	pthread_mutex_unlock(&gadget->lock);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-D driver] [-d device] [-i interval] [-r rate] [-q depth]\n"
+		"          [-F firmware] [-A attachment] [-t seconds] [-l log]\n"
+		"          [-w effects] [-f hz] [-v]\n"
+		"  -D/-d  udc driver and device, dummy_udc and dummy_udc.0 by default\n"
+		"  -i  bInterval of the interrupt out endpoint, default 1\n"
+		"  -r  reports per second the wheel takes, 0 (default) for no limit\n"
+		"  -q  reports the wheel buffers, default 1\n"
+		"  -F  firmware version to report, default 31\n"
+		"  -A  attachment to report, default 6\n"
+		"  -t  stop after this many seconds, default is to run until ^C\n"
+		"  -l  log every report with its arrival time\n"
+		"  -w  update this many constant effects through the event device\n"
+		"  -f  frames per second of the -w workload, default 60\n"
+		"  -v  print every ep0 request\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct gadget gadget = {
+		.product = 0xb66e,
+		.interval = 1,
+		.firmware = 31,
+		.attachment = 0x06,
+		.workload.hz = 60,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct usb_raw_init init = { .speed = USB_SPEED_FULL };
+	const char *driver = "dummy_udc", *device = "dummy_udc.0";
+	unsigned int rate = 0, depth = 1;
+	struct gadget_event event;
+	struct sigaction action = { .sa_handler = gadget_signal };
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "D:d:i:r:q:F:A:t:l:w:f:vh")) != -1) {
+		switch (opt) {
+		case 'D':
+			driver = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'i':
+			gadget.interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			gadget.firmware = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			gadget.attachment = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			alarm(strtoul(optarg, NULL, 0));
+			break;
+		case 'l':
+			if (!(gadget.log = fopen(optarg, "w"))) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'w':
+			gadget.workload.effects = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			gadget.workload.hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			gadget.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	gadget.rdesc = wheel_rdesc(gadget.product, &gadget.rdesc_size);
+	if (!gadget.rdesc || wheel_model_init(&gadget.model, rate, depth))
+		return 1;
+
+	gadget.ep_in = (struct usb_endpoint_descriptor){
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bmAttributes = USB_ENDPOINT_XFER_INT,
+		.wMaxPacketSize = __cpu_to_le16(GADGET_PACKET_SIZE),
+		.bInterval = 1,
+	};
+	gadget.ep_out = gadget.ep_in;
+	gadget.ep_out.bInterval = gadget.interval;
+	gadget.workload.product = gadget.product;
+
+	/* no SA_RESTART, so the blocking ioctls give up on ^C */
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGALRM, &action, NULL);
+
+	if ((gadget.fd = open("/dev/raw-gadget", O_RDWR)) < 0) {
+		perror("/dev/raw-gadget");
+		goto out;
+	}
+
+	snprintf((char *)init.driver_name, sizeof(init.driver_name), "%s", driver);
+	snprintf((char *)init.device_name, sizeof(init.device_name), "%s", device);
+	if (ioctl(gadget.fd, USB_RAW_IOCTL_INIT, &init) < 0
+			|| ioctl(gadget.fd, USB_RAW_IOCTL_RUN, 0) < 0) {
+		perror("starting the gadget");
+		goto close;
+	}
+
+	gadget.start = wheel_now();
+	while (!gadget_stop) {
+		event.event.type = 0;
+		event.event.length = sizeof(event.ctrl);
+		if (ioctl(gadget.fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0) {
+			if (errno != EINTR)
+				perror("fetching an event");
+			break;
+		}
+
+		switch (event.event.type) {
+		case USB_RAW_EVENT_CONNECT:
+			if (gadget_assign_endpoints(&gadget)) {
+				fprintf(stderr, "no interrupt endpoints on %s\n", device);
+				goto close;
+			}
+			break;
+		case USB_RAW_EVENT_CONTROL:
+			if (gadget_ep0(&gadget, &event.ctrl) < 0 && errno != EINTR)
+				perror("ep0");
+			break;
+		}
+	}
+
+	gadget_stop = 1;
+	if (gadget.workload.effects) {
+		wheel_workload_stop(&gadget.workload);
+		wheel_workload_print(&gadget.workload);
+	}
+	gadget_finish(&gadget);
+	ret = 0;
+
+close:
+	close(gadget.fd);
+out:
+	if (gadget.log)
+		fclose(gadget.log);
+	wheel_model_destroy(&gadget.model);
+	return ret;
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0
+/* built against ../bench/shim, so the emulated wheel describes itself with
+ * exactly the report descriptor the driver would replace its own with */
+#include <linux/hid.h>
+#include "hid-tmff2.h"
+
+/* from wheel.h, which wants libc headers that clash with the shim */
+const uint8_t *wheel_rdesc(unsigned int product, unsigned int *size);
+
+const uint8_t *wheel_rdesc(unsigned int product, unsigned int *size)
+{
+	struct tmff2_device_entry tmff2 = {0};
+	struct hid_device hdev = { .product = product };
+
+	switch (product) {
+	case TMT300RS_PS3_NORM_ID:
+	case TMT300RS_PS3_ADV_ID:
+	case TMT300RS_PS4_NORM_ID:
+		t300rs_populate_api(&tmff2);
+		break;
+	case TMT248_PC_ID:
+		t248_populate_api(&tmff2);
+		break;
+	default:
+		return NULL;
+	}
+
+	*size = 0;
+	return tmff2.wheel_fixup(&hdev, NULL, size);
+}
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPL-2.0
+/* an emulated T300RS or T248 on uhid. The driver binds to it like to the
+ * real wheel, minus usbhid: its reports come out of /dev/uhid instead of the
+ * interrupt endpoint. uhid queues output reports without ever blocking the
+ * sender, so when the modelled wheel has no room the time the host would
+ * have been held up is reported instead */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+#include "wheel.h"
+
+static const struct uhid_wheel {
+	unsigned int product;
+	const char *name;
+} uhid_wheels[] = {
+	{ 0xb66e, "Thrustmaster T300RS Racing wheel" },
+	{ 0xb66f, "Thrustmaster T300RS Racing wheel (advanced mode)" },
+	{ 0xb66d, "Thrustmaster T300RS Racing wheel (PS4 mode)" },
+	{ 0xb696, "Thrustmaster T248" },
+};
+
+static volatile sig_atomic_t uhid_stop;
+
+static void uhid_signal(int signal)
+{
+	uhid_stop = 1;
+}
+
+static int uhid_write(int fd, const struct uhid_event *event)
+{
+	ssize_t ret = write(fd, event, sizeof(*event));
+
+	if (ret < 0)
+		return -errno;
+
+	return ret == sizeof(*event) ? 0 : -EFAULT;
+}
+
+static int uhid_create(int fd, const struct uhid_wheel *wheel)
+{
+	struct uhid_event event = { .type = UHID_CREATE2 };
+	const uint8_t *rdesc;
+	unsigned int size;
+
+	if (!(rdesc = wheel_rdesc(wheel->product, &size)) || size > HID_MAX_DESCRIPTOR_SIZE)
+		return -EINVAL;
+
+	snprintf((char *)event.u.create2.name, sizeof(event.u.create2.name),
+			"%s", wheel->name);
+	snprintf((char *)event.u.create2.phys, sizeof(event.u.create2.phys),
+			"tmff2-emu");
+	/* the driver only matches usb ids, it finds out it's not on usb by
+	 * itself */
+	event.u.create2.bus = BUS_USB;
+	event.u.create2.vendor = WHEEL_VENDOR_ID;
+	event.u.create2.product = wheel->product;
+	event.u.create2.rd_size = size;
+	memcpy(event.u.create2.rd_data, rdesc, size);
+
+	return uhid_write(fd, &event);
+}
+
+static void uhid_output(struct wheel_state *state, struct wheel_model *model,
+		struct wheel_workload *workload, const uint8_t *data,
+		size_t size, bool verbose)
+{
+	uint64_t now = wheel_now();
+	int slot;
+	size_t i;
+
+	if (size && data[0] == WHEEL_REPORT_ID) {
+		data++;
+		size--;
+	}
+
+	wheel_model_ingest(model, now);
+	slot = wheel_decode(state, data, size);
+	if (slot >= 0 && workload)
+		wheel_workload_report(workload, now);
+
+	if (!verbose)
+		return;
+
+	printf("%llu.%06llu", (unsigned long long)now / 1000000000,
+			(unsigned long long)now / 1000 % 1000000);
+	/* the interesting part is at the front, the rest is padding */
+	for (i = 0; i < size && i < 16; ++i)
+		printf(" %02x", data[i]);
+	printf("\n");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-p product] [-r rate] [-d depth] [-t seconds]\n"
+		"          [-w effects] [-f hz] [-v]\n"
+		"  -p  usb product id, b66e (default), b66f, b66d or b696\n"
+		"  -r  reports per second the wheel takes, 0 (default) for no limit\n"
+		"  -d  reports the wheel buffers, default 1\n"
+		"  -t  stop after this many seconds, default is to run until ^C\n"
+		"  -w  update this many constant effects through the event device\n"
+		"  -f  frames per second of the -w workload, default 60\n"
+		"  -v  print every report as it arrives\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct uhid_wheel *wheel = &uhid_wheels[0];
+	struct wheel_workload workload = { .hz = 60 };
+	struct wheel_state state = {0};
+	struct wheel_model model;
+	struct uhid_event event;
+	struct pollfd pfd;
+	unsigned int rate = 0, depth = 1, seconds = 0, product;
+	uint64_t end = 0;
+	bool verbose = false;
+	int fd, opt, ret = 1;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "p:r:d:t:w:f:vh")) != -1) {
+		switch (opt) {
+		case 'p':
+			product = strtoul(optarg, NULL, 16);
+			for (i = 0; i < sizeof(uhid_wheels) / sizeof(*uhid_wheels); ++i)
+				if (uhid_wheels[i].product == product)
+					break;
+			if (i == sizeof(uhid_wheels) / sizeof(*uhid_wheels)) {
+				usage(argv[0]);
+				return 1;
+			}
+			wheel = &uhid_wheels[i];
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			workload.effects = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			workload.hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (wheel_model_init(&model, rate, depth))
+		return 1;
+
+	if ((fd = open("/dev/uhid", O_RDWR | O_CLOEXEC)) < 0) {
+		perror("/dev/uhid");
+		goto out;
+	}
+
+	if (uhid_create(fd, wheel)) {
+		fprintf(stderr, "could not create the uhid device\n");
+		goto close;
+	}
+
+	signal(SIGINT, uhid_signal);
+	signal(SIGTERM, uhid_signal);
+	if (seconds)
+		end = wheel_now() + seconds * 1000000000ull;
+
+	workload.product = wheel->product;
+	if (workload.effects && wheel_workload_start(&workload)) {
+		fprintf(stderr, "could not start the workload\n");
+		workload.effects = 0;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!uhid_stop && (!end || wheel_now() < end)) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		if (read(fd, &event, sizeof(event)) <= 0) {
+			perror("read");
+			break;
+		}
+
+		switch (event.type) {
+		case UHID_START:
+		case UHID_STOP:
+		case UHID_OPEN:
+		case UHID_CLOSE:
+			if (verbose)
+				printf("uhid event %u\n", event.type);
+			break;
+		case UHID_OUTPUT:
+			uhid_output(&state, &model, workload.effects ? &workload : NULL,
+					event.u.output.data, event.u.output.size,
+					verbose);
+			break;
+		case UHID_SET_REPORT:
+			/* reports the hid core had to send as SET_REPORT */
+			uhid_output(&state, &model, workload.effects ? &workload : NULL,
+					event.u.set_report.data,
+					event.u.set_report.size, verbose);
+			event = (struct uhid_event){
+				.type = UHID_SET_REPORT_REPLY,
+				.u.set_report_reply.id = event.u.set_report.id,
+			};
+			uhid_write(fd, &event);
+			break;
+		case UHID_GET_REPORT:
+			event = (struct uhid_event){
+				.type = UHID_GET_REPORT_REPLY,
+				.u.get_report_reply.id = event.u.get_report.id,
+				.u.get_report_reply.err = EIO,
+			};
+			uhid_write(fd, &event);
+			break;
+		}
+	}
+
+	if (workload.effects) {
+		wheel_workload_stop(&workload);
+		wheel_workload_print(&workload);
+	}
+
+	wheel_print(&state);
+	wheel_model_print(&model);
+	ret = 0;
+
+	event = (struct uhid_event){ .type = UHID_DESTROY };
+	uhid_write(fd, &event);
+close:
+	close(fd);
+out:
+	wheel_model_destroy(&model);
+	return ret;
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-2.0
+/* the wheel's end of the protocol, shared by the uhid and raw-gadget
+ * emulators */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "wheel.h"
+
+#define WHEEL_UPLOAD_CONSTANT	0x6a
+#define WHEEL_UPLOAD_PERIODIC	0x6b
+#define WHEEL_UPLOAD_CONDITION	0x64
+#define WHEEL_PLAY		0x89
+#define WHEEL_MODIFY_CONSTANT	0x0a
+#define WHEEL_MODIFY		0x0e
+#define WHEEL_MODIFY_ENVELOPE	0x31
+#define WHEEL_MODIFY_DURATION	0x49
+
+static uint16_t wheel_le16(const uint8_t *buf, size_t len, size_t offset)
+{
+	if (offset + 2 > len)
+		return 0;
+
+	return buf[offset] | buf[offset + 1] << 8;
+}
+
+/* the attributes after the mask byte, lowest bit first */
+static void wheel_decode_attributes(uint16_t *values, const uint8_t *buf,
+		size_t len, uint8_t mask)
+{
+	size_t offset = 4;
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		values[i] = wheel_le16(buf, len, offset);
+		offset += 2;
+	}
+}
+
+static int wheel_decode_effect(struct wheel_state *wheel, const uint8_t *buf,
+		size_t len)
+{
+	struct wheel_slot *slot;
+	int id, i;
+
+	if (len < 4 || buf[1] < 1 || buf[1] > WHEEL_SLOTS)
+		return -EINVAL;
+
+	id = buf[1] - 1;
+	slot = &wheel->slots[id];
+
+	switch (buf[2]) {
+	case WHEEL_UPLOAD_CONSTANT:
+		slot->kind = buf[2];
+		slot->values[0] = wheel_le16(buf, len, 3);
+		for (i = 0; i < 4; ++i)
+			slot->envelope[i] = wheel_le16(buf, len, 5 + 2 * i);
+		slot->duration = wheel_le16(buf, len, 15);
+		slot->uploads++;
+		break;
+	case WHEEL_UPLOAD_PERIODIC:
+		/* ramps are periodic effects with a saw for a waveform */
+		slot->kind = buf[2];
+		for (i = 0; i < 4; ++i)
+			slot->values[i] = wheel_le16(buf, len, 3 + 2 * i);
+		for (i = 0; i < 4; ++i)
+			slot->envelope[i] = wheel_le16(buf, len, 13 + 2 * i);
+		slot->waveform = len > 21 ? buf[21] : 0;
+		slot->duration = wheel_le16(buf, len, 23);
+		slot->uploads++;
+		break;
+	case WHEEL_UPLOAD_CONDITION:
+		slot->kind = buf[2];
+		for (i = 0; i < 4; ++i)
+			slot->values[i] = wheel_le16(buf, len, 3 + 2 * i);
+		slot->duration = wheel_le16(buf, len, 29);
+		slot->uploads++;
+		break;
+	case WHEEL_PLAY:
+		if (buf[3]) {
+			slot->playing = true;
+			slot->plays++;
+		} else {
+			slot->playing = false;
+			slot->stops++;
+		}
+		break;
+	case WHEEL_MODIFY_CONSTANT:
+		slot->values[0] = wheel_le16(buf, len, 3);
+		slot->modifies++;
+		break;
+	case WHEEL_MODIFY:
+		wheel_decode_attributes(slot->values, buf, len, buf[3] & 0x0f);
+		slot->modifies++;
+		break;
+	case WHEEL_MODIFY_ENVELOPE:
+		wheel_decode_attributes(slot->envelope, buf, len, buf[3] & 0x0f);
+		slot->modifies++;
+		break;
+	case WHEEL_MODIFY_DURATION:
+		slot->duration = wheel_le16(buf, len, 5);
+		slot->modifies++;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!slot->kind)
+		fprintf(stderr, "slot %d: %02x for an empty slot\n", id, buf[2]);
+
+	return id;
+}
+
+static int wheel_decode_setting(struct wheel_state *wheel, const uint8_t *buf,
+		size_t len)
+{
+	if (len < 2)
+		return -EINVAL;
+
+	switch (buf[0]) {
+	case 0x01:
+		wheel->open = buf[1] == 0x05;
+		break;
+	case 0x02:
+		wheel->gain = buf[1];
+		break;
+	case 0x08:
+		if (buf[1] == 0x03)
+			wheel->autocenter = wheel_le16(buf, len, 2);
+		else if (buf[1] == 0x11)
+			wheel->range = wheel_le16(buf, len, 2) / 0x3c;
+		else if (buf[1] != 0x04)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	wheel->settings++;
+	return -1;
+}
+
+int wheel_decode(struct wheel_state *wheel, const uint8_t *buf, size_t len)
+{
+	int ret;
+
+	wheel->packets++;
+
+	if (len && buf[0] == 0x00)
+		ret = wheel_decode_effect(wheel, buf, len);
+	else
+		ret = wheel_decode_setting(wheel, buf, len);
+
+	if (ret == -EINVAL)
+		wheel->unknown++;
+
+	return ret;
+}
+
+void wheel_print(const struct wheel_state *wheel)
+{
+	const struct wheel_slot *slot;
+	int i;
+
+	printf("packets %lu, settings %lu, unknown %lu\n", wheel->packets,
+			wheel->settings, wheel->unknown);
+	printf("open %d, gain %u, autocenter %u, range %u\n", wheel->open,
+			wheel->gain, wheel->autocenter, wheel->range);
+
+	for (i = 0; i < WHEEL_SLOTS; ++i) {
+		slot = &wheel->slots[i];
+		if (!slot->kind)
+			continue;
+
+		printf("slot %2d: %02x%s values %04x %04x %04x %04x, duration %u, "
+				"uploads %lu modifies %lu plays %lu stops %lu\n",
+				i, slot->kind, slot->playing ? " playing," : ",",
+				slot->values[0], slot->values[1],
+				slot->values[2], slot->values[3],
+				slot->duration, slot->uploads, slot->modifies,
+				slot->plays, slot->stops);
+	}
+}
+
+int wheel_model_init(struct wheel_model *model, unsigned int rate,
+		unsigned int depth)
+{
+	*model = (struct wheel_model){ .rate = rate, .depth = depth ? depth : 1 };
+
+	model->done = calloc(model->depth, sizeof(*model->done));
+	return model->done ? 0 : -ENOMEM;
+}
+
+void wheel_model_destroy(struct wheel_model *model)
+{
+	free(model->done);
+	model->done = NULL;
+}
+
+uint64_t wheel_model_ingest(struct wheel_model *model, uint64_t now)
+{
+	uint64_t start, accept;
+
+	model->reports++;
+	if (!model->rate)
+		return now;
+
+	/* the host doesn't get to the next report before the wheel took the
+	 * last one */
+	accept = now > model->accepted ? now : model->accepted;
+
+	/* whatever is done by then has left the queue */
+	while (model->count && model->done[model->head] <= accept) {
+		model->head = (model->head + 1) % model->depth;
+		model->count--;
+	}
+
+	/* no room, so the report stays with the host until there is */
+	if (model->count == model->depth) {
+		accept = model->done[model->head];
+		model->head = (model->head + 1) % model->depth;
+		model->count--;
+	}
+
+	if (accept > now)
+		wheel_hist_add(&model->stalls, accept - now);
+	model->accepted = accept;
+
+	start = model->busy_until > accept ? model->busy_until : accept;
+	model->busy_until = start + 1000000000ull / model->rate;
+	model->done[(model->head + model->count) % model->depth] = model->busy_until;
+	model->count++;
+	if (model->count > model->max_count)
+		model->max_count = model->count;
+
+	wheel_hist_add(&model->waits, start - accept);
+	return accept;
+}
+
+void wheel_model_print(const struct wheel_model *model)
+{
+	printf("reports %lu", model->reports);
+	if (!model->rate) {
+		printf(", no rate limit\n");
+		return;
+	}
+
+	printf(", rate %u/s, depth %u, max queued %u\n", model->rate,
+			model->depth, model->max_count);
+	wheel_hist_print(&model->stalls, "host stalled for room");
+	wheel_hist_print(&model->waits, "queued in the wheel");
+}
+
+void wheel_hist_add(struct wheel_hist *hist, uint64_t ns)
+{
+	int bucket = ns < 1000 ? 0 : 64 - __builtin_clzll(ns / 1000);
+
+	hist->count++;
+	hist->total_ns += ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+	hist->buckets[bucket < 32 ? bucket : 31]++;
+}
+
+void wheel_hist_print(const struct wheel_hist *hist, const char *name)
+{
+	int i;
+
+	printf("%s: %lu", name, hist->count);
+	if (!hist->count) {
+		printf("\n");
+		return;
+	}
+
+	printf(", mean %llu us, max %llu us\n",
+			(unsigned long long)(hist->total_ns / hist->count / 1000),
+			(unsigned long long)hist->max_ns / 1000);
+
+	for (i = 0; i < 32; ++i) {
+		if (hist->buckets[i])
+			printf("  < %8llu us: %lu\n", 1ull << i, hist->buckets[i]);
+	}
+}
+
+uint64_t wheel_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __TMFF2_EMU_WHEEL_H
+#define __TMFF2_EMU_WHEEL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WHEEL_VENDOR_ID		0x044f
+#define WHEEL_SLOTS		16
+#define WHEEL_REPORT_ID		0x60
+
+/* the wheel's side of the T300RS protocol, see force-effects.txt. Every
+ * report the driver sends is decoded back into the slots it touched */
+struct wheel_slot {
+	/* upload code of the effect in the slot, 0 if it's empty */
+	uint8_t kind;
+	uint8_t waveform;
+	bool playing;
+	/* the effect's attributes, in the order the modify packets use them */
+	uint16_t values[4];
+	uint16_t envelope[4];
+	uint16_t duration;
+
+	unsigned long uploads;
+	unsigned long modifies;
+	unsigned long plays;
+	unsigned long stops;
+};
+
+struct wheel_state {
+	struct wheel_slot slots[WHEEL_SLOTS];
+	bool open;
+	uint8_t gain;
+	uint16_t autocenter;
+	uint16_t range;
+
+	unsigned long packets;
+	unsigned long settings;
+	unsigned long unknown;
+};
+
+/* decode one output report, without the report id. Returns the slot the
+ * report was for, -1 for settings and -EINVAL for anything we don't know */
+int wheel_decode(struct wheel_state *wheel, const uint8_t *buf, size_t len);
+void wheel_print(const struct wheel_state *wheel);
+
+/* log2 histogram of durations, in us */
+struct wheel_hist {
+	unsigned long count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	unsigned long buckets[32];
+};
+
+void wheel_hist_add(struct wheel_hist *hist, uint64_t ns);
+void wheel_hist_print(const struct wheel_hist *hist, const char *name);
+
+/* how fast the wheel takes reports. A wheel that's busy doesn't take the
+ * next report off the bus, so once depth reports are waiting the host has
+ * to wait too */
+struct wheel_model {
+	/* reports per second, 0 to take them as fast as they come */
+	unsigned int rate;
+	unsigned int depth;
+
+	/* when each waiting report is done, oldest first */
+	uint64_t *done;
+	unsigned int head;
+	unsigned int count;
+	uint64_t busy_until;
+	/* when the last report got in, the next one can't get in before */
+	uint64_t accepted;
+
+	unsigned long reports;
+	unsigned int max_count;
+	/* time reports spent waiting for room, holding up the host */
+	struct wheel_hist stalls;
+	/* time reports spent queued in the wheel */
+	struct wheel_hist waits;
+};
+
+int wheel_model_init(struct wheel_model *model, unsigned int rate,
+		unsigned int depth);
+void wheel_model_destroy(struct wheel_model *model);
+/* a report arrived at now, returns when the wheel took it, which is later
+ * than now if the host had to wait for room */
+uint64_t wheel_model_ingest(struct wheel_model *model, uint64_t now);
+void wheel_model_print(const struct wheel_model *model);
+
+/* a game, updating constant effects on the wheel's event device at
+ * a fixed rate. Latency is from the start of a frame to the first effect
+ * report of that frame reaching the wheel */
+struct wheel_workload {
+	unsigned int product;
+	unsigned int effects;
+	unsigned int hz;
+
+	pthread_t thread;
+	atomic_bool stop;
+	atomic_uint_fast64_t frame;
+	atomic_uint_fast64_t frame_ns;
+	/* the last frame a report was matched to, emulator side only */
+	uint64_t seen;
+
+	unsigned long frames;
+	struct wheel_hist ioctls;
+	struct wheel_hist latency;
+};
+
+int wheel_workload_start(struct wheel_workload *workload);
+void wheel_workload_stop(struct wheel_workload *workload);
+/* an effect report reached the wheel at now */
+void wheel_workload_report(struct wheel_workload *workload, uint64_t now);
+void wheel_workload_print(const struct wheel_workload *workload);
+
+/* the report descriptor the driver installs for product, from the driver's
+ * own report_fixup */
+const uint8_t *wheel_rdesc(unsigned int product, unsigned int *size);
+
+uint64_t wheel_now(void);
+
+#endif
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPL-2.0
+/* a force feedback workload on the emulated wheel's event device */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include "wheel.h"
+
+#define WHEEL_WORKLOAD_MAX_EFFECTS 16
+
+static unsigned int wheel_read_hex(const char *path)
+{
+	unsigned int value = 0;
+	FILE *file = fopen(path, "r");
+
+	if (!file)
+		return 0;
+
+	if (fscanf(file, "%x", &value) != 1)
+		value = 0;
+	fclose(file);
+	return value;
+}
+
+/* the event device of the wheel, once the driver has bound to it */
+static int wheel_open_event(unsigned int product)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	int fd = -1;
+
+	if (!(dir = opendir("/sys/class/input")))
+		return -1;
+
+	while (fd < 0 && (entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "event", 5))
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/class/input/%s/device/id/vendor",
+				entry->d_name);
+		if (wheel_read_hex(path) != WHEEL_VENDOR_ID)
+			continue;
+
+		snprintf(path, sizeof(path), "/sys/class/input/%s/device/id/product",
+				entry->d_name);
+		if (wheel_read_hex(path) != product)
+			continue;
+
+		snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+		fd = open(path, O_RDWR);
+	}
+
+	closedir(dir);
+	return fd;
+}
+
+static int wheel_play(int fd, int id, int value)
+{
+	struct input_event event = {
+		.type = EV_FF,
+		.code = id,
+		.value = value,
+	};
+
+	return write(fd, &event, sizeof(event)) == sizeof(event) ? 0 : -errno;
+}
+
+static void *wheel_workload_run(void *data)
+{
+	struct wheel_workload *workload = data;
+	struct ff_effect effects[WHEEL_WORKLOAD_MAX_EFFECTS];
+	struct timespec next;
+	uint64_t start;
+	unsigned int i;
+	int fd, tries;
+
+	/* the driver binds asynchronously, give it a moment */
+	for (tries = 0; (fd = wheel_open_event(workload->product)) < 0; ++tries) {
+		if (tries == 100 || atomic_load(&workload->stop)) {
+			fprintf(stderr, "workload: no event device for %04x:%04x\n",
+					WHEEL_VENDOR_ID, workload->product);
+			return NULL;
+		}
+		usleep(100000);
+	}
+
+	for (i = 0; i < workload->effects; ++i) {
+		memset(&effects[i], 0, sizeof(effects[i]));
+		effects[i].type = FF_CONSTANT;
+		effects[i].id = -1;
+		effects[i].direction = 0x4000;
+		effects[i].u.constant.level = 0x1000;
+
+		if (ioctl(fd, EVIOCSFF, &effects[i]) < 0
+				|| wheel_play(fd, effects[i].id, 1)) {
+			perror("workload: uploading effect");
+			workload->effects = i;
+			goto out;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!atomic_load(&workload->stop)) {
+		atomic_store(&workload->frame_ns, wheel_now());
+		atomic_fetch_add(&workload->frame, 1);
+		workload->frames++;
+
+		for (i = 0; i < workload->effects; ++i) {
+			effects[i].u.constant.level = workload->frames & 1 ?
+				0x2000 : 0x1000;
+			start = wheel_now();
+			if (ioctl(fd, EVIOCSFF, &effects[i]) < 0) {
+				perror("workload: updating effect");
+				goto out;
+			}
+			wheel_hist_add(&workload->ioctls, wheel_now() - start);
+		}
+
+		next.tv_nsec += 1000000000l / workload->hz;
+		if (next.tv_nsec >= 1000000000l) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000l;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+out:
+	for (i = 0; i < workload->effects; ++i) {
+		wheel_play(fd, effects[i].id, 0);
+		ioctl(fd, EVIOCRMFF, effects[i].id);
+	}
+	close(fd);
+	return NULL;
+}
+
+int wheel_workload_start(struct wheel_workload *workload)
+{
+	if (workload->effects > WHEEL_WORKLOAD_MAX_EFFECTS)
+		workload->effects = WHEEL_WORKLOAD_MAX_EFFECTS;
+	if (!workload->hz)
+		workload->hz = 1;
+
+	atomic_init(&workload->stop, false);
+	atomic_init(&workload->frame, 0);
+	atomic_init(&workload->frame_ns, 0);
+	return -pthread_create(&workload->thread, NULL, wheel_workload_run,
+			workload);
+}
+
+void wheel_workload_stop(struct wheel_workload *workload)
+{
+	atomic_store(&workload->stop, true);
+	pthread_join(workload->thread, NULL);
+}
+
+void wheel_workload_report(struct wheel_workload *workload, uint64_t now)
+{
+	uint64_t frame = atomic_load(&workload->frame);
+	uint64_t start = atomic_load(&workload->frame_ns);
+
+	/* only the first report of a frame, and not if the workload has
+	 * already moved on to the next one */
+	if (!frame || frame == workload->seen || now < start)
+		return;
+
+	workload->seen = frame;
+	wheel_hist_add(&workload->latency, now - start);
+}
+
+void wheel_workload_print(const struct wheel_workload *workload)
+{
+	printf("workload: %u effects at %u Hz, %lu frames\n", workload->effects,
+			workload->hz, workload->frames);
+	wheel_hist_print(&workload->ioctls, "EVIOCSFF");
+	wheel_hist_print(&workload->latency, "frame to first report");
+}